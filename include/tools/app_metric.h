@@ -9,7 +9,7 @@ namespace yosemite {
 
 class AppMetrics final : public Tool {
 public:
-    AppMetrics() : Tool(APP_METRICE) {}
+    AppMetrics();
 
     ~AppMetrics() {}
 
@@ -21,6 +21,10 @@ public:
 
     void mem_free_callback(std::shared_ptr<MemFree_t> mem);
 
+    void ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten);
+
+    void ten_free_callback(std::shared_ptr<TenFree_t> ten);
+
     void evt_callback(EventPtr_t evt);
 
     void gpu_data_analysis(void* data, uint64_t size);
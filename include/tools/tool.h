@@ -19,10 +19,16 @@ public:
     virtual void query_ranges(void* ranges, uint32_t limit, uint32_t* count) = 0;
 
     virtual void flush() = 0;
+
+    // Set while the iteration detector sees a steady training loop;
+    // expensive tools skip their per-kernel work until it is cleared.
+    void set_steady_state(bool steady) { _steady_state = steady; }
 protected:
     AnalysisTool_t _tool;
 
     bool _torch_enabled = false;
+
+    bool _steady_state = false;
 };
 
 }   // yosemite
@@ -6,7 +6,19 @@ typedef enum {
     APP_METRICE = 1,
     MEM_TRACE = 2,
     HOT_ANALYSIS = 3,
-    TOOL_NUMS = 4
+    COALESCING = 4,
+    REUSE_DISTANCE = 5,
+    CACHE_SIM = 6,
+    TLB_ANALYSIS = 7,
+    ACCESS_PATTERN = 8,
+    WARP_SHARING = 9,
+    BANK_CONFLICT = 10,
+    WARP_IMBALANCE = 11,
+    OBJECT_PROFILE = 12,
+    FRAGMENTATION = 13,
+    LIFETIME = 14,
+    UVM_SIM = 15,
+    TOOL_NUMS = 16
 } AnalysisTool_t;
 
 #endif // TOOL_TYPE_H
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef YOSEMITE_UTILS_ACCESS_FLAGS_H
+#define YOSEMITE_UTILS_ACCESS_FLAGS_H
+
+#include <cstdint>
+
+namespace yosemite {
+
+// Bits of MemoryAccess::flags as forwarded by the GPU patch
+// (Sanitizer_DeviceMemoryFlags).
+constexpr uint32_t ACCESS_FLAG_READ = 0x1;
+constexpr uint32_t ACCESS_FLAG_WRITE = 0x2;
+constexpr uint32_t ACCESS_FLAG_ATOMIC = 0x4;
+// Not a Sanitizer flag: set by patches that also record shared-memory
+// accesses. Tools let YOSEMITE_SHARED_MEM_FLAG pick a different bit.
+constexpr uint32_t ACCESS_FLAG_SHARED = 0x100;
+
+static inline bool access_is_write(uint32_t flags) {
+    return (flags & (ACCESS_FLAG_WRITE | ACCESS_FLAG_ATOMIC)) != 0;
+}
+
+static inline bool access_is_atomic(uint32_t flags) {
+    return (flags & ACCESS_FLAG_ATOMIC) != 0;
+}
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_ACCESS_FLAGS_H
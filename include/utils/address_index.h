@@ -0,0 +1,92 @@
+#ifndef YOSEMITE_UTILS_ADDRESS_INDEX_H
+#define YOSEMITE_UTILS_ADDRESS_INDEX_H
+
+#include "utils/event.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace yosemite {
+
+/**
+ * Maps device addresses to the live object (allocation or tensor) that
+ * contains them. Objects only change between kernels while lookups happen
+ * per access, so lookups go to a sorted flat array that is rebuilt lazily
+ * after a change, and the last hit is checked before searching.
+ */
+class AddressIndex {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    typedef struct Entry {
+        DevPtr start;
+        DevPtr end;
+        uint32_t id;
+    } Entry_t;
+
+    void insert(DevPtr addr, uint64_t size, uint32_t id) {
+        _objects[addr] = Entry_t{addr, addr + size, id};
+        _dirty = true;
+    }
+
+    void erase(DevPtr addr) {
+        if (_objects.erase(addr) > 0) {
+            _dirty = true;
+        }
+    }
+
+    void refresh() {
+        if (!_dirty) {
+            return;
+        }
+        _sorted.clear();
+        _sorted.reserve(_objects.size());
+        for (auto& it : _objects) {
+            _sorted.push_back(it.second);
+        }
+        _hint = 0;
+        _dirty = false;
+    }
+
+    uint32_t find(uint64_t addr) {
+        refresh();
+        return find(addr, _hint);
+    }
+
+    // For concurrent readers: refresh() first and keep one hint per thread.
+    uint32_t find(uint64_t addr, size_t& hint) const {
+        if (hint < _sorted.size() && addr >= _sorted[hint].start && addr < _sorted[hint].end) {
+            return _sorted[hint].id;
+        }
+        auto it = std::upper_bound(_sorted.begin(), _sorted.end(), addr,
+                                   [](uint64_t a, const Entry_t& e) { return a < e.start; });
+        if (it == _sorted.begin()) {
+            return NONE;
+        }
+        --it;
+        if (addr >= it->end) {
+            return NONE;
+        }
+        hint = it - _sorted.begin();
+        return it->id;
+    }
+
+    const std::vector<Entry_t>& entries() {
+        refresh();
+        return _sorted;
+    }
+
+    size_t size() const { return _objects.size(); }
+
+private:
+    std::map<DevPtr, Entry_t> _objects;
+    std::vector<Entry_t> _sorted;
+    size_t _hint = 0;
+    bool _dirty = false;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_ADDRESS_INDEX_H
@@ -0,0 +1,105 @@
+#ifndef YOSEMITE_UTILS_CACHE_MODEL_H
+#define YOSEMITE_UTILS_CACHE_MODEL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace yosemite {
+
+typedef enum {
+    CACHE_POLICY_LRU = 0,
+    CACHE_POLICY_FIFO = 1,
+    CACHE_POLICY_RANDOM = 2,
+    CACHE_POLICY_SRRIP = 3,
+} CachePolicy_t;
+
+typedef enum {
+    CACHE_HIT = 0,
+    CACHE_SECTOR_MISS = 1,  // line present, sector not
+    CACHE_LINE_MISS = 2,    // line allocated, possibly evicting another
+} CacheResult_t;
+
+typedef struct CacheConfig {
+    uint64_t size = 40ULL << 20;
+    uint32_t line_size = 128;
+    uint32_t sector_size = 32;
+    uint32_t assoc = 16;
+    CachePolicy_t policy = CACHE_POLICY_LRU;
+    bool hashed_index = true;
+} CacheConfig_t;
+
+typedef struct CacheStats {
+    uint64_t accesses = 0;
+    uint64_t writes = 0;
+    uint64_t hits = 0;
+    uint64_t sector_misses = 0;
+    uint64_t line_misses = 0;
+    uint64_t writebacks = 0;    // dirty sectors written back on eviction
+
+    void merge(const CacheStats& other) {
+        accesses += other.accesses;
+        writes += other.writes;
+        hits += other.hits;
+        sector_misses += other.sector_misses;
+        line_misses += other.line_misses;
+        writebacks += other.writebacks;
+    }
+
+    double hit_rate() const {
+        return accesses ? (double)hits / accesses : 0.0;
+    }
+} CacheStats_t;
+
+
+/**
+ * Sectored, set-associative, write-back / write-allocate cache.
+ * All replacement state is per set, so callers may drive disjoint groups of
+ * sets from different threads without locking; partition requests by
+ * set_of() to do so.
+ */
+class CacheModel {
+public:
+    CacheModel(const CacheConfig_t& config);
+
+    uint32_t set_of(uint64_t line) const;
+
+    // sector is the sector number (address / sector_size)
+    CacheResult_t access(uint64_t sector, bool is_write, CacheStats_t& stats);
+
+    uint32_t num_sets() const { return _num_sets; }
+
+    uint32_t sector_shift() const { return _sector_shift; }
+
+    uint32_t line_shift() const { return _line_shift; }
+
+    const CacheConfig_t& config() const { return _config; }
+
+    std::string describe() const;
+
+private:
+    typedef struct Way {
+        uint64_t line;
+        uint64_t stamp;
+        uint32_t valid;     // one bit per sector, 0 means the way is empty
+        uint32_t dirty;
+        uint8_t rrpv;
+    } Way_t;
+
+    uint32_t victim(Way_t* ways, uint32_t set, uint64_t line);
+
+    CacheConfig_t _config;
+    uint32_t _num_sets;
+    uint32_t _sector_shift;
+    uint32_t _line_shift;
+    std::vector<Way_t> _ways;
+    std::vector<uint64_t> _clocks;  // per-set logical time
+};
+
+CachePolicy_t parse_cache_policy(const std::string& name);
+
+const char* cache_policy_name(CachePolicy_t policy);
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_CACHE_MODEL_H
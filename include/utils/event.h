@@ -63,8 +63,8 @@ typedef struct KernelLauch : public Event {
     std::string kernel_name;
     uint32_t kernel_id;
     uint64_t mem_accesses;
-    uint32_t touched_objects;
-    uint32_t touched_objects_size;
+    uint64_t touched_objects;
+    uint64_t touched_objects_size;
 
     KernelLauch() {
         evt_type = EventType_KERNEL_LAUNCH;
@@ -98,7 +98,7 @@ typedef struct KernelEnd : public Event {
 typedef struct MemAlloc : public Event {
     DevPtr addr;
     uint64_t size;
-    uint64_t release_time;
+    uint64_t release_time = UINT64_MAX;     // kernel index of the free, UINT64_MAX while live
     int alloc_type;
 
     MemAlloc() {
@@ -173,7 +173,7 @@ typedef struct TenAlloc : public Event {
     int64_t size;
     int64_t allocated_size;
     int64_t reserved_size;
-    uint64_t release_time;
+    uint64_t release_time = UINT64_MAX;     // kernel index of the free, UINT64_MAX while live
 
     TenAlloc() {
         evt_type = EventType_TEN_ALLOC;
@@ -0,0 +1,57 @@
+#ifndef YOSEMITE_UTILS_FAST_HASH_H
+#define YOSEMITE_UTILS_FAST_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace yosemite {
+
+/**
+ * Streaming non-cryptographic 64-bit hash for fingerprinting large buffers.
+ * The inner loop works on four independent 64-bit accumulators (XXH3 style
+ * multiply-accumulate) and has an AVX2 path selected at runtime; both paths
+ * produce the same digest.
+ */
+class FastHash {
+public:
+    static constexpr size_t STRIPE_SIZE = 32;
+    static constexpr size_t STRIPES_PER_BLOCK = 8;
+    static constexpr size_t BLOCK_SIZE = STRIPE_SIZE * STRIPES_PER_BLOCK;
+
+    FastHash(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed = 0);
+
+    void update(const void* data, size_t len);
+
+    uint64_t digest() const;
+
+private:
+    uint64_t _acc[4];
+    uint64_t _keys[STRIPES_PER_BLOCK * 4 + 4];
+    uint8_t _buffer[BLOCK_SIZE];
+    size_t _buffer_len;
+    uint64_t _total_len;
+    uint64_t _seed;
+};
+
+uint64_t fast_hash64(const void* data, size_t len, uint64_t seed = 0);
+
+// Finalizer of MurmurHash3, for hashing single keys (addresses, IDs).
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Folds a value into a running 64-bit hash (keys made of several fields).
+static inline uint64_t hash_combine(uint64_t seed, uint64_t value) {
+    return mix64(seed ^ (mix64(value) + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_FAST_HASH_H
@@ -0,0 +1,276 @@
+#ifndef YOSEMITE_UTILS_FLAT_HASH_H
+#define YOSEMITE_UTILS_FLAT_HASH_H
+
+#include "utils/fast_hash.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace yosemite {
+
+/**
+ * Open-addressing hash tables keyed by 64-bit integers (page numbers, line
+ * addresses, ...). Linear probing over flat arrays with a load factor of at
+ * most 3/4 and backward-shift deletion: no per-entry allocation and roughly
+ * 1.5x the key/value size in memory. UINT64_MAX is reserved as the empty key.
+ */
+template <typename Value>
+class FlatHashMap {
+public:
+    static constexpr uint64_t EMPTY = UINT64_MAX;
+
+    FlatHashMap(size_t capacity = 16) { rehash(capacity); }
+
+    size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    Value* find(uint64_t key) {
+        size_t i = mix64(key) & _mask;
+        while (_keys[i] != EMPTY) {
+            if (_keys[i] == key) {
+                return &_values[i];
+            }
+            i = (i + 1) & _mask;
+        }
+        return nullptr;
+    }
+
+    // Inserts a default-constructed value when the key is missing.
+    Value& operator[](uint64_t key) {
+        return *try_emplace(key).first;
+    }
+
+    // Returns the slot and whether it was just inserted.
+    std::pair<Value*, bool> try_emplace(uint64_t key) {
+        size_t i = mix64(key) & _mask;
+        while (_keys[i] != EMPTY) {
+            if (_keys[i] == key) {
+                return {&_values[i], false};
+            }
+            i = (i + 1) & _mask;
+        }
+        if ((_size + 1) * 4 > _keys.size() * 3) {
+            rehash(_keys.size() * 2);
+            return try_emplace(key);
+        }
+        _keys[i] = key;
+        _values[i] = Value();
+        _size++;
+        return {&_values[i], true};
+    }
+
+    bool erase(uint64_t key) {
+        size_t i = mix64(key) & _mask;
+        while (_keys[i] != key) {
+            if (_keys[i] == EMPTY) {
+                return false;
+            }
+            i = (i + 1) & _mask;
+        }
+        // shift the following entries of the cluster back into the hole
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & _mask;
+            if (_keys[j] == EMPTY) {
+                break;
+            }
+            size_t home = mix64(_keys[j]) & _mask;
+            if (((j - home) & _mask) >= ((j - i) & _mask)) {
+                _keys[i] = _keys[j];
+                _values[i] = std::move(_values[j]);
+                i = j;
+            }
+        }
+        _keys[i] = EMPTY;
+        _size--;
+        return true;
+    }
+
+    void clear() {
+        // a table grown by one large kernel should not make every later clear() slow
+        if (_keys.size() > 1024 && _size * 8 < _keys.size()) {
+            // drop the entries instead of rehashing them into the small table
+            _keys.assign(16, EMPTY);
+            _keys.shrink_to_fit();
+            _values.assign(16, Value());
+            _values.shrink_to_fit();
+            _mask = 15;
+            _size = 0;
+            return;
+        }
+        std::fill(_keys.begin(), _keys.end(), EMPTY);
+        _size = 0;
+    }
+
+    void reserve(size_t n) {
+        if (n * 4 > _keys.size() * 3) {
+            rehash(n * 4 / 3 + 1);
+        }
+    }
+
+    // fn(key, value) for every entry, in table order
+    template <typename Fn>
+    void for_each(Fn fn) {
+        for (size_t i = 0; i < _keys.size(); i++) {
+            if (_keys[i] != EMPTY) {
+                fn(_keys[i], _values[i]);
+            }
+        }
+    }
+
+    size_t memory_usage() const {
+        return _keys.size() * (sizeof(uint64_t) + sizeof(Value));
+    }
+
+private:
+    void rehash(size_t capacity) {
+        size_t new_capacity = 16;
+        while (new_capacity < capacity) {
+            new_capacity <<= 1;
+        }
+        std::vector<uint64_t> keys(new_capacity, EMPTY);
+        std::vector<Value> values(new_capacity);
+        size_t mask = new_capacity - 1;
+        for (size_t i = 0; i < _keys.size(); i++) {
+            if (_keys[i] == EMPTY) {
+                continue;
+            }
+            size_t j = mix64(_keys[i]) & mask;
+            while (keys[j] != EMPTY) {
+                j = (j + 1) & mask;
+            }
+            keys[j] = _keys[i];
+            values[j] = std::move(_values[i]);
+        }
+        _keys.swap(keys);
+        _values.swap(values);
+        _mask = mask;
+    }
+
+    std::vector<uint64_t> _keys;
+    std::vector<Value> _values;
+    size_t _size = 0;
+    size_t _mask = 0;
+};
+
+
+class FlatHashSet {
+public:
+    static constexpr uint64_t EMPTY = UINT64_MAX;
+
+    FlatHashSet(size_t capacity = 16) { rehash(capacity); }
+
+    size_t size() const { return _size; }
+
+    bool contains(uint64_t key) const {
+        size_t i = mix64(key) & _mask;
+        while (_keys[i] != EMPTY) {
+            if (_keys[i] == key) {
+                return true;
+            }
+            i = (i + 1) & _mask;
+        }
+        return false;
+    }
+
+    // true when the key was not present before
+    bool insert(uint64_t key) {
+        size_t i = mix64(key) & _mask;
+        while (_keys[i] != EMPTY) {
+            if (_keys[i] == key) {
+                return false;
+            }
+            i = (i + 1) & _mask;
+        }
+        if ((_size + 1) * 4 > _keys.size() * 3) {
+            rehash(_keys.size() * 2);
+            return insert(key);
+        }
+        _keys[i] = key;
+        _size++;
+        return true;
+    }
+
+    bool erase(uint64_t key) {
+        size_t i = mix64(key) & _mask;
+        while (_keys[i] != key) {
+            if (_keys[i] == EMPTY) {
+                return false;
+            }
+            i = (i + 1) & _mask;
+        }
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & _mask;
+            if (_keys[j] == EMPTY) {
+                break;
+            }
+            size_t home = mix64(_keys[j]) & _mask;
+            if (((j - home) & _mask) >= ((j - i) & _mask)) {
+                _keys[i] = _keys[j];
+                i = j;
+            }
+        }
+        _keys[i] = EMPTY;
+        _size--;
+        return true;
+    }
+
+    void clear() {
+        if (_keys.size() > 1024 && _size * 8 < _keys.size()) {
+            _keys.assign(16, EMPTY);
+            _keys.shrink_to_fit();
+            _mask = 15;
+            _size = 0;
+            return;
+        }
+        std::fill(_keys.begin(), _keys.end(), EMPTY);
+        _size = 0;
+    }
+
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (uint64_t key : _keys) {
+            if (key != EMPTY) {
+                fn(key);
+            }
+        }
+    }
+
+    size_t memory_usage() const {
+        return _keys.size() * sizeof(uint64_t);
+    }
+
+private:
+    void rehash(size_t capacity) {
+        size_t new_capacity = 16;
+        while (new_capacity < capacity) {
+            new_capacity <<= 1;
+        }
+        std::vector<uint64_t> keys(new_capacity, EMPTY);
+        size_t mask = new_capacity - 1;
+        for (uint64_t key : _keys) {
+            if (key == EMPTY) {
+                continue;
+            }
+            size_t j = mix64(key) & mask;
+            while (keys[j] != EMPTY) {
+                j = (j + 1) & mask;
+            }
+            keys[j] = key;
+        }
+        _keys.swap(keys);
+        _mask = mask;
+    }
+
+    std::vector<uint64_t> _keys;
+    size_t _size = 0;
+    size_t _mask = 0;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_FLAT_HASH_H
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <cstddef>
+#include <cstdint>
 
 namespace yosemite {
 
@@ -10,10 +11,19 @@ std::string format_size(size_t size);
 
 std::string format_number(uint64_t number);
 
+// "40MB", "64K", "2g" or plain bytes; returns 0 if the string is not a size
+uint64_t parse_size(const std::string& str);
+
 std::string get_current_date_n_time();
 
+std::string get_output_name(const std::string& prefix);
+
 bool check_folder_existance(const std::string &folder);
 
+bool cpu_supports_avx2();
+
+bool cpu_supports_avx512();
+
 }   // yosemite
 
 #endif // YOSEMITE_UTILS_HELPER_H
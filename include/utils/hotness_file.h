@@ -0,0 +1,132 @@
+#ifndef YOSEMITE_UTILS_HOTNESS_FILE_H
+#define YOSEMITE_UTILS_HOTNESS_FILE_H
+
+#include "utils/event.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace yosemite {
+
+/**
+ * Append-only container for HotAnalysis, one record per kernel instead of one
+ * text file per kernel.
+ *
+ *   header:  "YSHOT001"
+ *   record:  kernel id, name id, range count, the touched ranges, and the
+ *            allocations / tensors added and removed since the previous record
+ *   footer:  record index (kernel id, offset, name id, keyframe flag),
+ *            kernel name table, then a fixed trailer with their offsets
+ *
+ * All integers in records, index and name table are LEB128 varints, addresses
+ * are delta coded against the previous entry. Every keyframe_interval-th
+ * record stores the full live sets so a reader replays at most that many
+ * records to rebuild the state of any kernel. The footer is written by
+ * close(); a file without it is rejected by the reader.
+ */
+typedef struct HotnessRange {
+    uint64_t start;
+    uint64_t end;
+    uint64_t touch;
+} HotnessRange_t;
+
+typedef std::vector<std::pair<DevPtr, uint64_t>> LiveSet_t;
+
+typedef struct HotnessIndexEntry {
+    uint64_t kernel_id;
+    uint64_t offset;
+    uint32_t name_id;
+    bool keyframe;
+} HotnessIndexEntry_t;
+
+typedef struct HotnessRecord {
+    uint64_t kernel_id = 0;
+    std::string kernel_name;
+    // ranges the device tracked for this kernel, only the touched ones are stored
+    uint64_t num_ranges = 0;
+    std::vector<HotnessRange_t> ranges;
+    // live allocations and tensors (addr, size) when the kernel ran, sorted by addr
+    LiveSet_t allocations;
+    LiveSet_t tensors;
+} HotnessRecord_t;
+
+
+class HotnessWriter {
+public:
+    HotnessWriter() = default;
+
+    ~HotnessWriter();
+
+    bool open(const std::string& filename, uint32_t keyframe_interval = 1024);
+
+    // kernel ids must not decrease; ranges sorted by start, live sets sorted by addr;
+    // false once a write has failed
+    bool append(uint64_t kernel_id, const std::string& kernel_name, uint64_t num_ranges,
+                const std::vector<HotnessRange_t>& ranges,
+                const LiveSet_t& allocations, const LiveSet_t& tensors);
+
+    // writes the footer, the file is unreadable before this; false if any write failed
+    bool close();
+
+    uint64_t bytes_written() const { return _offset; }
+
+    uint64_t num_records() const { return _index.size(); }
+
+private:
+    bool flush_buffer();
+
+    FILE* _file = nullptr;
+    bool _failed = false;
+    std::string _buffer;
+    uint64_t _offset = 0;
+    uint32_t _keyframe_interval = 1024;
+    LiveSet_t _allocations;
+    LiveSet_t _tensors;
+    std::vector<HotnessIndexEntry_t> _index;
+    std::map<std::string, uint32_t> _name_ids;
+    std::vector<std::string> _names;
+};
+
+
+class HotnessReader {
+public:
+    HotnessReader() = default;
+
+    ~HotnessReader();
+
+    bool open(const std::string& filename);
+
+    size_t size() const { return _index.size(); }
+
+    const std::vector<HotnessIndexEntry_t>& index() const { return _index; }
+
+    const std::string& kernel_name(uint32_t name_id) const { return _names[name_id]; }
+
+    // i-th record in file order
+    bool read(size_t i, HotnessRecord_t& record);
+
+    bool read_kernel(uint64_t kernel_id, HotnessRecord_t& record);
+
+    // positions of all records of the kernels with this name
+    std::vector<size_t> find(const std::string& kernel_name) const;
+
+private:
+    bool decode(size_t i, HotnessRecord_t* record);
+
+    FILE* _file = nullptr;
+    std::vector<HotnessIndexEntry_t> _index;
+    std::vector<std::string> _names;
+    uint64_t _records_end = 0;
+    // live sets after decoding record _cursor, lets sequential reads skip the replay
+    size_t _cursor = SIZE_MAX;
+    std::map<DevPtr, uint64_t> _allocations;
+    std::map<DevPtr, uint64_t> _tensors;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_HOTNESS_FILE_H
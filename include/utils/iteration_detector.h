@@ -0,0 +1,80 @@
+#ifndef YOSEMITE_UTILS_ITERATION_DETECTOR_H
+#define YOSEMITE_UTILS_ITERATION_DETECTOR_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace yosemite {
+
+/**
+ * Online detection of the training-step period.
+ * Kernel launches and allocations are interned into a token stream; a rolling
+ * polynomial hash over the stream tells in O(1) whether the last
+ * confirm * p tokens repeat with period p. Once locked, every new token is
+ * compared against the token one period earlier, and any mismatch (eval,
+ * checkpointing, a new phase) drops the lock. While locked, every
+ * recheck-th iteration is reported as not steady so tools refresh their view.
+ */
+class IterationDetector {
+public:
+    IterationDetector(uint32_t max_period, uint32_t confirm_periods, uint32_t recheck_interval);
+
+    ~IterationDetector() = default;
+
+    // Both return true when steady() changed.
+    bool on_kernel(const std::string& kernel_name);
+
+    bool on_alloc(uint64_t size);
+
+    bool steady() const { return _locked && !_rechecking; }
+
+    uint32_t period() const { return _period; }
+
+    uint64_t iterations() const { return _iterations; }
+
+private:
+    bool push(uint32_t token);
+
+    bool periodic(uint32_t p) const;
+
+    bool verify(uint32_t p) const;
+
+    void lock(uint32_t p);
+
+    void unlock();
+
+    uint64_t window_hash(uint64_t begin, uint64_t end) const;
+
+    uint32_t token_at(uint64_t i) const { return _tokens[i % _capacity]; }
+
+    uint32_t _max_period;
+    uint32_t _confirm_periods;
+    uint32_t _recheck_interval;
+
+    std::unordered_map<std::string, uint32_t> _kernel_ids;
+    std::unordered_map<uint64_t, uint32_t> _alloc_ids;
+    uint32_t _next_id = 1;
+
+    // ring buffers over the last _capacity tokens
+    uint64_t _capacity;
+    uint64_t _num_tokens = 0;
+    std::vector<uint32_t> _tokens;
+    std::vector<uint64_t> _prefix;
+    std::vector<uint64_t> _powers;
+    std::unordered_map<uint32_t, std::deque<uint64_t>> _positions;
+
+    bool _locked = false;
+    bool _rechecking = false;
+    uint32_t _period = 0;
+    uint32_t _min_period = 0;
+    uint64_t _lock_position = 0;
+    uint64_t _unlock_position = 0;
+    uint64_t _iterations = 0;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_ITERATION_DETECTOR_H
@@ -0,0 +1,56 @@
+#ifndef YOSEMITE_UTILS_KLL_SKETCH_H
+#define YOSEMITE_UTILS_KLL_SKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace yosemite {
+
+/**
+ * KLL quantile sketch (Karnin, Lang, Liberty). Values go into a stack of
+ * compactors; a full compactor sorts itself and promotes every other item,
+ * chosen with a random offset, to the next level where it weighs twice as
+ * much. Capacities shrink by 2/3 per level below the top, so the sketch holds
+ * O(k log(n / k)) values and the rank error is about 1.7 / k. Sketches with
+ * the same k merge level by level.
+ */
+class KLLSketch {
+public:
+    KLLSketch(uint32_t k = 200);
+
+    void update(double value);
+
+    void merge(const KLLSketch& other);
+
+    // value at rank q * count(), 0 when empty
+    double quantile(double q) const;
+
+    uint64_t count() const { return _count; }
+
+    double min() const { return _min; }
+
+    double max() const { return _max; }
+
+    size_t retained() const { return _size; }
+
+private:
+    uint32_t capacity(uint32_t level) const;
+
+    void grow();
+
+    void compress();
+
+    std::vector<std::vector<double>> _compactors;
+    uint32_t _k;
+    size_t _size = 0;
+    size_t _max_size = 0;
+    uint64_t _count = 0;
+    double _min = 0;
+    double _max = 0;
+    uint64_t _random;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_KLL_SKETCH_H
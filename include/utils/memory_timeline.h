@@ -0,0 +1,97 @@
+#ifndef YOSEMITE_UTILS_MEMORY_TIMELINE_H
+#define YOSEMITE_UTILS_MEMORY_TIMELINE_H
+
+#include "utils/event.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace yosemite {
+
+typedef struct LiveObject {
+    DevPtr addr;
+    uint64_t size;
+    // allocation order, unique over the run
+    uint64_t seq;
+    uint64_t alloc_time;
+} LiveObject_t;
+
+typedef struct UsageBucket {
+    uint64_t start;
+    uint64_t min;
+    uint64_t max;
+} UsageBucket_t;
+
+// live set changes from the previous recorded peak to this one, keyed by seq
+typedef struct PeakDelta {
+    uint64_t time;
+    uint64_t usage;
+    std::map<uint64_t, LiveObject_t> added;
+    std::vector<uint64_t> removed;
+} PeakDelta_t;
+
+
+/**
+ * Memory usage over time for one kind of object (allocations or tensors).
+ *
+ * The usage series is kept as at most num_buckets min/max buckets; when time
+ * runs past the last one, neighbouring buckets are merged and the bucket
+ * width doubles, so memory stays constant however long the run is.
+ *
+ * Peaks are recorded as live set deltas: the changes since the previous peak
+ * are accumulated (an object allocated and freed in between cancels out) and
+ * attached to the peak when usage climbs above it. Usage that grows by less
+ * than peak_step (a fraction of the last peak) amends the last peak instead of
+ * adding one, so the last peak is always the exact maximum and a steady ramp
+ * does not produce one peak per allocation.
+ */
+class MemoryTimeline {
+public:
+    MemoryTimeline(uint32_t num_buckets = 1024, double peak_step = 0.01);
+
+    void alloc(DevPtr addr, uint64_t size, uint64_t time);
+
+    void free(DevPtr addr, uint64_t time);
+
+    // carry the current usage forward to time, e.g. at the end of the run
+    void extend(uint64_t time) { record(time, _usage); }
+
+    uint64_t usage() const { return _usage; }
+
+    uint64_t peak() const { return _peaks.empty() ? 0 : _peaks.back().usage; }
+
+    uint64_t num_allocs() const { return _seq; }
+
+    const std::vector<PeakDelta_t>& peaks() const { return _peaks; }
+
+    const std::vector<UsageBucket_t>& buckets() const { return _buckets; }
+
+    uint64_t bucket_width() const { return _width; }
+
+    // live set at the i-th recorded peak, in allocation order
+    std::vector<LiveObject_t> live_at_peak(size_t i) const;
+
+private:
+    // usage went from before to _usage at time
+    void record(uint64_t time, uint64_t before);
+
+    void merge_pending(PeakDelta_t& peak);
+
+    std::map<DevPtr, LiveObject_t> _live;
+    uint64_t _usage = 0;
+    uint64_t _seq = 0;
+
+    double _peak_step;
+    std::map<uint64_t, LiveObject_t> _pending_added;
+    std::vector<uint64_t> _pending_removed;
+    std::vector<PeakDelta_t> _peaks;
+
+    uint32_t _num_buckets;
+    uint64_t _width = 1;
+    std::vector<UsageBucket_t> _buckets;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_MEMORY_TIMELINE_H
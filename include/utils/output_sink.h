@@ -0,0 +1,51 @@
+#ifndef YOSEMITE_UTILS_OUTPUT_SINK_H
+#define YOSEMITE_UTILS_OUTPUT_SINK_H
+
+#include <cstdint>
+#include <string>
+#include <memory>
+
+namespace yosemite {
+
+typedef enum {
+    OUTPUT_SINK_SYNC = 0,
+    OUTPUT_SINK_PWRITE = 1,
+    OUTPUT_SINK_IO_URING = 2,
+} OutputSinkType_t;
+
+
+/**
+ * Output layer for the tools that dump one file per kernel.
+ * submit() takes ownership of a complete file image and returns without
+ * touching the disk; the backend creates, writes and closes the file on its
+ * own thread(s). drain() blocks until everything submitted so far is written.
+ */
+class OutputSink {
+public:
+    OutputSink(OutputSinkType_t type) : _type(type) {}
+
+    virtual ~OutputSink() = default;
+
+    virtual void submit(const std::string& filename, std::string&& data) = 0;
+
+    virtual void drain() = 0;
+
+    OutputSinkType_t type() const { return _type; }
+
+protected:
+    OutputSinkType_t _type;
+};
+
+
+/**
+ * Create the sink selected by YOSEMITE_OUTPUT_SINK ("io_uring", "pwrite" or "sync").
+ * io_uring is the default; when the kernel refuses to set up a ring the
+ * pwrite thread pool is used instead.
+ */
+std::shared_ptr<OutputSink> create_output_sink();
+
+const char* output_sink_name(OutputSinkType_t type);
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_OUTPUT_SINK_H
@@ -0,0 +1,54 @@
+#ifndef YOSEMITE_UTILS_SPACE_SAVING_H
+#define YOSEMITE_UTILS_SPACE_SAVING_H
+
+#include "utils/flat_hash.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace yosemite {
+
+/**
+ * Space-Saving heavy hitters over weighted 64-bit keys with a fixed number of
+ * counters. A key that is not tracked takes over the smallest counter and
+ * inherits its count as error, so count - error <= true weight <= count and
+ * every key heavier than total / capacity is guaranteed to be kept.
+ * Counters sit in a min-heap indexed by key: O(log capacity) per update.
+ */
+class SpaceSaving {
+public:
+    typedef struct Counter {
+        uint64_t key;
+        uint64_t count;
+        uint64_t error;
+    } Counter_t;
+
+    SpaceSaving(uint32_t capacity = 64);
+
+    void add(uint64_t key, uint64_t weight = 1);
+
+    // tracked counters, heaviest first
+    std::vector<Counter_t> top() const;
+
+    uint64_t total() const { return _total; }
+
+    uint32_t capacity() const { return _capacity; }
+
+    void clear();
+
+private:
+    void sift_up(uint32_t i);
+
+    void sift_down(uint32_t i);
+
+    void swap_counters(uint32_t i, uint32_t j);
+
+    std::vector<Counter_t> _heap;
+    FlatHashMap<uint32_t> _position;
+    uint32_t _capacity;
+    uint64_t _total = 0;
+};
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_SPACE_SAVING_H
@@ -0,0 +1,86 @@
+#ifndef YOSEMITE_UTILS_STACK_DISTANCE_H
+#define YOSEMITE_UTILS_STACK_DISTANCE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace yosemite {
+
+/**
+ * LRU stack (reuse) distance over a stream of block ids.
+ * A Fenwick tree over logical time marks the last access of every block, the
+ * distance of a reuse is the number of marks after the block's previous
+ * access: O(log n) per access. Time is renumbered once the tree fills up, so
+ * memory stays proportional to the number of distinct blocks however long the
+ * stream is.
+ *
+ * With a sampling rate below 1 only blocks whose hash falls under the SHARDS
+ * threshold are tracked and distances are scaled by 1 / rate. max_tracked
+ * bounds the tracked set by lowering the threshold (fixed-size SHARDS).
+ */
+class StackDistance {
+public:
+    static constexpr uint64_t COLD = UINT64_MAX;
+    static constexpr uint64_t SKIPPED = UINT64_MAX - 1;
+
+    StackDistance(double sampling_rate = 1.0, uint64_t max_tracked = 0);
+
+    // distance in blocks, COLD on first touch, SKIPPED when filtered out by sampling
+    uint64_t access(uint64_t block);
+
+    void reset();
+
+    uint64_t tracked() const { return _last.size(); }
+
+    double rate() const;
+
+private:
+    uint64_t prefix(uint64_t pos) const;
+
+    void update(uint64_t pos, int32_t delta);
+
+    void compact();
+
+    void shrink_sample();
+
+    std::unordered_map<uint64_t, uint64_t> _last;
+    std::vector<int32_t> _tree;
+    std::vector<uint64_t> _owner;
+    uint64_t _now = 0;
+    uint64_t _capacity;
+    uint64_t _threshold;
+    // configured rate, _threshold only goes down from it while a fixed-size sample fills up
+    uint64_t _initial_threshold;
+    uint64_t _max_tracked;
+};
+
+
+/**
+ * log2-bucketed distance histogram: buckets[0] holds distance 0, buckets[k]
+ * holds [2^(k-1), 2^k). Capacities that are powers of two fall on bucket
+ * boundaries, so miss_ratio() is exact for them (fully associative LRU).
+ * Counts are weighted so that samples taken while a fixed-size SHARDS stack
+ * was still at a higher rate do not dominate the later ones.
+ */
+typedef struct ReuseHistogram {
+    static constexpr uint32_t NUM_BUCKETS = 65;
+
+    double buckets[NUM_BUCKETS] = {0};
+    double cold = 0;
+    double total = 0;
+
+    // weight is 1 / sampling rate at the time of the access
+    void add(uint64_t distance, double weight = 1.0);
+
+    void merge(const ReuseHistogram& other);
+
+    double miss_ratio(uint64_t capacity) const;
+
+    // largest non-empty bucket, 0 when only cold misses were seen
+    uint32_t max_bucket() const;
+} ReuseHistogram_t;
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_STACK_DISTANCE_H
@@ -0,0 +1,61 @@
+#ifndef YOSEMITE_UTILS_THREAD_POOL_H
+#define YOSEMITE_UTILS_THREAD_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+namespace yosemite {
+
+/**
+ * Work-stealing thread pool. Every worker owns a deque; tasks submitted from
+ * a worker go to its own deque and are popped LIFO, idle workers steal FIFO
+ * from the others. Tasks submitted from outside are spread round-robin.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    ThreadPool(uint32_t num_threads);
+
+    ~ThreadPool();
+
+    void submit(Task task);
+
+    // Block until every submitted task, including tasks they spawned, has run.
+    void wait();
+
+    uint32_t size() const { return _workers.size(); }
+
+private:
+    typedef struct WorkerQueue {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    } WorkerQueue_t;
+
+    void worker_loop(uint32_t index);
+
+    bool pop_task(uint32_t index, Task& task);
+
+    std::vector<std::unique_ptr<WorkerQueue_t>> _queues;
+    std::vector<std::thread> _workers;
+    std::atomic<uint64_t> _queued{0};
+    std::atomic<uint64_t> _next_queue{0};
+    uint64_t _unfinished = 0;
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+    bool _stop = false;
+};
+
+uint32_t default_thread_count(const char* env_name);
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_THREAD_POOL_H
@@ -0,0 +1,28 @@
+#ifndef YOSEMITE_UTILS_TOUCH_REDUCE_H
+#define YOSEMITE_UTILS_TOUCH_REDUCE_H
+
+#include <cstdint>
+
+namespace yosemite {
+
+typedef struct TouchSummary {
+    uint64_t objects = 0;
+    uint64_t bytes = 0;
+    uint64_t touches = 0;
+} TouchSummary_t;
+
+/**
+ * One pass over the range / touch arrays of a MemoryAccessState: number of
+ * touched ranges, their total size and the sum of their touch counts, all in
+ * 64 bits. start_end holds n (start, end) pairs. When bitmap is not null it
+ * receives (n + 63) / 64 words with bit i set for a touched range i.
+ * Scalar, AVX2 and AVX-512 versions, picked once at load time like warp_simd.
+ */
+TouchSummary_t touch_reduce(const uint64_t* start_end, const uint32_t* touch, uint32_t n,
+                            uint64_t* bitmap = nullptr);
+
+const char* touch_reduce_isa();
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_TOUCH_REDUCE_H
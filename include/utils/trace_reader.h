@@ -0,0 +1,51 @@
+#ifndef YOSEMITE_UTILS_TRACE_READER_H
+#define YOSEMITE_UTILS_TRACE_READER_H
+
+#include "utils/event.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace yosemite {
+
+typedef struct TraceRecord {
+    uint64_t page;
+    uint64_t address;
+    uint32_t access_size;
+    uint64_t timer;
+    uint32_t flags;
+    uint64_t warp_id;
+} TraceRecord_t;
+
+typedef struct KernelTrace {
+    std::vector<TraceRecord_t> records;
+    std::vector<std::pair<DevPtr, uint64_t>> allocations;
+    std::vector<std::pair<DevPtr, uint64_t>> tensors;
+    uint64_t start_time = 0;
+    uint64_t end_time = 0;
+    // set when the file is a deduplicated reference to an earlier kernel
+    bool is_reference = false;
+    uint32_t reference_kernel_id = 0;
+    uint64_t reference_timer_base = 0;
+    uint64_t reference_accesses = 0;
+    // set when MemTrace ran with YOSEMITE_TRACE_SAMPLING, counts scale by seen / kept
+    bool is_sampled = false;
+    uint64_t sampling_seen_accesses = 0;
+    uint64_t sampling_kept_accesses = 0;
+    double sampling_warp_rate = 1.0;
+    double sampling_spatial_rate = 1.0;
+} KernelTrace_t;
+
+/**
+ * Load kernel_<kernel_id>.txt from a MemTrace output directory. With expand set,
+ * a REFERENCE record is replaced by the referenced kernel's accesses rebased
+ * onto this kernel's allocations and timer.
+ */
+bool read_kernel_trace(const std::string& directory, uint32_t kernel_id,
+                       KernelTrace_t& trace, bool expand = true);
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_TRACE_READER_H
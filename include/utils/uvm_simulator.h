@@ -0,0 +1,136 @@
+#ifndef YOSEMITE_UTILS_UVM_SIMULATOR_H
+#define YOSEMITE_UTILS_UVM_SIMULATOR_H
+
+#include "utils/event.h"
+#include "utils/flat_hash.h"
+#include "utils/address_index.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace yosemite {
+
+typedef enum {
+    UVM_POLICY_LRU = 0,
+    UVM_POLICY_LFU = 1,
+    UVM_POLICY_BELADY = 2,
+    UVM_POLICY_NUMS = 3
+} UvmPolicy_t;
+
+// pages [first, first + count) in the dense page numbering
+typedef struct PageRun {
+    uint32_t first;
+    uint32_t count;
+} PageRun_t;
+
+typedef struct UvmResult {
+    UvmPolicy_t policy;
+    uint64_t capacity_pages;
+    uint64_t touches = 0;
+    uint64_t faults = 0;
+    uint64_t cold_faults = 0;           // first touch of a page
+    uint64_t refaults = 0;              // touch of a page evicted earlier
+    uint64_t forced_evictions = 0;      // working set of the kernel larger than the capacity
+    uint64_t evictions = 0;
+    uint64_t migrated_in = 0;           // pages
+    uint64_t migrated_out = 0;          // pages
+    uint64_t thrashing_launches = 0;
+    // per kernel name id
+    std::vector<uint64_t> name_refaults;
+    std::vector<uint64_t> name_thrashing_launches;
+} UvmResult_t;
+
+
+/**
+ * Unified-memory oversubscription model.
+ *
+ * Allocations are numbered densely in pages of page_size bytes, each one a
+ * contiguous block of page ids that is never reused, so every touched range is
+ * a single run of ids. The pages a launch touches are sorted, merged into runs
+ * and interned: identical page sets (the same kernel in every iteration) are
+ * stored once and a launch costs two 32-bit words in the trace.
+ *
+ * simulate() replays the trace against a device holding capacity_pages pages.
+ * A missing page faults and migrates in; when the device is full a victim is
+ * picked by the policy among the pages not used by the current launch. If the
+ * launch alone needs more than the capacity, one of its own pages is evicted
+ * and charged one extra fault and migration, and the launch counts as
+ * thrashing. Freed allocations leave the device without migration. Belady
+ * uses the next launch touching each page, computed backward one block of
+ * launches at a time so its memory grows with sqrt(touches * pages).
+ */
+class UvmSimulator {
+public:
+    UvmSimulator(uint64_t page_size = 2 << 20);
+
+    void alloc(DevPtr addr, uint64_t size);
+
+    void free(DevPtr addr);
+
+    // starts a launch, closing the previous one
+    void kernel_start(uint32_t name);
+
+    // marks [start, end) touched by the current launch, clipped to the allocation holding start
+    void touch(DevPtr start, DevPtr end);
+
+    // closes the current launch, e.g. before simulate()
+    void kernel_end();
+
+    UvmResult_t simulate(UvmPolicy_t policy, uint64_t capacity_pages) const;
+
+    uint64_t page_size() const { return _page_size; }
+
+    uint64_t num_pages() const { return _num_pages; }
+
+    uint64_t peak_pages() const { return _peak_pages; }
+
+    uint64_t num_kernels() const { return _kernel_sets.size(); }
+
+    uint64_t num_sets() const { return _set_offsets.size() - 1; }
+
+    uint64_t num_runs() const { return _set_runs.size(); }
+
+private:
+    typedef struct Allocation {
+        DevPtr addr;
+        uint64_t first_page;        // addr / page_size
+        uint32_t first_id;
+        uint32_t pages;
+    } Allocation_t;
+
+    typedef struct Release {
+        uint32_t kernel;            // applied before this launch
+        PageRun_t run;
+    } Release_t;
+
+    uint32_t intern_set();
+
+    uint64_t _page_size;
+    uint32_t _page_shift;
+    uint64_t _num_pages = 0;
+    uint64_t _live_pages = 0;
+    uint64_t _peak_pages = 0;
+
+    AddressIndex _index;
+    std::vector<Allocation_t> _allocations;
+
+    bool _in_kernel = false;
+    std::vector<PageRun_t> _current;
+    // 1 + index of the last launch that touched the page
+    std::vector<uint32_t> _page_stamps;
+
+    // set i is _set_runs[_set_offsets[i], _set_offsets[i + 1])
+    std::vector<PageRun_t> _set_runs;
+    std::vector<uint64_t> _set_offsets;
+    FlatHashMap<uint32_t> _set_ids;
+
+    std::vector<uint32_t> _kernel_sets;
+    std::vector<uint32_t> _kernel_names;
+    std::vector<Release_t> _releases;
+};
+
+const char* uvm_policy_name(UvmPolicy_t policy);
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_UVM_SIMULATOR_H
@@ -0,0 +1,39 @@
+#ifndef YOSEMITE_UTILS_WARP_SIMD_H
+#define YOSEMITE_UTILS_WARP_SIMD_H
+
+#include <cstdint>
+
+namespace yosemite {
+
+/**
+ * Per-warp primitives over the 32 lane addresses of a MemoryAccess.
+ * Each has a scalar, an AVX2 and an AVX-512 implementation; the widest one
+ * the CPU supports is picked once at load time.
+ */
+
+// Lanes with a non-zero address.
+uint32_t warp_active_mask(const uint64_t* addresses);
+
+// Active lanes holding the first occurrence of their (address >> shift),
+// popcount of the result is the number of distinct sectors/lines/words.
+uint32_t warp_unique_mask(const uint64_t* addresses, uint32_t active, uint32_t shift);
+
+// masks[i] = active lanes whose (address >> shift) equals lane i's,
+// zero for inactive lanes. Same as CUDA's __match_any_sync.
+void warp_match_any(const uint64_t* addresses, uint32_t active, uint32_t shift, uint32_t* masks);
+
+// Active lanes whose address is first + (lane - first_lane) * stride, where
+// first is the address of the lowest active lane. Equal to the active mask
+// for broadcasts (stride 0) and for affine warps with the given stride.
+uint32_t warp_stride_mask(const uint64_t* addresses, uint32_t active, int64_t stride);
+
+// Largest number of distinct (address >> shift) words falling into one of 32
+// banks of (1 << shift) bytes; lanes on the same word are a broadcast and
+// count once. This is the number of shared-memory wavefronts of the warp.
+uint32_t warp_bank_load(const uint64_t* addresses, uint32_t active, uint32_t shift);
+
+const char* warp_simd_isa();
+
+}   // yosemite
+
+#endif // YOSEMITE_UTILS_WARP_SIMD_H
@@ -6,7 +6,21 @@
 #include "tools/app_metric.h"
 #include "tools/mem_trace.h"
 #include "tools/hot_analysis.h"
-
+#include "tools/coalescing.h"
+#include "tools/reuse_distance.h"
+#include "tools/cache_sim.h"
+#include "tools/tlb_analysis.h"
+#include "tools/access_pattern.h"
+#include "tools/warp_sharing.h"
+#include "tools/bank_conflict.h"
+#include "tools/warp_imbalance.h"
+#include "tools/object_profile.h"
+#include "tools/fragmentation.h"
+#include "tools/lifetime.h"
+#include "tools/uvm_sim.h"
+#include "utils/iteration_detector.h"
+
+#include <algorithm>
 #include <memory>
 #include <map>
 #include <iostream>
@@ -15,6 +29,8 @@ using namespace yosemite;
 
 static std::map<AnalysisTool_t, std::shared_ptr<Tool>> _tools;
 
+static std::unique_ptr<IterationDetector> _detector;
+
 
 YosemiteResult_t yosemite_tool_enable(AnalysisTool_t& tool) {
     const char* tool_name = std::getenv("YOSEMITE_TOOL_NAME");
@@ -35,6 +51,42 @@ YosemiteResult_t yosemite_tool_enable(AnalysisTool_t& tool) {
     } else if (std::string(tool_name) == "hot_analysis") {
         tool = HOT_ANALYSIS;
         _tools.emplace(HOT_ANALYSIS, std::make_shared<HotAnalysis>());
+    } else if (std::string(tool_name) == "coalescing") {
+        tool = COALESCING;
+        _tools.emplace(COALESCING, std::make_shared<Coalescing>());
+    } else if (std::string(tool_name) == "reuse_distance") {
+        tool = REUSE_DISTANCE;
+        _tools.emplace(REUSE_DISTANCE, std::make_shared<ReuseDistance>());
+    } else if (std::string(tool_name) == "cache_sim") {
+        tool = CACHE_SIM;
+        _tools.emplace(CACHE_SIM, std::make_shared<CacheSim>());
+    } else if (std::string(tool_name) == "tlb_analysis") {
+        tool = TLB_ANALYSIS;
+        _tools.emplace(TLB_ANALYSIS, std::make_shared<TlbAnalysis>());
+    } else if (std::string(tool_name) == "access_pattern") {
+        tool = ACCESS_PATTERN;
+        _tools.emplace(ACCESS_PATTERN, std::make_shared<AccessPattern>());
+    } else if (std::string(tool_name) == "warp_sharing") {
+        tool = WARP_SHARING;
+        _tools.emplace(WARP_SHARING, std::make_shared<WarpSharing>());
+    } else if (std::string(tool_name) == "bank_conflict") {
+        tool = BANK_CONFLICT;
+        _tools.emplace(BANK_CONFLICT, std::make_shared<BankConflict>());
+    } else if (std::string(tool_name) == "warp_imbalance") {
+        tool = WARP_IMBALANCE;
+        _tools.emplace(WARP_IMBALANCE, std::make_shared<WarpImbalance>());
+    } else if (std::string(tool_name) == "object_profile") {
+        tool = OBJECT_PROFILE;
+        _tools.emplace(OBJECT_PROFILE, std::make_shared<ObjectProfile>());
+    } else if (std::string(tool_name) == "fragmentation") {
+        tool = FRAGMENTATION;
+        _tools.emplace(FRAGMENTATION, std::make_shared<Fragmentation>());
+    } else if (std::string(tool_name) == "lifetime") {
+        tool = LIFETIME;
+        _tools.emplace(LIFETIME, std::make_shared<Lifetime>());
+    } else if (std::string(tool_name) == "uvm_sim") {
+        tool = UVM_SIM;
+        _tools.emplace(UVM_SIM, std::make_shared<UvmSim>());
     } else {
         fprintf(stdout, "Tool not found.\n");
         return YOSEMITE_NOT_IMPLEMENTED;
@@ -59,6 +111,41 @@ YosemiteResult_t yosemite_flush() {
 }
 
 
+// Positive integer from the environment, at most max_value; default_value when unset or not positive.
+static uint32_t env_bounded(const char* name, uint32_t default_value, uint32_t max_value) {
+    const char* env = std::getenv(name);
+    if (env == nullptr) {
+        return default_value;
+    }
+    long long value = std::atoll(env);
+    if (value <= 0) {
+        fprintf(stderr, "Ignoring %s=%s, using %u.\n", name, env, default_value);
+        return default_value;
+    }
+    return (uint32_t)std::min(value, (long long)max_value);
+}
+
+
+YosemiteResult_t yosemite_iteration_detector_enable() {
+    // the detector keeps confirm * max_period kernels, about 20 bytes each
+    uint32_t max_period = env_bounded("YOSEMITE_ITER_MAX_PERIOD", 100000, 1 << 20);
+    uint32_t confirm = env_bounded("YOSEMITE_ITER_CONFIRM", 3, 16);
+    const char* recheck = std::getenv("YOSEMITE_ITER_RECHECK");
+    _detector.reset(new IterationDetector(max_period, confirm,
+                                          recheck ? std::max(std::atoi(recheck), 0) : 50));
+    fprintf(stdout, "Enabling iteration detector.\n");
+    fflush(stdout);
+    return YOSEMITE_SUCCESS;
+}
+
+
+static void yosemite_update_steady_state() {
+    for (auto &tool : _tools) {
+        tool.second->set_steady_state(_detector->steady());
+    }
+}
+
+
 YosemiteResult_t yosemite_torch_prof_enable() {
     fprintf(stdout, "Enabling torch profiler.\n");
     fflush(stdout);
@@ -72,6 +159,9 @@ YosemiteResult_t yosemite_torch_prof_enable() {
 
 
 YosemiteResult_t yosemite_alloc_callback(uint64_t ptr, uint64_t size, int type) {
+    if (_detector && _detector->on_alloc(size)) {
+        yosemite_update_steady_state();
+    }
     for (auto &tool : _tools) {
         auto mem_alloc = std::make_shared<MemAlloc_t>(ptr, size, type);
         tool.second->evt_callback(mem_alloc);
@@ -111,6 +201,9 @@ YosemiteResult_t yosemite_memset_callback(uint64_t dst, uint32_t size, int value
 
 
 YosemiteResult_t yosemite_kernel_start_callback(std::string kernel_name) {
+    if (_detector && _detector->on_kernel(kernel_name)) {
+        yosemite_update_steady_state();
+    }
     for (auto &tool : _tools) {
         auto kernel = std::make_shared<KernelLauch_t>(kernel_name); 
         tool.second->evt_callback(kernel);
@@ -143,9 +236,9 @@ YosemiteResult_t yosemite_init(SanitizerOptions_t& options) {
         return res;
     }
 
-    if (tool == CODE_CHECK) {
+    if (tool == CODE_CHECK || tool == FRAGMENTATION) {
         options.patch_name = GPU_NO_PATCH;
-    } else if (tool == APP_METRICE) {
+    } else if (tool == APP_METRICE || tool == LIFETIME) {
         options.patch_name = GPU_PATCH_APP_METRIC;
         options.patch_file = "gpu_patch_app_metric.fatbin";
     } else if (tool == MEM_TRACE) {
@@ -154,6 +247,27 @@ YosemiteResult_t yosemite_init(SanitizerOptions_t& options) {
     } else if (tool == HOT_ANALYSIS) {
         options.patch_name = GPU_PATCH_HOT_ANALYSIS;
         options.patch_file = "gpu_patch_hot_analysis.fatbin";
+    } else if (tool == UVM_SIM) {
+        // touched ranges from the hot_analysis patch, or exact pages from the traces
+        const char* uvm_source = std::getenv("YOSEMITE_UVM_SOURCE");
+        if (uvm_source && std::string(uvm_source) == "mem_trace") {
+            options.patch_name = GPU_PATCH_MEM_TRACE;
+            options.patch_file = "gpu_patch_mem_trace.fatbin";
+        } else {
+            options.patch_name = GPU_PATCH_HOT_ANALYSIS;
+            options.patch_file = "gpu_patch_hot_analysis.fatbin";
+        }
+    } else if (tool == COALESCING || tool == REUSE_DISTANCE || tool == CACHE_SIM
+               || tool == TLB_ANALYSIS || tool == ACCESS_PATTERN || tool == WARP_SHARING
+               || tool == BANK_CONFLICT || tool == WARP_IMBALANCE || tool == OBJECT_PROFILE) {
+        options.patch_name = GPU_PATCH_MEM_TRACE;
+        options.patch_file = "gpu_patch_mem_trace.fatbin";
+    }
+
+    // skip repeated training iterations?
+    const char* iter_detect = std::getenv("YOSEMITE_ITER_DETECT");
+    if (iter_detect && std::string(iter_detect) == "1") {
+        yosemite_iteration_detector_enable();
     }
 
     // enable torch profiler?
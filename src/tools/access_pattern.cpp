@@ -0,0 +1,279 @@
+/**
+ * Warp access pattern classification.
+ * Every warp access is labelled broadcast, unit-stride, constant-stride,
+ * small-gather or random from its lane addresses and access size; the mix and
+ * the access-width histogram are summarized per kernel name and allocation.
+ */
+#include "tools/access_pattern.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/access_flags.h"
+#include "utils/address_index.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+typedef enum {
+    PATTERN_BROADCAST = 0,      // every active lane reads the same address
+    PATTERN_UNIT_STRIDE = 1,    // lane i at base + i * accessSize
+    PATTERN_CONSTANT_STRIDE = 2,
+    PATTERN_SMALL_GATHER = 3,   // irregular but within a few 128B lines
+    PATTERN_RANDOM = 4,
+    PATTERN_NUMS = 5
+} AccessPattern_t;
+
+static const char* PATTERN_NAMES[PATTERN_NUMS] = {
+    "broadcast", "unit_stride", "const_stride", "small_gather", "random"
+};
+
+// access widths 1, 2, 4, 8, 16 and larger
+static constexpr uint32_t NUM_WIDTHS = 6;
+static const char* WIDTH_NAMES[NUM_WIDTHS] = {"1B", "2B", "4B", "8B", "16B", ">16B"};
+
+static constexpr uint32_t LINE_SHIFT = 7;
+static uint32_t gather_max_lines = 4;
+
+typedef struct PatternStats {
+    uint64_t instructions = 0;
+    uint64_t stores = 0;
+    uint64_t patterns[PATTERN_NUMS] = {0};
+    uint64_t widths[NUM_WIDTHS] = {0};
+
+    void add(AccessPattern_t pattern, uint32_t width, bool is_store) {
+        instructions++;
+        stores += is_store;
+        patterns[pattern]++;
+        widths[width]++;
+    }
+
+    void merge(const PatternStats& other) {
+        instructions += other.instructions;
+        stores += other.stores;
+        for (uint32_t p = 0; p < PATTERN_NUMS; p++) {
+            patterns[p] += other.patterns[p];
+        }
+        for (uint32_t w = 0; w < NUM_WIDTHS; w++) {
+            widths[w] += other.widths[w];
+        }
+    }
+} PatternStats_t;
+
+typedef struct AllocationPatternStats {
+    DevPtr addr;
+    uint64_t size;
+    PatternStats_t stats;
+} AllocationPatternStats_t;
+
+static std::map<std::string, PatternStats_t> kernel_stats;
+static PatternStats_t* cur_kernel_stats = nullptr;
+
+// live allocations by slot, a freed slot is folded into freed_stats and reused
+static AddressIndex alloc_index;
+static std::vector<AllocationPatternStats_t> alloc_stats;
+static std::vector<uint32_t> free_slots;
+static PatternStats_t freed_stats;
+static uint64_t num_freed = 0;
+static PatternStats_t unknown_stats;
+
+
+AccessPattern::AccessPattern() : Tool(ACCESS_PATTERN) {
+    const char* env_gather = std::getenv("YOSEMITE_PATTERN_GATHER_LINES");
+    if (env_gather != nullptr) {
+        gather_max_lines = std::max(std::atoi(env_gather), 0);
+    }
+    fprintf(stdout, "Access pattern classification using %s warp kernels.\n", warp_simd_isa());
+}
+
+
+AccessPattern::~AccessPattern() {}
+
+
+void AccessPattern::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_stats = &kernel_stats[kernel->kernel_name];
+    alloc_index.refresh();
+}
+
+
+void AccessPattern::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    cur_kernel_stats = nullptr;
+}
+
+
+void AccessPattern::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    uint32_t slot = alloc_stats.size();
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        alloc_stats[slot] = AllocationPatternStats_t{mem->addr, mem->size, PatternStats_t()};
+    } else {
+        alloc_stats.push_back(AllocationPatternStats_t{mem->addr, mem->size, PatternStats_t()});
+    }
+    alloc_index.insert(mem->addr, mem->size, slot);
+}
+
+
+void AccessPattern::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    uint32_t slot = alloc_index.find(mem->addr);
+    if (slot == AddressIndex::NONE || alloc_stats[slot].addr != mem->addr) {
+        return;
+    }
+    freed_stats.merge(alloc_stats[slot].stats);
+    alloc_stats[slot].stats = PatternStats_t();
+    num_freed++;
+    alloc_index.erase(mem->addr);
+    free_slots.push_back(slot);
+}
+
+
+void AccessPattern::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+static AccessPattern_t classify(const MemoryAccess& access, uint32_t active) {
+    if (__builtin_popcount(active) == 1 || warp_stride_mask(access.addresses, active, 0) == active) {
+        return PATTERN_BROADCAST;
+    }
+    // candidate stride from the two lowest active lanes
+    uint32_t first = __builtin_ctz(active);
+    uint32_t second = __builtin_ctz(active & (active - 1));
+    int64_t delta = (int64_t)(access.addresses[second] - access.addresses[first]);
+    int64_t lanes = second - first;
+    if (delta % lanes == 0 && warp_stride_mask(access.addresses, active, delta / lanes) == active) {
+        return delta / lanes == (int64_t)access.accessSize ? PATTERN_UNIT_STRIDE : PATTERN_CONSTANT_STRIDE;
+    }
+    uint32_t lines = __builtin_popcount(warp_unique_mask(access.addresses, active, LINE_SHIFT));
+    return lines <= gather_max_lines ? PATTERN_SMALL_GATHER : PATTERN_RANDOM;
+}
+
+
+void AccessPattern::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_kernel_stats == nullptr) {
+        cur_kernel_stats = &kernel_stats["<unknown>"];
+    }
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        if (active == 0) {
+            continue;
+        }
+        AccessPattern_t pattern = classify(access, active);
+        uint32_t width = access.accessSize > 16 ? NUM_WIDTHS - 1
+                         : 31 - __builtin_clz(std::max(access.accessSize, 1u));
+        bool is_store = access_is_write(access.flags);
+
+        cur_kernel_stats->add(pattern, width, is_store);
+        uint32_t alloc_id = alloc_index.find(access.addresses[__builtin_ctz(active)]);
+        if (alloc_id != AddressIndex::NONE) {
+            alloc_stats[alloc_id].stats.add(pattern, width, is_store);
+        } else {
+            unknown_stats.add(pattern, width, is_store);
+        }
+    }
+}
+
+
+void AccessPattern::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static void dump_stats(std::ofstream& out, const PatternStats_t& stats) {
+    double insts = stats.instructions ? stats.instructions : 1;
+    out << "insts=" << stats.instructions << " stores=" << stats.stores;
+    for (uint32_t p = 0; p < PATTERN_NUMS; p++) {
+        out << " " << PATTERN_NAMES[p] << "=" << 100.0 * stats.patterns[p] / insts << "%";
+    }
+    out << " widths:";
+    for (uint32_t w = 0; w < NUM_WIDTHS; w++) {
+        if (stats.widths[w] > 0) {
+            out << " " << WIDTH_NAMES[w] << "=" << 100.0 * stats.widths[w] / insts << "%";
+        }
+    }
+
+    // hints for kernel authors
+    uint64_t gathers = stats.patterns[PATTERN_SMALL_GATHER] + stats.patterns[PATTERN_RANDOM];
+    uint64_t narrow = stats.widths[0] + stats.widths[1] + stats.widths[2];
+    if (gathers * 2 > stats.instructions) {
+        out << " [gather-heavy]";
+    }
+    if (narrow * 2 > stats.instructions && stats.patterns[PATTERN_UNIT_STRIDE] * 2 > stats.instructions) {
+        out << " [narrow-unit-stride: vectorizable]";
+    }
+}
+
+
+void AccessPattern::flush() {
+    std::string filename = get_output_name("access_pattern") + ".log";
+    printf("Dumping access pattern analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(4);
+
+    std::vector<std::pair<std::string, PatternStats_t*>> kernels;
+    for (auto& it : kernel_stats) {
+        kernels.emplace_back(it.first, &it.second);
+    }
+    // gather-heavy kernels first, then by size
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        uint64_t ga = a.second->patterns[PATTERN_SMALL_GATHER] + a.second->patterns[PATTERN_RANDOM];
+        uint64_t gb = b.second->patterns[PATTERN_SMALL_GATHER] + b.second->patterns[PATTERN_RANDOM];
+        if (ga != gb) {
+            return ga > gb;
+        }
+        return a.second->instructions > b.second->instructions;
+    });
+
+    out << "==================== Kernels ====================" << std::endl;
+    for (auto& kernel : kernels) {
+        dump_stats(out, *kernel.second);
+        out << "\t" << kernel.first << std::endl;
+    }
+    out << std::endl;
+
+    out << "==================== Allocations ====================" << std::endl;
+    for (uint32_t i = 0; i < alloc_stats.size(); i++) {
+        auto& alloc = alloc_stats[i];
+        if (alloc.stats.instructions == 0) {
+            continue;
+        }
+        out << "Alloc " << i << " " << alloc.addr << " " << alloc.size
+            << " (" << format_size(alloc.size) << "): ";
+        dump_stats(out, alloc.stats);
+        out << std::endl;
+    }
+    if (freed_stats.instructions > 0) {
+        out << "Freed allocations (" << num_freed << "): ";
+        dump_stats(out, freed_stats);
+        out << std::endl;
+    }
+    if (unknown_stats.instructions > 0) {
+        out << "Outside allocations: ";
+        dump_stats(out, unknown_stats);
+        out << std::endl;
+    }
+
+    out.close();
+}
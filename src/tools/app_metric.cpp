@@ -1,6 +1,9 @@
 
 #include "tools/app_metric.h"
 #include "utils/helper.h"
+#include "utils/kll_sketch.h"
+#include "utils/touch_reduce.h"
+#include "utils/memory_timeline.h"
 #include "gpu_patch.h"
 
 #include <algorithm>
@@ -10,6 +13,7 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <random>
 
 
 using namespace yosemite;
@@ -43,9 +47,104 @@ static Timer_t _timer;
 static std::map<uint64_t, std::shared_ptr<KernelLauch_t>> kernel_events;
 static std::map<uint64_t, std::shared_ptr<MemAlloc_t>> alloc_events;
 static std::map<DevPtr, std::shared_ptr<MemAlloc_t>> active_memories;
+static std::map<DevPtr, std::shared_ptr<TenAlloc_t>> active_tensors;
 
 static std::map<std::string, uint32_t> kernel_invocations;
 
+/**
+ * Per kernel name distributions, updated once per launch. In streaming mode
+ * (YOSEMITE_METRICS_STREAMING=1) these and a fixed-size reservoir sample of
+ * launches and allocations are all that is kept, so memory does not grow with
+ * the number of launches.
+ */
+typedef struct KernelAggregate {
+    uint64_t count = 0;
+    uint64_t tot_mem_accesses = 0;
+    uint64_t tot_objs = 0;
+    uint64_t tot_obj_size = 0;
+    KLLSketch mem_accesses;
+    KLLSketch objs;
+    KLLSketch obj_size;
+} KernelAggregate_t;
+
+static std::map<std::string, KernelAggregate_t> kernel_aggregates;
+
+// launch whose counters gpu_data_analysis fills, folded into the aggregates once the next one starts
+static std::shared_ptr<KernelLauch_t> current_kernel;
+
+// usage series and peak live sets of the cudaMalloc allocations and of the PyTorch tensors
+static MemoryTimeline alloc_timeline;
+static MemoryTimeline tensor_timeline;
+
+static bool streaming = false;
+static uint32_t reservoir_capacity = 1000;
+static std::mt19937_64 reservoir_rng(0x5eed);
+static std::vector<std::pair<uint64_t, std::shared_ptr<KernelLauch_t>>> kernel_samples;
+static std::vector<std::pair<uint64_t, std::shared_ptr<MemAlloc_t>>> alloc_samples;
+
+
+// Algorithm R: the seq-th item replaces a random slot with probability capacity / (seq + 1)
+template <typename T>
+static void reservoir_add(std::vector<std::pair<uint64_t, T>>& samples, uint64_t seq, const T& item) {
+    if (samples.size() < reservoir_capacity) {
+        samples.emplace_back(seq, item);
+        return;
+    }
+    uint64_t slot = reservoir_rng() % (seq + 1);
+    if (slot < reservoir_capacity) {
+        samples[slot] = std::make_pair(seq, item);
+    }
+}
+
+
+static void retire_kernel() {
+    if (!current_kernel) {
+        return;
+    }
+    auto kernel = current_kernel;
+    current_kernel.reset();
+
+    _stats.tot_mem_accesses += kernel->mem_accesses;
+    if (_stats.max_mem_accesses_per_kernel < kernel->mem_accesses) {
+        _stats.max_mem_accesses_kernel = kernel->kernel_name;
+        _stats.max_mem_accesses_per_kernel = kernel->mem_accesses;
+    }
+    _stats.tot_objs_per_kernel += kernel->touched_objects;
+    _stats.max_objs_per_kernel = std::max(_stats.max_objs_per_kernel, kernel->touched_objects);
+    _stats.tot_obj_size_per_kernel += kernel->touched_objects_size;
+    _stats.max_obj_size_per_kernel = std::max(_stats.max_obj_size_per_kernel, kernel->touched_objects_size);
+
+    auto& aggregate = kernel_aggregates[kernel->kernel_name];
+    aggregate.count++;
+    aggregate.tot_mem_accesses += kernel->mem_accesses;
+    aggregate.tot_objs += kernel->touched_objects;
+    aggregate.tot_obj_size += kernel->touched_objects_size;
+    aggregate.mem_accesses.update(kernel->mem_accesses);
+    aggregate.objs.update(kernel->touched_objects);
+    aggregate.obj_size.update(kernel->touched_objects_size);
+}
+
+
+AppMetrics::AppMetrics() : Tool(APP_METRICE) {
+    const char* env_buckets = std::getenv("YOSEMITE_METRICS_TIMELINE_BUCKETS");
+    const char* env_peak_step = std::getenv("YOSEMITE_METRICS_PEAK_STEP");
+    uint32_t num_buckets = env_buckets ? std::max(std::atoi(env_buckets), 2) : 1024;
+    double peak_step = env_peak_step ? std::atof(env_peak_step) : 0.01;
+    alloc_timeline = MemoryTimeline(num_buckets, peak_step);
+    tensor_timeline = MemoryTimeline(num_buckets, peak_step);
+
+    const char* env_streaming = std::getenv("YOSEMITE_METRICS_STREAMING");
+    if (env_streaming && std::string(env_streaming) == "1") {
+        streaming = true;
+        const char* env_reservoir = std::getenv("YOSEMITE_METRICS_RESERVOIR");
+        if (env_reservoir) {
+            reservoir_capacity = std::max(std::atoi(env_reservoir), 0);
+        }
+        fprintf(stdout, "AppMetrics streaming mode, keeping %u sampled launches and allocations.\n",
+                reservoir_capacity);
+    }
+}
+
 
 
 void AppMetrics::evt_callback(EventPtr_t evt) {
@@ -62,6 +161,12 @@ void AppMetrics::evt_callback(EventPtr_t evt) {
         case EventType_MEM_FREE:
             mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
             break;
+        case EventType_TEN_ALLOC:
+            ten_alloc_callback(std::dynamic_pointer_cast<TenAlloc_t>(evt));
+            break;
+        case EventType_TEN_FREE:
+            ten_free_callback(std::dynamic_pointer_cast<TenFree_t>(evt));
+            break;
         default:
             break;
     }
@@ -69,7 +174,13 @@ void AppMetrics::evt_callback(EventPtr_t evt) {
 
 
 void AppMetrics::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
-    kernel_events.emplace(_timer.get(), kernel);
+    retire_kernel();
+    current_kernel = kernel;
+    if (streaming) {
+        reservoir_add(kernel_samples, _stats.num_kernels, kernel);
+    } else {
+        kernel_events.emplace(_timer.get(), kernel);
+    }
     if (kernel_invocations.find(kernel->kernel_name) == kernel_invocations.end()) {
         kernel_invocations.emplace(kernel->kernel_name, 1);
     } else {
@@ -87,9 +198,14 @@ void AppMetrics::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
 
 
 void AppMetrics::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
-    alloc_events.emplace(_timer.get(), mem);
+    if (streaming) {
+        reservoir_add(alloc_samples, _stats.num_allocs, mem);
+    } else {
+        alloc_events.emplace(_timer.get(), mem);
+    }
     active_memories.emplace(mem->addr, mem);
-    
+    alloc_timeline.alloc(mem->addr, mem->size, _timer.get());
+
     _stats.num_allocs++;
     _stats.cur_mem_usage += mem->size;
     _stats.max_mem_usage = std::max(_stats.max_mem_usage, _stats.cur_mem_usage);
@@ -102,29 +218,83 @@ void AppMetrics::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
     auto it = active_memories.find(mem->addr);
     assert(it != active_memories.end());
     _stats.cur_mem_usage -= it->second->size;
+    it->second->release_time = _stats.num_kernels;
     active_memories.erase(it);
+    alloc_timeline.free(mem->addr, _timer.get());
 
     _timer.increment(true);
 }
 
 
+void AppMetrics::ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten) {
+    active_tensors[ten->addr] = ten;
+    tensor_timeline.alloc(ten->addr, ten->size, _timer.get());
+
+    _timer.increment(true);
+}
+
+
+void AppMetrics::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
+    auto it = active_tensors.find(ten->addr);
+    if (it != active_tensors.end()) {
+        it->second->release_time = _stats.num_kernels;
+        active_tensors.erase(it);
+    }
+    tensor_timeline.free(ten->addr, _timer.get());
+
+    _timer.increment(true);
+}
+
+
+static void dump_timeline(std::ofstream& out, const char* what, const MemoryTimeline& timeline) {
+    if (timeline.num_allocs() == 0) {
+        return;
+    }
+    auto& peaks = timeline.peaks();
+    out << "------------------------------" << std::endl;
+    if (!peaks.empty()) {
+        auto live = timeline.live_at_peak(peaks.size() - 1);
+        out << "Peak " << what << " usage: " << peaks.back().usage << "B ("
+            << format_size(peaks.back().usage) << ") at time " << peaks.back().time
+            << ", " << live.size() << " live" << std::endl;
+        // allocation order: the earliest entries are the long-lived ones
+        for (auto& object : live) {
+            out << "  #" << object.seq << " (time " << object.alloc_time << "):\t"
+                << object.addr << " " << object.size << " (" << format_size(object.size) << ")" << std::endl;
+        }
+        out << std::endl;
+    }
+
+    out << "Peak " << what << " history: " << peaks.size() << " peaks" << std::endl;
+    for (size_t i = 0; i < peaks.size(); i++) {
+        out << "  Peak " << i << ": time=" << peaks[i].time << " usage=" << peaks[i].usage
+            << " (" << format_size(peaks[i].usage) << ") +" << peaks[i].added.size()
+            << " -" << peaks[i].removed.size() << std::endl;
+    }
+    out << std::endl;
+
+    out << "Timeline " << what << " (bucket width " << timeline.bucket_width() << "): start min max" << std::endl;
+    for (auto& bucket : timeline.buckets()) {
+        out << "  " << bucket.start << " " << bucket.min << " " << bucket.max << std::endl;
+    }
+    out << std::endl;
+}
+
+
 void AppMetrics::gpu_data_analysis(void* data, uint64_t size) {
     MemoryAccessTracker* tracker = (MemoryAccessTracker*)data;
     MemoryAccessState* states = tracker->access_state;
 
-    uint32_t touched_objects = 0;
-    uint32_t touched_objects_size = 0;
-    for (uint32_t i = 0; i < states->size; i++) {
-        if (states->touch[i] != 0) {
-            touched_objects++;
-            touched_objects_size += states->start_end[i].end - states->start_end[i].start;
-        }
-    }
+    static_assert(sizeof(MemoryRange) == 2 * sizeof(uint64_t), "start_end must be (start, end) pairs");
+    TouchSummary_t summary = touch_reduce((const uint64_t*)states->start_end, states->touch, states->size);
 
-    auto event = std::prev(kernel_events.end())->second;
+    if (!current_kernel) {
+        return;
+    }
+    auto event = current_kernel;
     event->mem_accesses = tracker->accessCount;
-    event->touched_objects = touched_objects;
-    event->touched_objects_size = touched_objects_size;
+    event->touched_objects = summary.objects;
+    event->touched_objects_size = summary.bytes;
 }
 
 
@@ -157,41 +327,49 @@ void AppMetrics::flush() {
     printf("Dumping traces to %s\n", filename.c_str());
 
     std::ofstream out(filename);
+    retire_kernel();
+
+    // (sequence number, event): every event in full mode, the reservoir when streaming
+    std::vector<std::pair<uint64_t, std::shared_ptr<MemAlloc_t>>> allocs;
+    std::vector<std::pair<uint64_t, std::shared_ptr<KernelLauch_t>>> kernels;
+    if (streaming) {
+        allocs = alloc_samples;
+        kernels = kernel_samples;
+        std::sort(allocs.begin(), allocs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        out << "Sampled allocations: " << allocs.size() << " of " << _stats.num_allocs << std::endl;
+    } else {
+        uint64_t seq = 0;
+        for (auto event : alloc_events) {
+            allocs.emplace_back(seq++, event.second);
+        }
+        seq = 0;
+        for (auto event : kernel_events) {
+            kernels.emplace_back(seq++, event.second);
+        }
+    }
 
-    int count = 0;
-    for (auto event : alloc_events) {
-        out << "Alloc(" << event.second->alloc_type << ") " << count << ":\t"
+    for (auto event : allocs) {
+        out << "Alloc(" << event.second->alloc_type << ") " << event.first << ":\t"
             << event.second->addr << " " << event.second->size
-            << " (" << format_size(event.second->size) << ")" << std::endl;
-        count++;
+            << " (" << format_size(event.second->size) << ")";
+        if (event.second->release_time != UINT64_MAX) {
+            out << " released=" << event.second->release_time;
+        }
+        out << std::endl;
     }
     out << std::endl;
 
-    count = 0;
-    for (auto event : kernel_events) {
-        out << "Kernel " << count << " ("
+    if (streaming) {
+        out << "Sampled kernels: " << kernels.size() << " of " << _stats.num_kernels << std::endl;
+    }
+    for (auto event : kernels) {
+        out << "Kernel " << event.first << " ("
             << "refs=" << event.second->mem_accesses
             << ", objs=" << event.second->touched_objects
             << ", obj_size=" << event.second->touched_objects_size
             << ", " << format_size(event.second->touched_objects_size)
             << "):\t" << event.second->kernel_name << std::endl;
-        _stats.tot_mem_accesses += event.second->mem_accesses;
-        if (_stats.max_mem_accesses_per_kernel < event.second->mem_accesses) {
-            _stats.max_mem_accesses_kernel = event.second->kernel_name;
-            _stats.max_mem_accesses_per_kernel = event.second->mem_accesses;
-        }
-
-        _stats.tot_objs_per_kernel += event.second->touched_objects;
-        if (_stats.max_objs_per_kernel < event.second->touched_objects) {
-            _stats.max_objs_per_kernel = event.second->touched_objects;
-        }
-
-        _stats.tot_obj_size_per_kernel += event.second->touched_objects_size;
-        if (_stats.max_obj_size_per_kernel < event.second->touched_objects_size) {
-            _stats.max_obj_size_per_kernel = event.second->touched_objects_size;
-        }
-
-        count++;
     }
     out << std::endl;
 
@@ -208,6 +386,32 @@ void AppMetrics::flush() {
     }
     out << std::endl;
 
+    // per kernel name distributions, heaviest total memory accesses first
+    std::vector<std::pair<std::string, const KernelAggregate_t*>> aggregates;
+    for (auto& it : kernel_aggregates) {
+        aggregates.emplace_back(it.first, &it.second);
+    }
+    std::sort(aggregates.begin(), aggregates.end(), [](const auto& a, const auto& b) {
+        return a.second->tot_mem_accesses > b.second->tot_mem_accesses;
+    });
+    auto print_distribution = [&out](const char* tag, uint64_t total, uint64_t count, const KLLSketch& sketch) {
+        out << ", " << tag << "(total=" << total
+            << ", mean=" << (count > 0 ? total / count : 0)
+            << ", p50=" << (uint64_t)sketch.quantile(0.5)
+            << ", p90=" << (uint64_t)sketch.quantile(0.9)
+            << ", p99=" << (uint64_t)sketch.quantile(0.99)
+            << ", max=" << (uint64_t)sketch.max() << ")";
+    };
+    for (auto& it : aggregates) {
+        auto aggregate = it.second;
+        out << "Count=" << aggregate->count;
+        print_distribution("refs", aggregate->tot_mem_accesses, aggregate->count, aggregate->mem_accesses);
+        print_distribution("objs", aggregate->tot_objs, aggregate->count, aggregate->objs);
+        print_distribution("obj_size", aggregate->tot_obj_size, aggregate->count, aggregate->obj_size);
+        out << "\t" << it.first << std::endl;
+    }
+    out << std::endl;
+
     if (_stats.num_kernels > 0) {   // could be 0 when using python interface
         _stats.avg_mem_accesses = _stats.tot_mem_accesses / _stats.num_kernels;
         _stats.avg_objs_per_kernel = _stats.tot_objs_per_kernel / _stats.num_kernels;
@@ -215,7 +419,7 @@ void AppMetrics::flush() {
     }
     out << "Number of allocations: " << _stats.num_allocs << std::endl;
     out << "Number of kernels: " << _stats.num_kernels << std::endl;
-    out << "Maximum memory usage: " << _stats.tot_mem_accesses
+    out << "Maximum memory usage: " << _stats.max_mem_usage
         << "B (" << format_size(_stats.max_mem_usage) << ")" << std::endl;
     out << "------------------------------" << std::endl;
     out << "Maximum objects per kernel: " << _stats.max_objs_per_kernel << std::endl;
@@ -237,5 +441,11 @@ void AppMetrics::flush() {
 
     auto avg_access_per_page = (float) _stats.tot_mem_accesses / (_stats.max_mem_usage / 4096.0f);
     out << "Average accesses per page: " << avg_access_per_page << std::endl;
+    out << std::endl;
+
+    alloc_timeline.extend(_timer.get());
+    tensor_timeline.extend(_timer.get());
+    dump_timeline(out, "allocation", alloc_timeline);
+    dump_timeline(out, "tensor", tensor_timeline);
     out.close();
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+/**
+ * Shared-memory bank conflict analysis.
+ * Accesses carrying the shared-memory flag are replayed against 32 banks in
+ * both 4-byte and 8-byte bank modes. Wide accesses are split into phases the
+ * way the hardware does (half-warps for 2 words per lane, quarter-warps for
+ * 4), and each phase costs as many wavefronts as the most loaded bank.
+ */
+#include "tools/bank_conflict.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/access_flags.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t NUM_BANK_MODES = 2;
+static constexpr uint32_t BANK_SHIFTS[NUM_BANK_MODES] = {2, 3};
+static constexpr const char* BANK_MODE_NAMES[NUM_BANK_MODES] = {"4B", "8B"};
+static constexpr uint32_t MAX_WAVEFRONTS = 32;
+
+typedef struct BankStats {
+    uint64_t wavefronts = 0;
+    uint64_t ideal_wavefronts = 0;
+    uint64_t conflicted = 0;
+    // replays[n] = instructions needing n extra wavefronts over the ideal, capped
+    uint64_t replays[MAX_WAVEFRONTS + 1] = {0};
+
+    double replay_factor() const {
+        return ideal_wavefronts ? (double)wavefronts / ideal_wavefronts : 1.0;
+    }
+} BankStats_t;
+
+typedef struct KernelBankStats {
+    uint64_t instructions = 0;
+    uint64_t stores = 0;
+    BankStats_t modes[NUM_BANK_MODES];
+} KernelBankStats_t;
+
+static uint32_t shared_flag = ACCESS_FLAG_SHARED;
+static uint64_t global_accesses = 0;
+
+static std::map<std::string, KernelBankStats_t> kernel_stats;
+static KernelBankStats_t* cur_kernel_stats = nullptr;
+
+
+BankConflict::BankConflict() : Tool(BANK_CONFLICT) {
+    const char* env_flag = std::getenv("YOSEMITE_SHARED_MEM_FLAG");
+    if (env_flag != nullptr) {
+        shared_flag = std::strtoul(env_flag, nullptr, 0);
+    }
+    fprintf(stdout, "Bank conflict analysis on accesses with flag 0x%x, %s warp kernels.\n",
+            shared_flag, warp_simd_isa());
+}
+
+
+BankConflict::~BankConflict() {}
+
+
+void BankConflict::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_stats = &kernel_stats[kernel->kernel_name];
+}
+
+
+void BankConflict::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    cur_kernel_stats = nullptr;
+}
+
+
+void BankConflict::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+}
+
+
+void BankConflict::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+}
+
+
+void BankConflict::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+// Wavefronts of one warp access for banks of (1 << shift) bytes.
+static void count_wavefronts(const MemoryAccess& access, uint32_t active, uint32_t shift,
+                             uint32_t& wavefronts, uint32_t& ideal) {
+    uint32_t words_per_lane = (access.accessSize + (1u << shift) - 1) >> shift;
+    if (words_per_lane <= 1) {
+        wavefronts = warp_bank_load(access.addresses, active, shift);
+        ideal = 1;
+        return;
+    }
+    words_per_lane = std::min(words_per_lane, (uint32_t)GPU_WARP_SIZE);
+
+    // each phase serves GPU_WARP_SIZE / words_per_lane lanes, laid out word by word;
+    // the last phase is partial when words_per_lane does not divide the warp
+    uint32_t lanes_per_phase = GPU_WARP_SIZE / words_per_lane;
+    uint64_t words[GPU_WARP_SIZE] = {};
+    wavefronts = 0;
+    ideal = 0;
+    for (uint32_t first = 0; first < GPU_WARP_SIZE; first += lanes_per_phase) {
+        uint32_t phase_active = 0;
+        uint32_t slot = 0;
+        uint32_t phase_end = std::min(first + lanes_per_phase, (uint32_t)GPU_WARP_SIZE);
+        for (uint32_t lane = first; lane < phase_end; lane++) {
+            for (uint32_t w = 0; w < words_per_lane; w++, slot++) {
+                words[slot] = 0;
+                if (active >> lane & 1) {
+                    words[slot] = access.addresses[lane] + ((uint64_t)w << shift);
+                    phase_active |= 1u << slot;
+                }
+            }
+        }
+        if (phase_active == 0) {
+            continue;
+        }
+        wavefronts += warp_bank_load(words, phase_active, shift);
+        ideal++;
+    }
+}
+
+
+void BankConflict::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_kernel_stats == nullptr) {
+        cur_kernel_stats = &kernel_stats["<unknown>"];
+    }
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        global_accesses++;
+        if (!(access.flags & shared_flag)) {
+            continue;
+        }
+        uint32_t active = warp_active_mask(access.addresses);
+        if (active == 0) {
+            continue;
+        }
+        cur_kernel_stats->instructions++;
+        cur_kernel_stats->stores += access_is_write(access.flags);
+        for (uint32_t m = 0; m < NUM_BANK_MODES; m++) {
+            uint32_t wavefronts, ideal;
+            count_wavefronts(access, active, BANK_SHIFTS[m], wavefronts, ideal);
+            BankStats_t& stats = cur_kernel_stats->modes[m];
+            stats.wavefronts += wavefronts;
+            stats.ideal_wavefronts += ideal;
+            stats.conflicted += wavefronts > ideal;
+            stats.replays[std::min(wavefronts - ideal, MAX_WAVEFRONTS)]++;
+        }
+    }
+}
+
+
+void BankConflict::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+void BankConflict::flush() {
+    std::string filename = get_output_name("bank_conflict") + ".log";
+    printf("Dumping bank conflict analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(4);
+
+    std::vector<std::pair<std::string, KernelBankStats_t*>> kernels;
+    uint64_t shared_accesses = 0;
+    for (auto& it : kernel_stats) {
+        if (it.second.instructions > 0) {
+            kernels.emplace_back(it.first, &it.second);
+            shared_accesses += it.second.instructions;
+        }
+    }
+    out << "Shared memory accesses: " << shared_accesses << " of " << global_accesses
+        << " (flag 0x" << std::hex << shared_flag << std::dec << ")" << std::endl;
+    if (shared_accesses == 0) {
+        out << "No access carried the shared memory flag; is the GPU patch recording shared memory?"
+            << std::endl;
+    }
+    out << std::endl;
+
+    // most extra wavefronts (4B banks) first
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        const BankStats_t& sa = a.second->modes[0];
+        const BankStats_t& sb = b.second->modes[0];
+        return sa.wavefronts - sa.ideal_wavefronts > sb.wavefronts - sb.ideal_wavefronts;
+    });
+
+    for (auto& kernel : kernels) {
+        out << kernel.first << " (insts=" << kernel.second->instructions
+            << ", stores=" << kernel.second->stores << ")" << std::endl;
+        for (uint32_t m = 0; m < NUM_BANK_MODES; m++) {
+            const BankStats_t& stats = kernel.second->modes[m];
+            out << "  " << BANK_MODE_NAMES[m] << " banks: wavefronts=" << stats.wavefronts
+                << " ideal=" << stats.ideal_wavefronts
+                << " replay_factor=" << stats.replay_factor()
+                << " conflicted_insts=" << stats.conflicted
+                << " extra wavefronts histogram:";
+            for (uint32_t n = 0; n <= MAX_WAVEFRONTS; n++) {
+                if (stats.replays[n] > 0) {
+                    out << " " << n << ":" << stats.replays[n];
+                }
+            }
+            out << std::endl;
+        }
+    }
+
+    out.close();
+}
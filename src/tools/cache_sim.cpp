@@ -0,0 +1,384 @@
+/**
+ * Trace-driven cache simulation.
+ * Warp accesses are coalesced into sector requests and replayed through one
+ * or more cache configurations (e.g. YOSEMITE_CACHE_SIZE=40MB,50MB). Sets are
+ * partitioned across threads; each partition keeps its own counters, merged
+ * per kernel and per allocation.
+ */
+#include "tools/cache_sim.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/access_flags.h"
+#include "utils/address_index.h"
+#include "utils/cache_model.h"
+#include "utils/thread_pool.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+typedef struct SectorRequest {
+    uint64_t sector;
+    uint32_t alloc_id;
+    uint32_t is_write;
+} SectorRequest_t;
+
+typedef struct CachePartition {
+    std::vector<SectorRequest_t> requests;
+    CacheStats_t kernel_stats;
+    std::vector<CacheStats_t> alloc_stats;     // indexed by allocation slot
+    CacheStats_t unknown_stats;                 // sectors outside every allocation
+} CachePartition_t;
+
+typedef struct AllocationInfo {
+    DevPtr addr;
+    uint64_t size;
+} AllocationInfo_t;
+
+static std::vector<std::unique_ptr<CacheModel>> caches;
+// partitions[c][p] holds the requests of cache c falling into sets of partition p
+static std::vector<std::vector<CachePartition_t>> partitions;
+static uint32_t num_partitions = 1;
+static std::unique_ptr<ThreadPool> _pool;
+
+static uint64_t pending_requests = 0;
+static uint64_t max_pending_requests = 1 << 18;
+
+/**
+ * Live allocations by slot. A freed slot is reused by the next allocation and
+ * its counters are folded into freed_stats first, so memory follows the live
+ * allocations rather than every allocation ever made.
+ */
+static AddressIndex alloc_index;
+static std::vector<AllocationInfo_t> allocations;
+static std::vector<uint32_t> free_slots;
+static std::vector<CacheStats_t> freed_stats;     // per cache
+static uint64_t num_freed = 0;
+
+static std::map<std::string, std::vector<CacheStats_t>> kernel_stats;
+static std::vector<CacheStats_t>* cur_kernel_stats = nullptr;
+static uint32_t sector_shift = 5;
+
+
+CacheSim::CacheSim() : Tool(CACHE_SIM) {
+    CacheConfig_t base;
+    const char* env_line = std::getenv("YOSEMITE_CACHE_LINE_SIZE");
+    if (env_line != nullptr) {
+        base.line_size = std::max(std::atoi(env_line), 0);
+    }
+    const char* env_sector = std::getenv("YOSEMITE_CACHE_SECTOR_SIZE");
+    if (env_sector != nullptr) {
+        base.sector_size = std::max(std::atoi(env_sector), 0);
+    }
+    const char* env_assoc = std::getenv("YOSEMITE_CACHE_ASSOC");
+    if (env_assoc != nullptr) {
+        base.assoc = std::max(std::atoi(env_assoc), 0);
+    }
+    const char* env_policy = std::getenv("YOSEMITE_CACHE_POLICY");
+    if (env_policy != nullptr) {
+        base.policy = parse_cache_policy(env_policy);
+    }
+    const char* env_hashed = std::getenv("YOSEMITE_CACHE_HASHED_INDEX");
+    if (env_hashed != nullptr) {
+        base.hashed_index = std::string(env_hashed) != "0";
+    }
+
+    // one simulated cache per size in the comma separated list
+    std::string sizes = "40MB";
+    const char* env_size = std::getenv("YOSEMITE_CACHE_SIZE");
+    if (env_size != nullptr) {
+        sizes = env_size;
+    }
+    std::stringstream ss(sizes);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        CacheConfig_t config = base;
+        config.size = parse_size(item);
+        if (config.size == 0) {
+            fprintf(stderr, "Invalid cache size %s, ignored.\n", item.c_str());
+            continue;
+        }
+        caches.push_back(std::make_unique<CacheModel>(config));
+    }
+    if (caches.empty()) {
+        caches.push_back(std::make_unique<CacheModel>(base));
+    }
+    sector_shift = caches[0]->sector_shift();
+
+    uint32_t num_threads = default_thread_count("YOSEMITE_CACHE_THREADS");
+    if (num_threads > 0) {
+        _pool.reset(new ThreadPool(num_threads));
+        num_partitions = num_threads;
+    }
+    partitions.resize(caches.size());
+    freed_stats.resize(caches.size());
+    for (auto& cache_partitions : partitions) {
+        cache_partitions.resize(num_partitions);
+    }
+
+    const char* env_batch = std::getenv("YOSEMITE_CACHE_BATCH");
+    if (env_batch != nullptr) {
+        max_pending_requests = std::max(std::atoll(env_batch), 1LL);
+    }
+
+    for (auto& cache : caches) {
+        fprintf(stdout, "Simulating cache: %s\n", cache->describe().c_str());
+    }
+    fprintf(stdout, "Cache simulation threads: %u\n", num_threads);
+}
+
+
+CacheSim::~CacheSim() {}
+
+
+static void simulate_partition(uint32_t c, uint32_t p) {
+    CacheModel& cache = *caches[c];
+    CachePartition_t& partition = partitions[c][p];
+    for (auto& request : partition.requests) {
+        CacheStats_t& alloc = request.alloc_id == AddressIndex::NONE ?
+                              partition.unknown_stats : partition.alloc_stats[request.alloc_id];
+        CacheResult_t result = cache.access(request.sector, request.is_write, partition.kernel_stats);
+        // replay the outcome on the allocation counters without a second lookup
+        alloc.accesses++;
+        alloc.writes += request.is_write;
+        alloc.hits += result == CACHE_HIT;
+        alloc.sector_misses += result == CACHE_SECTOR_MISS;
+        alloc.line_misses += result == CACHE_LINE_MISS;
+    }
+    partition.requests.clear();
+}
+
+
+static void simulate_pending() {
+    if (pending_requests == 0) {
+        return;
+    }
+    if (cur_kernel_stats == nullptr) {
+        cur_kernel_stats = &kernel_stats["<unknown>"];
+        cur_kernel_stats->resize(caches.size());
+    }
+    for (auto& cache_partitions : partitions) {
+        for (auto& partition : cache_partitions) {
+            partition.alloc_stats.resize(allocations.size());
+        }
+    }
+
+    for (uint32_t c = 0; c < caches.size(); c++) {
+        for (uint32_t p = 0; p < num_partitions; p++) {
+            if (partitions[c][p].requests.empty()) {
+                continue;
+            }
+            if (_pool) {
+                _pool->submit([c, p] { simulate_partition(c, p); });
+            } else {
+                simulate_partition(c, p);
+            }
+        }
+    }
+    if (_pool) {
+        _pool->wait();
+    }
+
+    for (uint32_t c = 0; c < caches.size(); c++) {
+        for (auto& partition : partitions[c]) {
+            (*cur_kernel_stats)[c].merge(partition.kernel_stats);
+            partition.kernel_stats = CacheStats_t();
+        }
+    }
+    pending_requests = 0;
+}
+
+
+void CacheSim::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_stats = &kernel_stats[kernel->kernel_name];
+    cur_kernel_stats->resize(caches.size());
+    alloc_index.refresh();
+}
+
+
+void CacheSim::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    simulate_pending();
+    cur_kernel_stats = nullptr;
+}
+
+
+void CacheSim::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    uint32_t slot = allocations.size();
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        allocations[slot] = AllocationInfo_t{mem->addr, mem->size};
+    } else {
+        allocations.push_back(AllocationInfo_t{mem->addr, mem->size});
+    }
+    alloc_index.insert(mem->addr, mem->size, slot);
+}
+
+
+void CacheSim::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    uint32_t slot = alloc_index.find(mem->addr);
+    if (slot == AddressIndex::NONE || allocations[slot].addr != mem->addr) {
+        return;
+    }
+    // requests still queued may belong to the slot
+    simulate_pending();
+    for (uint32_t c = 0; c < caches.size(); c++) {
+        for (auto& partition : partitions[c]) {
+            if (slot < partition.alloc_stats.size()) {
+                freed_stats[c].merge(partition.alloc_stats[slot]);
+                partition.alloc_stats[slot] = CacheStats_t();
+            }
+        }
+    }
+    num_freed++;
+    alloc_index.erase(mem->addr);
+    free_slots.push_back(slot);
+}
+
+
+void CacheSim::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void CacheSim::gpu_data_analysis(void* data, uint64_t size) {
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        uint32_t unique = warp_unique_mask(access.addresses, active, sector_shift);
+        uint32_t span = std::max((access.accessSize + (1u << sector_shift) - 1) >> sector_shift, 1u);
+        uint32_t is_write = access_is_write(access.flags);
+        while (unique) {
+            uint32_t lane = __builtin_ctz(unique);
+            unique &= unique - 1;
+            uint32_t alloc_id = alloc_index.find(access.addresses[lane]);
+            uint64_t sector = access.addresses[lane] >> sector_shift;
+            for (uint32_t j = 0; j < span; j++) {
+                for (uint32_t c = 0; c < caches.size(); c++) {
+                    uint64_t line = (sector + j) >> (caches[c]->line_shift() - sector_shift);
+                    uint32_t p = (uint64_t)caches[c]->set_of(line) * num_partitions / caches[c]->num_sets();
+                    partitions[c][p].requests.push_back(SectorRequest_t{sector + j, alloc_id, is_write});
+                }
+                pending_requests++;
+            }
+        }
+    }
+    if (pending_requests >= max_pending_requests) {
+        simulate_pending();
+    }
+}
+
+
+void CacheSim::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static void dump_stats(std::ofstream& out, const CacheStats_t& stats) {
+    out << "accesses=" << stats.accesses
+        << " writes=" << stats.writes
+        << " hits=" << stats.hits
+        << " sector_misses=" << stats.sector_misses
+        << " line_misses=" << stats.line_misses
+        << " writebacks=" << stats.writebacks
+        << " hit_rate=" << 100.0 * stats.hit_rate() << "%";
+}
+
+
+void CacheSim::flush() {
+    simulate_pending();
+
+    std::string filename = get_output_name("cache_sim") + ".log";
+    printf("Dumping cache simulation to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(4);
+
+    std::vector<std::pair<std::string, std::vector<CacheStats_t>*>> kernels;
+    for (auto& it : kernel_stats) {
+        kernels.emplace_back(it.first, &it.second);
+    }
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        return (*a.second)[0].accesses > (*b.second)[0].accesses;
+    });
+
+    for (uint32_t c = 0; c < caches.size(); c++) {
+        out << "==================== Cache " << c << ": " << caches[c]->describe()
+            << " ====================" << std::endl;
+
+        CacheStats_t total;
+        for (auto& kernel : kernels) {
+            total.merge((*kernel.second)[c]);
+        }
+        out << "Total: ";
+        dump_stats(out, total);
+        out << std::endl << std::endl;
+
+        out << "Kernels:" << std::endl;
+        for (auto& kernel : kernels) {
+            dump_stats(out, (*kernel.second)[c]);
+            out << "\t" << kernel.first << std::endl;
+        }
+        out << std::endl;
+
+        std::vector<CacheStats_t> alloc_stats(allocations.size());
+        std::vector<bool> live(allocations.size(), false);
+        for (auto& entry : alloc_index.entries()) {
+            live[entry.id] = true;
+        }
+        CacheStats_t unknown_stats;
+        for (auto& partition : partitions[c]) {
+            for (uint32_t i = 0; i < partition.alloc_stats.size(); i++) {
+                alloc_stats[i].merge(partition.alloc_stats[i]);
+            }
+            unknown_stats.merge(partition.unknown_stats);
+        }
+        // writebacks are only known to the cache, not to the allocation replay
+        out << "Allocations:" << std::endl;
+        for (uint32_t i = 0; i < allocations.size(); i++) {
+            if (!live[i] || alloc_stats[i].accesses == 0) {
+                continue;
+            }
+            out << "Alloc " << i << " " << allocations[i].addr << " " << allocations[i].size
+                << " (" << format_size(allocations[i].size) << "): ";
+            dump_stats(out, alloc_stats[i]);
+            out << std::endl;
+        }
+        if (freed_stats[c].accesses > 0) {
+            out << "Freed allocations (" << num_freed << "): ";
+            dump_stats(out, freed_stats[c]);
+            out << std::endl;
+        }
+        if (unknown_stats.accesses > 0) {
+            out << "Outside allocations: ";
+            dump_stats(out, unknown_stats);
+            out << std::endl;
+        }
+        out << std::endl;
+    }
+
+    out.close();
+}
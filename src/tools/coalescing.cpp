@@ -0,0 +1,252 @@
+/**
+ * Online warp coalescing analysis.
+ * For every warp-level access: active lanes, distinct 32B sectors and 128B
+ * lines touched, bytes requested vs. bytes moved. Aggregated per kernel name
+ * and per allocation, no trace is written.
+ */
+#include "tools/coalescing.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/access_flags.h"
+#include "utils/address_index.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t SECTOR_SHIFT = 5;
+static constexpr uint32_t LINE_SHIFT = 7;
+
+typedef struct CoalescingStats {
+    uint64_t instructions = 0;
+    uint64_t store_instructions = 0;
+    uint64_t active_lanes = 0;
+    uint64_t sectors = 0;
+    uint64_t lines = 0;
+    uint64_t requested_bytes = 0;
+    uint64_t transferred_bytes = 0;
+    // sectors_hist[n] = instructions touching n sectors (capped at 32)
+    uint64_t sectors_hist[GPU_WARP_SIZE + 1] = {0};
+
+    void add(uint32_t lanes, uint32_t num_sectors, uint32_t num_lines,
+             uint64_t requested, bool is_store) {
+        instructions++;
+        store_instructions += is_store;
+        active_lanes += lanes;
+        sectors += num_sectors;
+        lines += num_lines;
+        requested_bytes += requested;
+        transferred_bytes += (uint64_t)num_sectors << SECTOR_SHIFT;
+        sectors_hist[std::min<uint32_t>(num_sectors, GPU_WARP_SIZE)]++;
+    }
+
+    void merge(const CoalescingStats& other) {
+        instructions += other.instructions;
+        store_instructions += other.store_instructions;
+        active_lanes += other.active_lanes;
+        sectors += other.sectors;
+        lines += other.lines;
+        requested_bytes += other.requested_bytes;
+        transferred_bytes += other.transferred_bytes;
+        for (uint32_t n = 0; n <= GPU_WARP_SIZE; n++) {
+            sectors_hist[n] += other.sectors_hist[n];
+        }
+    }
+} CoalescingStats_t;
+
+typedef struct AllocationStats {
+    DevPtr addr;
+    uint64_t size;
+    CoalescingStats_t stats;
+} AllocationStats_t;
+
+static std::map<std::string, CoalescingStats_t> kernel_stats;
+static CoalescingStats_t* cur_kernel_stats = nullptr;
+
+// live allocations by slot, a freed slot is folded into freed_stats and reused
+static AddressIndex alloc_index;
+static std::vector<AllocationStats_t> alloc_stats;
+static std::vector<uint32_t> free_slots;
+static CoalescingStats_t freed_stats;
+static uint64_t num_freed = 0;
+static CoalescingStats_t unknown_stats;
+
+
+Coalescing::Coalescing() : Tool(COALESCING) {
+    fprintf(stdout, "Coalescing analysis using %s warp kernels.\n", warp_simd_isa());
+}
+
+
+Coalescing::~Coalescing() {}
+
+
+void Coalescing::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_stats = &kernel_stats[kernel->kernel_name];
+    alloc_index.refresh();
+}
+
+
+void Coalescing::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    cur_kernel_stats = nullptr;
+}
+
+
+void Coalescing::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    uint32_t slot = alloc_stats.size();
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        alloc_stats[slot] = AllocationStats_t{mem->addr, mem->size, CoalescingStats_t()};
+    } else {
+        alloc_stats.push_back(AllocationStats_t{mem->addr, mem->size, CoalescingStats_t()});
+    }
+    alloc_index.insert(mem->addr, mem->size, slot);
+}
+
+
+void Coalescing::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    uint32_t slot = alloc_index.find(mem->addr);
+    if (slot == AddressIndex::NONE || alloc_stats[slot].addr != mem->addr) {
+        return;
+    }
+    freed_stats.merge(alloc_stats[slot].stats);
+    alloc_stats[slot].stats = CoalescingStats_t();
+    num_freed++;
+    alloc_index.erase(mem->addr);
+    free_slots.push_back(slot);
+}
+
+
+void Coalescing::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void Coalescing::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_kernel_stats == nullptr) {
+        cur_kernel_stats = &kernel_stats["<unknown>"];
+    }
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        if (active == 0) {
+            continue;
+        }
+        uint32_t lanes = __builtin_popcount(active);
+        uint32_t sectors = __builtin_popcount(warp_unique_mask(access.addresses, active, SECTOR_SHIFT));
+        uint32_t lines = __builtin_popcount(warp_unique_mask(access.addresses, active, LINE_SHIFT));
+        if (access.accessSize > (1u << SECTOR_SHIFT)) {
+            // wide accesses cover several consecutive sectors per lane
+            sectors *= (access.accessSize + (1u << SECTOR_SHIFT) - 1) >> SECTOR_SHIFT;
+        }
+        uint64_t requested = (uint64_t)lanes * access.accessSize;
+        bool is_store = access_is_write(access.flags);
+
+        cur_kernel_stats->add(lanes, sectors, lines, requested, is_store);
+
+        // all lanes of an instruction almost always hit the same allocation
+        uint32_t alloc_id = alloc_index.find(access.addresses[__builtin_ctz(active)]);
+        if (alloc_id != AddressIndex::NONE) {
+            alloc_stats[alloc_id].stats.add(lanes, sectors, lines, requested, is_store);
+        } else {
+            unknown_stats.add(lanes, sectors, lines, requested, is_store);
+        }
+    }
+}
+
+
+void Coalescing::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static void dump_stats(std::ofstream& out, const CoalescingStats_t& stats) {
+    double insts = stats.instructions ? stats.instructions : 1;
+    double efficiency = stats.transferred_bytes
+                        ? 100.0 * stats.requested_bytes / stats.transferred_bytes : 100.0;
+    out << "insts=" << stats.instructions
+        << " stores=" << stats.store_instructions
+        << " lanes/inst=" << stats.active_lanes / insts
+        << " sectors/inst=" << stats.sectors / insts
+        << " lines/inst=" << stats.lines / insts
+        << " requested=" << stats.requested_bytes
+        << " transferred=" << stats.transferred_bytes
+        << " efficiency=" << efficiency << "%";
+}
+
+
+void Coalescing::flush() {
+    std::string filename = get_output_name("coalescing") + ".log";
+    printf("Dumping coalescing analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(4);
+
+    // kernels moving the most bytes first
+    std::vector<std::pair<std::string, CoalescingStats_t*>> kernels;
+    for (auto& it : kernel_stats) {
+        kernels.emplace_back(it.first, &it.second);
+    }
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        return a.second->transferred_bytes > b.second->transferred_bytes;
+    });
+
+    out << "==================== Kernels ====================" << std::endl;
+    for (auto& kernel : kernels) {
+        dump_stats(out, *kernel.second);
+        out << "\t" << kernel.first << std::endl;
+        out << "  sectors/inst histogram:";
+        for (uint32_t n = 1; n <= GPU_WARP_SIZE; n++) {
+            if (kernel.second->sectors_hist[n] > 0) {
+                out << " " << n << ":" << kernel.second->sectors_hist[n];
+            }
+        }
+        out << std::endl;
+    }
+    out << std::endl;
+
+    out << "==================== Allocations ====================" << std::endl;
+    for (uint32_t i = 0; i < alloc_stats.size(); i++) {
+        auto& alloc = alloc_stats[i];
+        if (alloc.stats.instructions == 0) {
+            continue;
+        }
+        out << "Alloc " << i << " " << alloc.addr << " " << alloc.size
+            << " (" << format_size(alloc.size) << "): ";
+        dump_stats(out, alloc.stats);
+        out << std::endl;
+    }
+    if (freed_stats.instructions > 0) {
+        out << "Freed allocations (" << num_freed << "): ";
+        dump_stats(out, freed_stats);
+        out << std::endl;
+    }
+    if (unknown_stats.instructions > 0) {
+        out << "Outside allocations: ";
+        dump_stats(out, unknown_stats);
+        out << std::endl;
+    }
+
+    out.close();
+}
@@ -1,6 +1,7 @@
 #include "tools/code_check.h"
 #include "utils/helper.h"
 #include "utils/hash.h"
+#include "utils/flat_hash.h"
 #include "gpu_patch.h"
 #include "cpp_trace.h"
 #include "py_frame.h"
@@ -51,12 +52,44 @@ struct TenStats {
 };
 
 
+/**
+ * cudaMalloc/cudaFree churn, one entry per (size class, call site). A
+ * reallocation is an allocation made while a buffer of the same entry has
+ * been freed and not replaced yet: a pool holding max_live buffers of the
+ * class would have served it without the two synchronizing calls. Times are
+ * in kernels launched.
+ */
+struct ChurnStats {
+    uint64_t size_class = 0;
+    uint64_t callsite = 0;
+    uint64_t allocs = 0;
+    uint64_t reallocs = 0;
+    uint64_t live = 0;
+    uint64_t max_live = 0;
+    uint64_t freed = 0;             // freed and not reallocated yet
+    uint64_t max_size = 0;
+    uint64_t freed_kernels = 0;     // summed over reallocations
+    uint64_t last_free_kernel = 0;
+};
+
+struct LiveAlloc {
+    uint64_t key = 0;
+    uint64_t size = 0;
+};
+
+
 std::map<MemcpyDirection_t, CpyStats> cpy_stats;
 SetStats set_stats;
 MemStats mem_stats;
 TenStats ten_stats;
 uint64_t kernel_count = 0;
 
+static FlatHashMap<ChurnStats> churn_stats;
+static FlatHashMap<LiveAlloc> live_allocs;
+static std::map<uint64_t, std::string> callsites;
+static bool churn_callsite = false;
+static uint64_t churn_min_reallocs = 2;
+
 
 std::string vector2str(std::vector<std::string> &vec, int skip_first = 0, int skip_last = 0) {
     if (skip_first + skip_last > vec.size()) {
@@ -78,6 +111,38 @@ void CodeCheck::init() {
     }
     init_backtrace(lib_path.c_str());
 
+    // call sites split the size classes further but cost a backtrace per cudaMalloc
+    const char* env_callsite = std::getenv("YOSEMITE_CHURN_CALLSITE");
+    churn_callsite = env_callsite && std::string(env_callsite) == "1";
+    const char* env_min_reallocs = std::getenv("YOSEMITE_CHURN_MIN_REALLOCS");
+    if (env_min_reallocs) {
+        churn_min_reallocs = std::max(std::atoll(env_min_reallocs), 1LL);
+    }
+}
+
+
+static uint64_t size_class(uint64_t size) {
+    uint64_t rounded = 1;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+
+static uint64_t churn_key(uint64_t size, uint64_t& callsite) {
+    callsite = 0;
+    if (churn_callsite) {
+        auto backtraces = get_backtrace();
+        std::string bt_str = vector2str(backtraces);
+        callsite = fast_hash64(bt_str.data(), bt_str.size());
+        if (callsites.find(callsite) == callsites.end()) {
+            callsites.emplace(callsite, bt_str);
+        }
+    }
+    // the whole call site hash takes part in the key, call sites never merge
+    uint64_t log2_class = __builtin_ctzll(size_class(size));
+    return churn_callsite ? hash_combine(callsite, log2_class) : log2_class;
 }
 
 
@@ -127,6 +192,25 @@ void CodeCheck::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
     mem_stats.alloc_count++;
     mem_stats.alloc_size += mem->size;
 
+    uint64_t callsite;
+    uint64_t key = churn_key(mem->size, callsite);
+    auto slot = churn_stats.try_emplace(key);
+    ChurnStats& churn = *slot.first;
+    if (slot.second) {
+        churn.size_class = size_class(mem->size);
+        churn.callsite = callsite;
+    }
+    churn.allocs++;
+    churn.live++;
+    churn.max_live = std::max(churn.max_live, churn.live);
+    churn.max_size = std::max(churn.max_size, mem->size);
+    if (churn.freed > 0) {
+        churn.freed--;
+        churn.reallocs++;
+        churn.freed_kernels += kernel_count - churn.last_free_kernel;
+    }
+    live_allocs[mem->addr] = LiveAlloc{key, mem->size};
+
     _timer.increment(true);
 }
 
@@ -135,6 +219,17 @@ void CodeCheck::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
     mem_stats.free_count++;
     mem_stats.free_size += mem->size;
 
+    LiveAlloc* alloc = live_allocs.find(mem->addr);
+    if (alloc != nullptr) {
+        ChurnStats* churn = churn_stats.find(alloc->key);
+        if (churn != nullptr) {
+            churn->live--;
+            churn->freed++;
+            churn->last_free_kernel = kernel_count;
+        }
+        live_allocs.erase(mem->addr);
+    }
+
     _timer.increment(true);
 }
 
@@ -220,4 +315,37 @@ void CodeCheck::flush() {
     fprintf(stdout, "%-12s count: %-10lu, size: %lu (%s)\n", 
             "[TenFree]", ten_stats.free_count, ten_stats.free_size, format_size(ten_stats.free_size).c_str());
     fprintf(stdout, "--------------------------------------------------------------------------------\n");
+
+    std::vector<const ChurnStats*> churning;
+    churn_stats.for_each([&churning](uint64_t key, const ChurnStats& churn) {
+        if (churn.reallocs >= churn_min_reallocs) {
+            churning.push_back(&churn);
+        }
+    });
+    if (churning.empty()) {
+        return;
+    }
+    std::sort(churning.begin(), churning.end(), [](const ChurnStats* a, const ChurnStats* b) {
+        return a->reallocs * a->size_class > b->reallocs * b->size_class;
+    });
+
+    uint64_t pool_bytes = 0;
+    uint64_t avoided_calls = 0;
+    for (auto churn : churning) {
+        uint64_t pool = churn->max_live * churn->size_class;
+        pool_bytes += pool;
+        avoided_calls += 2 * churn->reallocs;
+        fprintf(stdout, "%-12s class: %-10s allocs: %-8lu reallocs: %-8lu max_live: %-4lu"
+                " max_size: %s, avg freed: %.1f kernels -> pool %lu x %s (%s)\n",
+                "[Churn]", format_size(churn->size_class).c_str(), churn->allocs, churn->reallocs,
+                churn->max_live, format_size(churn->max_size).c_str(),
+                (double)churn->freed_kernels / churn->reallocs,
+                churn->max_live, format_size(churn->size_class).c_str(), format_size(pool).c_str());
+        if (churn->callsite != 0) {
+            fprintf(stdout, "%s", callsites[churn->callsite].c_str());
+        }
+    }
+    fprintf(stdout, "%-12s pools: %lu size classes, %s, avoiding %lu cudaMalloc/cudaFree calls\n",
+            "[Churn]", churning.size(), format_size(pool_bytes).c_str(), avoided_calls);
+    fprintf(stdout, "--------------------------------------------------------------------------------\n");
 }
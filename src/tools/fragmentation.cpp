@@ -0,0 +1,472 @@
+/**
+ * PyTorch caching-allocator fragmentation.
+ * cudaMalloc allocations are the allocator's segments, tensor events are the
+ * blocks it carves out of them. The free space inside the segments is kept as
+ * an ordered set of free intervals, coalesced on tensor free and never merged
+ * across segments, with a size-ordered multiset for the largest free block.
+ * Every segment allocation is a reserved-memory growth; the tensor that lands
+ * in the new segment tells whether the growth was forced by fragmentation
+ * (enough free bytes, no block large enough) or by capacity, and the tensor
+ * sizes requested just before it form the sequence the growth is blamed on.
+ */
+#include "tools/fragmentation.h"
+#include "utils/helper.h"
+#include "utils/memory_timeline.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+typedef struct FreeBlock {
+    uint64_t size;
+    DevPtr segment;
+} FreeBlock_t;
+
+typedef struct GrowthEvent {
+    uint64_t time;
+    DevPtr segment;
+    uint64_t segment_size;
+    uint64_t reserved;
+    // free space inside the other segments when this one was added
+    uint64_t free_bytes;
+    uint64_t largest_free;
+    // first tensor placed into the new segment, 0 until it arrives
+    uint64_t request = 0;
+    bool fragmentation = false;
+    std::string kernel;
+    std::vector<uint64_t> recent;
+} GrowthEvent_t;
+
+typedef struct GrowthSequence {
+    uint64_t count = 0;
+    uint64_t fragmentation_count = 0;
+    uint64_t grown_bytes = 0;
+} GrowthSequence_t;
+
+static Timer_t _timer;
+static std::string last_kernel = "<none>";
+
+static std::map<DevPtr, uint64_t> segments;
+static std::map<DevPtr, FreeBlock_t> free_blocks;
+static std::map<uint64_t, uint64_t> free_sizes;     // block size -> count
+static std::map<DevPtr, uint64_t> live_tensors;
+
+static uint64_t reserved_bytes = 0;
+static uint64_t allocated_bytes = 0;
+static uint64_t free_bytes = 0;
+static uint64_t num_segment_allocs = 0;
+static uint64_t num_tensor_allocs = 0;
+static uint64_t untracked_tensors = 0;
+static uint64_t untracked_tensor_bytes = 0;
+
+// last totals reported by the allocator itself
+static int64_t reported_allocated = 0;
+static int64_t reported_reserved = 0;
+static int64_t peak_reported_reserved = 0;
+
+// worst free-but-reserved state seen
+static uint64_t worst_free_bytes = 0;
+static uint64_t worst_largest_free = 0;
+static uint64_t worst_time = 0;
+
+static std::vector<GrowthEvent_t> growth_events;
+static size_t pending_growth = SIZE_MAX;
+static std::deque<uint64_t> recent_requests;
+static uint32_t history_length = 4;
+
+static MemoryTimeline reserved_timeline;
+static MemoryTimeline allocated_timeline;
+
+
+Fragmentation::Fragmentation() : Tool(FRAGMENTATION) {
+    const char* env_history = std::getenv("YOSEMITE_FRAG_HISTORY");
+    if (env_history) {
+        history_length = std::max(std::atoi(env_history), 0);
+    }
+    const char* env_buckets = std::getenv("YOSEMITE_FRAG_TIMELINE_BUCKETS");
+    uint32_t num_buckets = env_buckets ? std::max(std::atoi(env_buckets), 2) : 256;
+    reserved_timeline = MemoryTimeline(num_buckets);
+    allocated_timeline = MemoryTimeline(num_buckets);
+}
+
+
+Fragmentation::~Fragmentation() {}
+
+
+static uint64_t largest_free_block() {
+    return free_sizes.empty() ? 0 : free_sizes.rbegin()->first;
+}
+
+
+static void insert_free(DevPtr addr, uint64_t size, DevPtr segment) {
+    free_blocks[addr] = FreeBlock_t{size, segment};
+    free_sizes[size]++;
+}
+
+
+static void erase_free(std::map<DevPtr, FreeBlock_t>::iterator it) {
+    auto size_it = free_sizes.find(it->second.size);
+    if (--size_it->second == 0) {
+        free_sizes.erase(size_it);
+    }
+    free_blocks.erase(it);
+}
+
+
+// return [addr, addr + size) to its segment, merging with free neighbours of the same segment
+static void release_block(DevPtr addr, uint64_t size, DevPtr segment) {
+    free_bytes += size;
+    auto next = free_blocks.lower_bound(addr);
+    if (next != free_blocks.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second.size == addr && prev->second.segment == segment) {
+            addr = prev->first;
+            size += prev->second.size;
+            erase_free(prev);
+        }
+    }
+    if (next != free_blocks.end() && addr + size == next->first && next->second.segment == segment) {
+        size += next->second.size;
+        erase_free(next);
+    }
+    insert_free(addr, size, segment);
+}
+
+
+// carve [addr, addr + size) out of the free block holding it; false when no free block does
+static bool claim_block(DevPtr addr, uint64_t size, DevPtr& segment) {
+    auto it = free_blocks.upper_bound(addr);
+    if (it == free_blocks.begin()) {
+        return false;
+    }
+    --it;
+    DevPtr start = it->first;
+    FreeBlock_t block = it->second;
+    if (addr + size > start + block.size) {
+        return false;
+    }
+    erase_free(it);
+    if (addr > start) {
+        insert_free(start, addr - start, block.segment);
+    }
+    if (addr + size < start + block.size) {
+        insert_free(addr + size, start + block.size - addr - size, block.segment);
+    }
+    free_bytes -= size;
+    segment = block.segment;
+    return true;
+}
+
+
+static void update_worst() {
+    if (free_bytes > worst_free_bytes) {
+        worst_free_bytes = free_bytes;
+        worst_largest_free = largest_free_block();
+        worst_time = _timer.get();
+    }
+}
+
+
+void Fragmentation::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    last_kernel = kernel->kernel_name;
+    _timer.increment(true);
+}
+
+
+void Fragmentation::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+}
+
+
+void Fragmentation::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    if (segments.count(mem->addr) || mem->size == 0) {
+        return;
+    }
+    GrowthEvent_t growth;
+    growth.time = _timer.get();
+    growth.segment = mem->addr;
+    growth.segment_size = mem->size;
+    growth.free_bytes = free_bytes;
+    growth.largest_free = largest_free_block();
+    growth.kernel = last_kernel;
+    growth.recent.assign(recent_requests.begin(), recent_requests.end());
+
+    segments.emplace(mem->addr, mem->size);
+    reserved_bytes += mem->size;
+    num_segment_allocs++;
+    release_block(mem->addr, mem->size, mem->addr);
+    reserved_timeline.alloc(mem->addr, mem->size, _timer.get());
+
+    growth.reserved = reserved_bytes;
+    pending_growth = growth_events.size();
+    growth_events.push_back(growth);
+
+    _timer.increment(true);
+}
+
+
+void Fragmentation::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    auto segment = segments.find(mem->addr);
+    if (segment == segments.end()) {
+        return;
+    }
+    DevPtr start = segment->first;
+    DevPtr end = segment->first + segment->second;
+    // the allocator only releases empty segments, drop whatever we still think is inside
+    auto block = free_blocks.lower_bound(start);
+    while (block != free_blocks.end() && block->first < end) {
+        free_bytes -= block->second.size;
+        erase_free(block++);
+    }
+    auto tensor = live_tensors.lower_bound(start);
+    while (tensor != live_tensors.end() && tensor->first < end) {
+        allocated_bytes -= tensor->second;
+        allocated_timeline.free(tensor->first, _timer.get());
+        tensor = live_tensors.erase(tensor);
+    }
+    reserved_bytes -= segment->second;
+    reserved_timeline.free(segment->first, _timer.get());
+    segments.erase(segment);
+    if (pending_growth != SIZE_MAX && growth_events[pending_growth].segment == start) {
+        pending_growth = SIZE_MAX;
+    }
+
+    _timer.increment(true);
+}
+
+
+void Fragmentation::mem_cpy_callback(std::shared_ptr<MemCpy_t> mem) {
+}
+
+
+void Fragmentation::mem_set_callback(std::shared_ptr<MemSet_t> mem) {
+}
+
+
+void Fragmentation::ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten) {
+    reported_allocated = ten->allocated_size;
+    reported_reserved = ten->reserved_size;
+    peak_reported_reserved = std::max(peak_reported_reserved, reported_reserved);
+    num_tensor_allocs++;
+    uint64_t size = ten->size > 0 ? ten->size : 0;
+
+    DevPtr segment;
+    if (size == 0 || live_tensors.count(ten->addr) || !claim_block(ten->addr, size, segment)) {
+        // outside the segments we saw being created, or overlapping a live block
+        untracked_tensors++;
+        untracked_tensor_bytes += size;
+    } else {
+        live_tensors.emplace(ten->addr, size);
+        allocated_bytes += size;
+        allocated_timeline.alloc(ten->addr, size, _timer.get());
+        if (pending_growth != SIZE_MAX && growth_events[pending_growth].segment == segment) {
+            GrowthEvent_t& growth = growth_events[pending_growth];
+            growth.request = size;
+            growth.fragmentation = growth.free_bytes >= size;
+            pending_growth = SIZE_MAX;
+        }
+    }
+
+    if (history_length > 0) {
+        recent_requests.push_back(size);
+        if (recent_requests.size() > history_length) {
+            recent_requests.pop_front();
+        }
+    }
+    update_worst();
+
+    _timer.increment(true);
+}
+
+
+void Fragmentation::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
+    reported_allocated = ten->allocated_size;
+    reported_reserved = ten->reserved_size;
+
+    auto it = live_tensors.find(ten->addr);
+    if (it != live_tensors.end()) {
+        auto segment = std::prev(segments.upper_bound(it->first));
+        release_block(it->first, it->second, segment->first);
+        allocated_bytes -= it->second;
+        allocated_timeline.free(it->first, _timer.get());
+        live_tensors.erase(it);
+        update_worst();
+    }
+
+    _timer.increment(true);
+}
+
+
+void Fragmentation::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        case EventType_MEM_COPY:
+            mem_cpy_callback(std::dynamic_pointer_cast<MemCpy_t>(evt));
+            break;
+        case EventType_MEM_SET:
+            mem_set_callback(std::dynamic_pointer_cast<MemSet_t>(evt));
+            break;
+        case EventType_TEN_ALLOC:
+            ten_alloc_callback(std::dynamic_pointer_cast<TenAlloc_t>(evt));
+            break;
+        case EventType_TEN_FREE:
+            ten_free_callback(std::dynamic_pointer_cast<TenFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void Fragmentation::gpu_data_analysis(void* data, uint64_t size) {
+}
+
+
+void Fragmentation::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static double fragmentation_ratio(uint64_t free, uint64_t largest) {
+    return free > 0 ? 1.0 - (double)largest / free : 0.0;
+}
+
+
+// request sizes rounded up to a power of two, so that the same code path gives the same key
+static std::string size_class(uint64_t size) {
+    uint64_t rounded = 1;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return format_size(rounded);
+}
+
+
+void Fragmentation::flush() {
+    std::string filename = get_output_name("fragmentation") + ".log";
+    printf("Dumping fragmentation report to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out << "==================== Summary ====================" << std::endl;
+    out << "Segments: " << num_segment_allocs << " allocated, " << segments.size() << " live, reserved "
+        << format_size(reserved_bytes) << " (peak " << format_size(reserved_timeline.peak()) << ")" << std::endl;
+    out << "Tensors: " << num_tensor_allocs << " allocated, " << live_tensors.size() << " live, allocated "
+        << format_size(allocated_bytes) << " (peak " << format_size(allocated_timeline.peak()) << ")" << std::endl;
+    if (untracked_tensors > 0) {
+        out << "Untracked tensors (outside known segments): " << untracked_tensors
+            << ", " << format_size(untracked_tensor_bytes) << std::endl;
+    }
+    out << "Allocator reported: allocated " << format_size(std::max<int64_t>(reported_allocated, 0))
+        << ", reserved " << format_size(std::max<int64_t>(reported_reserved, 0))
+        << " (peak " << format_size(std::max<int64_t>(peak_reported_reserved, 0)) << ")" << std::endl;
+    out << "Free in reserved: " << format_size(free_bytes) << " in " << free_blocks.size()
+        << " blocks, largest " << format_size(largest_free_block())
+        << ", fragmentation " << fragmentation_ratio(free_bytes, largest_free_block()) << std::endl;
+    out << "Worst: " << format_size(worst_free_bytes) << " free at time " << worst_time
+        << ", largest " << format_size(worst_largest_free)
+        << ", fragmentation " << fragmentation_ratio(worst_free_bytes, worst_largest_free) << std::endl;
+    out << std::endl;
+
+    uint64_t fragmentation_growth = 0;
+    std::map<std::string, GrowthSequence_t> sequences;
+    out << "==================== Reserved growth ====================" << std::endl;
+    for (size_t i = 0; i < growth_events.size(); i++) {
+        auto& growth = growth_events[i];
+        std::string recent;
+        std::string key;
+        for (auto size : growth.recent) {
+            recent += (recent.empty() ? "" : ", ") + format_size(size);
+            key += size_class(size) + " ";
+        }
+        key += "-> " + (growth.request > 0 ? size_class(growth.request) : std::string("?"));
+        auto& sequence = sequences[key];
+        sequence.count++;
+        sequence.grown_bytes += growth.segment_size;
+        if (growth.fragmentation) {
+            sequence.fragmentation_count++;
+            fragmentation_growth += growth.segment_size;
+        }
+
+        out << "Growth " << i << ": time=" << growth.time << " +" << format_size(growth.segment_size)
+            << " reserved=" << format_size(growth.reserved)
+            << " free=" << format_size(growth.free_bytes)
+            << " largest=" << format_size(growth.largest_free)
+            << " request=" << (growth.request > 0 ? format_size(growth.request) : std::string("?"))
+            << " [" << (growth.request == 0 ? "unknown" : growth.fragmentation ? "fragmentation" : "capacity") << "]"
+            << " after " << growth.kernel << std::endl;
+        if (!recent.empty()) {
+            out << "    recent requests: " << recent << std::endl;
+        }
+    }
+    out << std::endl;
+
+    // sequences ending in a growth, the ones that cost the most reserved memory first
+    std::vector<std::pair<std::string, GrowthSequence_t>> sorted(sequences.begin(), sequences.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.grown_bytes > b.second.grown_bytes;
+    });
+    out << "==================== Growth sequences ====================" << std::endl;
+    for (auto& it : sorted) {
+        out << format_size(it.second.grown_bytes) << " in " << it.second.count << " growths ("
+            << it.second.fragmentation_count << " fragmentation):\t" << it.first << std::endl;
+    }
+    out << std::endl;
+
+    // free blocks by size class
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> histogram;
+    for (auto& it : free_sizes) {
+        uint64_t bucket = 1;
+        while (bucket < it.first) {
+            bucket <<= 1;
+        }
+        histogram[bucket].first += it.second;
+        histogram[bucket].second += it.first * it.second;
+    }
+    out << "==================== Free blocks ====================" << std::endl;
+    for (auto& it : histogram) {
+        out << "<= " << format_size(it.first) << ": " << it.second.first << " blocks, "
+            << format_size(it.second.second) << std::endl;
+    }
+    out << std::endl;
+
+    reserved_timeline.extend(_timer.get());
+    allocated_timeline.extend(_timer.get());
+    auto& reserved = reserved_timeline.buckets();
+    auto& allocated = allocated_timeline.buckets();
+    out << "==================== Timeline ====================" << std::endl;
+    out << "bucket width " << reserved_timeline.bucket_width()
+        << ": start reserved_min reserved_max allocated_min allocated_max" << std::endl;
+    for (size_t i = 0; i < reserved.size(); i++) {
+        out << reserved[i].start << " " << reserved[i].min << " " << reserved[i].max;
+        if (i < allocated.size()) {
+            out << " " << allocated[i].min << " " << allocated[i].max;
+        }
+        out << std::endl;
+    }
+    out.close();
+
+    fprintf(stdout, "Reserved %s (peak %s), allocated %s, free in reserved %s, largest free block %s\n",
+            format_size(reserved_bytes).c_str(), format_size(reserved_timeline.peak()).c_str(),
+            format_size(allocated_bytes).c_str(), format_size(free_bytes).c_str(),
+            format_size(largest_free_block()).c_str());
+    if (fragmentation_growth > 0) {
+        fprintf(stdout, "%s of reserved growth happened while enough memory was free but fragmented; "
+                "expandable_segments or reordering those allocations could reclaim it.\n",
+                format_size(fragmentation_growth).c_str());
+    }
+}
@@ -5,13 +5,20 @@
 #include "tools/hot_analysis.h"
 #include <cstring>
 #include "utils/helper.h"
+#include "utils/output_sink.h"
+#include "utils/flat_hash.h"
+#include "utils/space_saving.h"
+#include "utils/hotness_file.h"
+#include "utils/touch_reduce.h"
 #include "gpu_patch.h"
 
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <vector>
 #include <cassert>
 #include <cstring>
-#include <fstream>
+#include <sstream>
 
 
 using namespace yosemite;
@@ -20,10 +27,73 @@ constexpr uint32_t RANGE_GRANULARITY = 2 * 1024 * 1024;
 
 static std::map<DevPtr, std::shared_ptr<MemAlloc_t>> active_memories;
 static std::map<DevPtr, std::shared_ptr<TenAlloc>> active_tensors;
-static std::map<MemoryRange, uint32_t> range_access_counts;
+
+/**
+ * Hotness of one range, keyed by its start address. Entries go away with the
+ * allocation, so the table only ever holds the live ranges. score is an
+ * exponentially decayed access count, up to date as of last_kernel.
+ */
+typedef struct RangeHotness {
+    uint64_t end = 0;
+    uint64_t accesses = 0;
+    double score = 0;
+    uint64_t last_kernel = 0;
+} RangeHotness_t;
+
+typedef enum {
+    HOT_TIER = 0,
+    WARM_TIER = 1,
+    COLD_TIER = 2,
+} HotnessTier_t;
+
+static const char* tier_names[] = {"hot", "warm", "cold"};
+
+/**
+ * Accesses attributed to one tensor over its lifetime. A range that only
+ * partially overlaps a tensor contributes touch * overlap / range size, so
+ * counts are fractional.
+ */
+typedef struct TensorHotness {
+    DevPtr addr = 0;
+    uint64_t size = 0;
+    double accesses = 0;
+    uint64_t kernels = 0;
+    uint64_t alloc_kernel = 0;
+    uint64_t free_kernel = 0;
+    uint64_t first_kernel = 0;
+    uint64_t last_kernel = 0;
+} TensorHotness_t;
+
+// [start, end) of a tensor or an allocation and what the join attributed to it
+typedef struct Extent {
+    uint64_t start;
+    uint64_t end;
+    double accesses;
+} Extent_t;
+
+static FlatHashMap<RangeHotness_t> range_hotness;
+static std::map<DevPtr, TensorHotness_t> live_tensor_hotness;
+// freed tensors that were touched at least once
+static std::vector<TensorHotness_t> retired_tensor_hotness;
+// hottest ranges over the whole run, including the ones freed since
+static SpaceSaving top_ranges;
+static double half_life = 1000;
+static double hot_fraction = 0.8;
+static double warm_fraction = 0.95;
 
 static std::string output_directory;
+static std::shared_ptr<OutputSink> _sink;
 static uint32_t global_kernel_id = 0;
+static std::string current_kernel_name = "<unknown>";
+
+// YOSEMITE_HOT_FORMAT=binary: one hotness.bin container instead of kernel_N.txt files
+static bool binary_output = false;
+static HotnessWriter _writer;
+
+static std::vector<uint64_t> touched_bitmap;
+static uint64_t analyzed_kernels = 0;
+static uint64_t touched_objects = 0;
+static uint64_t touched_bytes = 0;
 
 
 HotAnalysis::HotAnalysis() : Tool(HOT_ANALYSIS) {
@@ -35,12 +105,50 @@ HotAnalysis::HotAnalysis() : Tool(HOT_ANALYSIS) {
         output_directory = "hotness_" + get_current_date_n_time();
     }
     check_folder_existance(output_directory);
+    _sink = create_output_sink();
+
+    const char* env_format = std::getenv("YOSEMITE_HOT_FORMAT");
+    if (env_format && std::string(env_format) == "binary") {
+        const char* env_keyframe = std::getenv("YOSEMITE_HOT_KEYFRAME");
+        uint32_t keyframe_interval = env_keyframe ? std::max(std::atoi(env_keyframe), 1) : 1024;
+        std::string filename = output_directory + "/hotness.bin";
+        binary_output = _writer.open(filename, keyframe_interval);
+        if (binary_output) {
+            printf("Dumping traces to %s\n", filename.c_str());
+        }
+    }
+
+    const char* env_topk = std::getenv("YOSEMITE_HOT_TOPK");
+    top_ranges = SpaceSaving(env_topk ? std::max(std::atoi(env_topk), 1) : 64);
+
+    // in kernel launches, a range not touched for half_life launches has half its score
+    const char* env_half_life = std::getenv("YOSEMITE_HOT_HALF_LIFE");
+    if (env_half_life && std::atof(env_half_life) > 0) {
+        half_life = std::atof(env_half_life);
+    }
+
+    // "hot,warm": share of the decayed score covered by the hot and the hot + warm ranges
+    const char* env_tiers = std::getenv("YOSEMITE_HOT_TIERS");
+    if (env_tiers) {
+        std::string tiers(env_tiers);
+        size_t comma = tiers.find(',');
+        double hot = std::atof(tiers.substr(0, comma).c_str());
+        double warm = comma != std::string::npos ? std::atof(tiers.substr(comma + 1).c_str()) : warm_fraction;
+        if (hot > 0 && hot <= warm && warm <= 1) {
+            hot_fraction = hot;
+            warm_fraction = warm;
+        } else {
+            fprintf(stderr, "Invalid YOSEMITE_HOT_TIERS %s, using %.2f,%.2f.\n",
+                    env_tiers, hot_fraction, warm_fraction);
+        }
+    }
 }
 
 HotAnalysis::~HotAnalysis() {
 }
 
 void HotAnalysis::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    current_kernel_name = kernel->kernel_name;
 }
 
 void HotAnalysis::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
@@ -50,8 +158,30 @@ void HotAnalysis::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
     active_memories.emplace(mem->addr, mem);
 }
 
+static void split_ranges(const MemAlloc_t& mem, std::vector<MemoryRange>& ranges) {
+    if (mem.size <= RANGE_GRANULARITY) {
+        ranges.push_back(MemoryRange{mem.addr, mem.addr + mem.size});
+        return;
+    }
+    uint64_t start = mem.addr;
+    uint64_t end = mem.addr + mem.size;
+    while (start < end) {
+        ranges.push_back(MemoryRange{start, std::min(start + RANGE_GRANULARITY, end)});
+        start += RANGE_GRANULARITY;
+    }
+}
+
 void HotAnalysis::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
-    active_memories.erase(mem->addr);
+    auto it = active_memories.find(mem->addr);
+    if (it == active_memories.end()) {
+        return;
+    }
+    std::vector<MemoryRange> ranges;
+    split_ranges(*it->second, ranges);
+    for (auto& range : ranges) {
+        range_hotness.erase(range.start);
+    }
+    active_memories.erase(it);
 }
 
 void HotAnalysis::mem_cpy_callback(std::shared_ptr<MemCpy_t> mem) {
@@ -62,10 +192,25 @@ void HotAnalysis::mem_set_callback(std::shared_ptr<MemSet_t> mem) {
 
 void HotAnalysis::ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten) {
     active_tensors.emplace(ten->addr, ten);
+
+    TensorHotness_t hotness;
+    hotness.addr = ten->addr;
+    hotness.size = ten->size;
+    hotness.alloc_kernel = global_kernel_id;
+    live_tensor_hotness[ten->addr] = hotness;
 }
 
 void HotAnalysis::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
     active_tensors.erase(ten->addr);
+
+    auto it = live_tensor_hotness.find(ten->addr);
+    if (it != live_tensor_hotness.end()) {
+        if (it->second.kernels > 0) {
+            it->second.free_kernel = global_kernel_id;
+            retired_tensor_hotness.push_back(it->second);
+        }
+        live_tensor_hotness.erase(it);
+    }
 }
 
 void HotAnalysis::evt_callback(EventPtr_t evt) {
@@ -99,79 +244,173 @@ void HotAnalysis::evt_callback(EventPtr_t evt) {
     }
 }
 
+static double decayed_score(const RangeHotness_t& hotness, uint64_t now) {
+    if (now == hotness.last_kernel) {
+        return hotness.score;
+    }
+    return hotness.score * std::exp2(-(double)(now - hotness.last_kernel) / half_life);
+}
+
+/**
+ * Attribute the touch counts of the ranges to extents (live tensors or
+ * allocations) with one linear sweep over both sequences. Both must be sorted
+ * by start, the extents must not overlap. A range partially covered by an
+ * extent gives it the covered fraction of its count.
+ */
+static void interval_join(const MemoryRange* ranges, const uint32_t* touch,
+                          const std::vector<uint32_t>& order, std::vector<Extent_t>& extents) {
+    size_t first = 0;
+    for (uint32_t i : order) {
+        const MemoryRange& range = ranges[i];
+        // extents ending before this range cannot overlap any later range either
+        while (first < extents.size() && extents[first].end <= range.start) {
+            first++;
+        }
+        if (touch[i] == 0 || range.end <= range.start) {
+            continue;
+        }
+        double per_byte = (double)touch[i] / (range.end - range.start);
+        for (size_t j = first; j < extents.size() && extents[j].start < range.end; j++) {
+            uint64_t lo = std::max(extents[j].start, range.start);
+            uint64_t hi = std::min(extents[j].end, range.end);
+            if (hi > lo) {
+                extents[j].accesses += per_byte * (hi - lo);
+            }
+        }
+    }
+}
+
 void HotAnalysis::gpu_data_analysis(void* data, uint64_t size) {
     MemoryAccessState* state = (MemoryAccessState*)data;
+    if (_steady_state) {
+        global_kernel_id++;
+        return;
+    }
 
-    std::string filename = output_directory + "/kernel_"
-                            + std::to_string(global_kernel_id++) + ".txt";
-    printf("Dumping traces to %s\n", filename.c_str());
-
-    std::ofstream out(filename);
+    uint64_t now = global_kernel_id++;
+    std::string filename = output_directory + "/kernel_" + std::to_string(now) + ".txt";
+    if (!binary_output) {
+        printf("Dumping traces to %s\n", filename.c_str());
+    }
 
-    auto tensor_iter = active_tensors.begin();
+    std::ostringstream out;
 
-    for (uint32_t i = 0; i < size; ++i) {
-        MemoryRange range = state->start_end[i];
+    static_assert(sizeof(MemoryRange) == 2 * sizeof(uint64_t), "start_end must be (start, end) pairs");
+    touched_bitmap.resize((size + 63) / 64);
+    TouchSummary_t summary = touch_reduce((const uint64_t*)state->start_end, state->touch,
+                                          size, touched_bitmap.data());
+    analyzed_kernels++;
+    touched_objects += summary.objects;
+    touched_bytes += summary.bytes;
 
-        if (tensor_iter != active_tensors.end()) {
-            if (tensor_iter->first == range.start) {
-                out << "Tensor start ------------------------------------------" << tensor_iter->first << std::endl;
-            }
+    if (!binary_output) {
+        for (uint32_t i = 0; i < size; ++i) {
+            MemoryRange range = state->start_end[i];
+            out << range.start << " " << range.end << " " << state->touch[i] << std::endl;
         }
+        out << std::endl;
+    }
 
-        out << range.start << " " << range.end << " " << state->touch[i] << std::endl;
-
-        if (tensor_iter != active_tensors.end()) {
-            if (tensor_iter->first + tensor_iter->second->size == range.end) {
-                out << "Tensor end ------------------------------------------" << tensor_iter->first + tensor_iter->second->size << std::endl;
-                tensor_iter++;
-            }
+    // only the touched ranges, straight from the bitmap
+    for (uint32_t w = 0; w < touched_bitmap.size(); ++w) {
+        for (uint64_t bits = touched_bitmap[w]; bits != 0; bits &= bits - 1) {
+            uint32_t i = w * 64 + __builtin_ctzll(bits);
+            MemoryRange range = state->start_end[i];
+            uint64_t touch = state->touch[i];
+            RangeHotness_t& hotness = range_hotness[range.start];
+            hotness.end = range.end;
+            hotness.accesses += touch;
+            hotness.score = decayed_score(hotness, now) + touch;
+            hotness.last_kernel = now;
+            top_ranges.add(range.start, touch);
         }
+    }
 
-        auto it = range_access_counts.find(range);
-        if (it != range_access_counts.end()) {
-            it->second += state->touch[i];
-        } else {
-            range_access_counts.emplace(range, state->touch[i]);
-        }
+    // ranges come in allocation order, only sort when the device reordered them
+    std::vector<uint32_t> order(size);
+    for (uint32_t i = 0; i < size; ++i) {
+        order[i] = i;
+    }
+    const MemoryRange* ranges = state->start_end;
+    if (!std::is_sorted(order.begin(), order.end(), [ranges](uint32_t a, uint32_t b) {
+            return ranges[a].start < ranges[b].start; })) {
+        std::sort(order.begin(), order.end(), [ranges](uint32_t a, uint32_t b) {
+            return ranges[a].start < ranges[b].start;
+        });
     }
-    out << std::endl;
 
+    std::vector<Extent_t> extents;
+    extents.reserve(active_memories.size());
     for (auto active_mem : active_memories) {
         auto mem = active_mem.second;
-        out << mem->addr << " " << mem->size << std::endl;
+        extents.push_back(Extent_t{mem->addr, mem->addr + mem->size, 0});
+    }
+    interval_join(ranges, state->touch, order, extents);
+    if (!binary_output) {
+        for (auto& extent : extents) {
+            out << extent.start << " " << extent.end - extent.start << " "
+                << (uint64_t)std::llround(extent.accesses) << std::endl;
+        }
+        out << std::endl;
     }
-    out << std::endl;
 
+    extents.clear();
+    extents.reserve(active_tensors.size());
     for (auto active_ten : active_tensors) {
         auto ten = active_ten.second;
-        out << ten->addr << " " << ten->size << std::endl;
+        extents.push_back(Extent_t{ten->addr, ten->addr + ten->size, 0});
+    }
+    interval_join(ranges, state->touch, order, extents);
+    for (auto& extent : extents) {
+        if (!binary_output) {
+            out << extent.start << " " << extent.end - extent.start << " "
+                << (uint64_t)std::llround(extent.accesses) << std::endl;
+        }
+        if (extent.accesses > 0) {
+            TensorHotness_t& hotness = live_tensor_hotness[extent.start];
+            if (hotness.kernels == 0) {
+                hotness.first_kernel = now;
+            }
+            hotness.accesses += extent.accesses;
+            hotness.kernels++;
+            hotness.last_kernel = now;
+        }
     }
 
-    out.close();
+    if (binary_output) {
+        // only touched ranges are stored, the rest follows from the live allocations
+        std::vector<HotnessRange_t> touched;
+        for (uint32_t i : order) {
+            if (state->touch[i] != 0) {
+                touched.push_back(HotnessRange_t{ranges[i].start, ranges[i].end, state->touch[i]});
+            }
+        }
+        LiveSet_t allocations;
+        allocations.reserve(active_memories.size());
+        for (auto active_mem : active_memories) {
+            allocations.emplace_back(active_mem.first, active_mem.second->size);
+        }
+        LiveSet_t tensors;
+        tensors.reserve(active_tensors.size());
+        for (auto active_ten : active_tensors) {
+            tensors.emplace_back(active_ten.first, active_ten.second->size);
+        }
+        _writer.append(now, current_kernel_name, size, touched, allocations, tensors);
+        return;
+    }
+
+    _sink->submit(filename, out.str());
 }
 
 void HotAnalysis::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+    if (_steady_state) {
+        // no ranges, no device-side tracking for a steady-state iteration
+        *count = 0;
+        return;
+    }
     std::vector<MemoryRange> active_memory_ranges;
     for (auto active_mem : active_memories) {
-        auto mem = active_mem.second;
-        if (mem->size <= RANGE_GRANULARITY) {
-            MemoryRange range = {mem->addr, mem->addr + mem->size};
-            active_memory_ranges.push_back(range);
-        } else {
-            uint64_t start = mem->addr;
-            uint64_t end = mem->addr + mem->size;
-            while (start < end) {
-                if (start + RANGE_GRANULARITY > end) {
-                    MemoryRange range = {start, end};
-                    active_memory_ranges.push_back(range);
-                } else {
-                    MemoryRange range = {start, start + RANGE_GRANULARITY};
-                    active_memory_ranges.push_back(range);
-                }
-                start += RANGE_GRANULARITY;
-            }
-        }
+        split_ranges(*active_mem.second, active_memory_ranges);
     }
     fprintf(stdout, "size: %lu, limit: %u\n", active_memory_ranges.size(), MAX_NUM_MEMORY_RANGES);
     fflush(stdout);
@@ -183,14 +422,122 @@ void HotAnalysis::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
 }
 
 void HotAnalysis::flush() {
+    typedef struct LiveRange {
+        MemoryRange range;
+        uint64_t accesses;
+        double score;
+        HotnessTier_t tier;
+    } LiveRange_t;
+
+    uint64_t now = global_kernel_id;
+    std::vector<MemoryRange> ranges;
+    for (auto active_mem : active_memories) {
+        split_ranges(*active_mem.second, ranges);
+    }
+    std::vector<LiveRange_t> live;
+    live.reserve(ranges.size());
+    double total_score = 0;
+    for (auto& range : ranges) {
+        RangeHotness_t* hotness = range_hotness.find(range.start);
+        uint64_t accesses = hotness ? hotness->accesses : 0;
+        double score = hotness ? decayed_score(*hotness, now) : 0;
+        live.push_back(LiveRange_t{range, accesses, score, COLD_TIER});
+        total_score += score;
+    }
+
+    // hottest ranges first: hot until they cover hot_fraction of the score, then warm
+    std::sort(live.begin(), live.end(), [](const LiveRange_t& a, const LiveRange_t& b) {
+        return a.score > b.score;
+    });
+    double covered = 0;
+    for (auto& r : live) {
+        if (r.score <= 0) {
+            break;
+        }
+        r.tier = covered < hot_fraction * total_score ? HOT_TIER
+                 : covered < warm_fraction * total_score ? WARM_TIER : COLD_TIER;
+        covered += r.score;
+    }
+    std::sort(live.begin(), live.end(), [](const LiveRange_t& a, const LiveRange_t& b) {
+        return a.range.start < b.range.start;
+    });
+
     std::string filename = output_directory + "/all_kernels.txt";
     printf("Dumping traces to %s\n", filename.c_str());
 
-    std::ofstream out(filename);
+    std::ostringstream out;
+    uint64_t tier_ranges[3] = {0};
+    uint64_t tier_bytes[3] = {0};
+    double tier_score[3] = {0};
+    for (auto& r : live) {
+        out << r.range.start << " " << r.range.end << " " << r.accesses << " "
+            << r.score << " " << tier_names[r.tier] << std::endl;
+        tier_ranges[r.tier]++;
+        tier_bytes[r.tier] += r.range.end - r.range.start;
+        tier_score[r.tier] += r.score;
+    }
+    _sink->submit(filename, out.str());
+
+    filename = output_directory + "/top_ranges.txt";
+    printf("Dumping traces to %s\n", filename.c_str());
+    std::ostringstream top_out;
+    top_out << "TOTAL: " << top_ranges.total() << std::endl;
+    for (auto& counter : top_ranges.top()) {
+        // the true count lies in [count - error, count]
+        top_out << counter.key << " " << counter.count << " " << counter.error << std::endl;
+    }
+    _sink->submit(filename, top_out.str());
+
+    // per-tensor table over the whole run, hottest first
+    std::vector<TensorHotness_t> tensors(retired_tensor_hotness);
+    for (auto& it : live_tensor_hotness) {
+        tensors.push_back(it.second);
+    }
+    std::sort(tensors.begin(), tensors.end(), [](const TensorHotness_t& a, const TensorHotness_t& b) {
+        return a.accesses > b.accesses;
+    });
+    filename = output_directory + "/tensors.txt";
+    printf("Dumping traces to %s\n", filename.c_str());
+    std::ostringstream ten_out;
+    ten_out << "# addr size accesses accesses_per_byte kernels first_kernel last_kernel alloc_kernel free_kernel" << std::endl;
+    for (auto& ten : tensors) {
+        ten_out << ten.addr << " " << ten.size << " " << (uint64_t)std::llround(ten.accesses) << " "
+                << (ten.size > 0 ? ten.accesses / ten.size : 0.0) << " " << ten.kernels << " ";
+        if (ten.kernels > 0) {
+            ten_out << ten.first_kernel << " " << ten.last_kernel;
+        } else {
+            ten_out << "- -";
+        }
+        ten_out << " " << ten.alloc_kernel << " ";
+        if (ten.free_kernel > 0) {
+            ten_out << ten.free_kernel << std::endl;
+        } else {
+            ten_out << "-" << std::endl;
+        }
+    }
+    _sink->submit(filename, ten_out.str());
+
+    if (analyzed_kernels > 0) {
+        fprintf(stdout, "Touched per kernel: %.1f ranges, %s on average (range reduction: %s)\n",
+                (double)touched_objects / analyzed_kernels,
+                format_size(touched_bytes / analyzed_kernels).c_str(), touch_reduce_isa());
+    }
+    fprintf(stdout, "Live memory tiers (half-life %.0f kernels, hot/warm at %.0f%%/%.0f%% of score):\n",
+            half_life, hot_fraction * 100, warm_fraction * 100);
+    for (int t = HOT_TIER; t <= COLD_TIER; t++) {
+        fprintf(stdout, "  %-5s %8lu ranges  %12s  %6.2f%% of score\n",
+                tier_names[t], tier_ranges[t], format_size(tier_bytes[t]).c_str(),
+                total_score > 0 ? tier_score[t] * 100 / total_score : 0.0);
+    }
 
-    for (auto range : range_access_counts) {
-        out << range.first.start << " " << range.first.end << " " << range.second << std::endl;
+    if (binary_output) {
+        if (_writer.close()) {
+            fprintf(stdout, "Hotness container: %lu kernels, %s\n",
+                    _writer.num_records(), format_size(_writer.bytes_written()).c_str());
+        } else {
+            fprintf(stderr, "Hotness container is incomplete, see the write error above\n");
+        }
     }
 
-    out.close();
+    _sink->drain();
 }
@@ -0,0 +1,340 @@
+/**
+ * Allocation and tensor lifetimes.
+ * Times are kernel indices: an object allocated or freed between launches
+ * k - 1 and k gets time k, and the app_metric touch data of launch k marks
+ * the objects it accessed. The ranges handed to the patch are the live
+ * allocations cut at the live tensors, so every range belongs to at most one
+ * allocation and one tensor. At flush the kernels an object spent in memory
+ * before its first use and after its last use are weighted by its size, and
+ * the worst offenders are reported as memory reduction targets.
+ */
+#include "tools/lifetime.h"
+#include "utils/helper.h"
+#include "utils/touch_reduce.h"
+#include "utils/address_index.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t NO_KERNEL = UINT32_MAX;
+
+/**
+ * Object id -> lifetime, one array per field so that the per-launch touch
+ * updates and the flush-time scans only walk the columns they need.
+ */
+typedef struct ObjectTable {
+    std::vector<DevPtr> addr;
+    std::vector<uint64_t> size;
+    std::vector<uint32_t> alloc_time;
+    std::vector<uint32_t> free_time;
+    std::vector<uint32_t> first_touch;
+    std::vector<uint32_t> last_touch;
+    std::vector<uint32_t> touch_kernels;
+
+    uint32_t add(DevPtr object_addr, uint64_t object_size, uint32_t time) {
+        addr.push_back(object_addr);
+        size.push_back(object_size);
+        alloc_time.push_back(time);
+        free_time.push_back(NO_KERNEL);
+        first_touch.push_back(NO_KERNEL);
+        last_touch.push_back(NO_KERNEL);
+        touch_kernels.push_back(0);
+        return addr.size() - 1;
+    }
+
+    void touch(uint32_t id, uint32_t kernel) {
+        if (last_touch[id] == kernel) {
+            return;
+        }
+        if (first_touch[id] == NO_KERNEL) {
+            first_touch[id] = kernel;
+        }
+        last_touch[id] = kernel;
+        touch_kernels[id]++;
+    }
+
+    size_t count() const { return addr.size(); }
+} ObjectTable_t;
+
+typedef struct IdleObject {
+    uint32_t id;
+    uint64_t before;        // kernels between allocation and first use
+    uint64_t after;         // kernels between last use and free
+    uint64_t weight;        // size * (before + after)
+} IdleObject_t;
+
+static AddressIndex alloc_index;
+static AddressIndex tensor_index;
+static ObjectTable_t allocs;
+static ObjectTable_t tensors;
+
+static std::vector<std::string> kernel_names;
+static std::vector<uint64_t> touched_bitmap;
+static uint32_t num_kernels = 0;
+static uint32_t top_k = 50;
+static uint64_t truncated_queries = 0;
+
+
+Lifetime::Lifetime() : Tool(LIFETIME) {
+    const char* env_topk = std::getenv("YOSEMITE_LIFETIME_TOPK");
+    if (env_topk) {
+        top_k = std::max(std::atoi(env_topk), 0);
+    }
+}
+
+
+Lifetime::~Lifetime() {}
+
+
+void Lifetime::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    kernel_names.push_back(kernel->kernel_name);
+    num_kernels++;
+}
+
+
+void Lifetime::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+}
+
+
+void Lifetime::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    alloc_index.insert(mem->addr, mem->size, allocs.add(mem->addr, mem->size, num_kernels));
+}
+
+
+void Lifetime::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    uint32_t id = alloc_index.find(mem->addr);
+    if (id == AddressIndex::NONE || allocs.addr[id] != mem->addr) {
+        return;
+    }
+    allocs.free_time[id] = num_kernels;
+    alloc_index.erase(mem->addr);
+}
+
+
+void Lifetime::mem_cpy_callback(std::shared_ptr<MemCpy_t> mem) {
+}
+
+
+void Lifetime::mem_set_callback(std::shared_ptr<MemSet_t> mem) {
+}
+
+
+void Lifetime::ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten) {
+    uint64_t size = ten->size > 0 ? ten->size : 0;
+    tensor_index.insert(ten->addr, size, tensors.add(ten->addr, size, num_kernels));
+}
+
+
+void Lifetime::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
+    uint32_t id = tensor_index.find(ten->addr);
+    if (id == AddressIndex::NONE || tensors.addr[id] != ten->addr) {
+        return;
+    }
+    tensors.free_time[id] = num_kernels;
+    tensor_index.erase(ten->addr);
+}
+
+
+void Lifetime::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        case EventType_MEM_COPY:
+            mem_cpy_callback(std::dynamic_pointer_cast<MemCpy_t>(evt));
+            break;
+        case EventType_MEM_SET:
+            mem_set_callback(std::dynamic_pointer_cast<MemSet_t>(evt));
+            break;
+        case EventType_TEN_ALLOC:
+            ten_alloc_callback(std::dynamic_pointer_cast<TenAlloc_t>(evt));
+            break;
+        case EventType_TEN_FREE:
+            ten_free_callback(std::dynamic_pointer_cast<TenFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void Lifetime::gpu_data_analysis(void* data, uint64_t size) {
+    if (num_kernels == 0) {
+        kernel_start_callback(std::make_shared<KernelLauch_t>("<unknown>"));
+    }
+    MemoryAccessTracker* tracker = (MemoryAccessTracker*)data;
+    MemoryAccessState* state = tracker->access_state;
+    uint32_t kernel = num_kernels - 1;
+
+    static_assert(sizeof(MemoryRange) == 2 * sizeof(uint64_t), "start_end must be (start, end) pairs");
+    touched_bitmap.resize((state->size + 63) / 64);
+    touch_reduce((const uint64_t*)state->start_end, state->touch, state->size, touched_bitmap.data());
+
+    for (uint32_t w = 0; w < touched_bitmap.size(); ++w) {
+        for (uint64_t bits = touched_bitmap[w]; bits != 0; bits &= bits - 1) {
+            uint32_t i = w * 64 + __builtin_ctzll(bits);
+            uint64_t start = state->start_end[i].start;
+            uint32_t alloc_id = alloc_index.find(start);
+            if (alloc_id != AddressIndex::NONE) {
+                allocs.touch(alloc_id, kernel);
+            }
+            uint32_t tensor_id = tensor_index.find(start);
+            if (tensor_id != AddressIndex::NONE) {
+                tensors.touch(tensor_id, kernel);
+            }
+        }
+    }
+}
+
+
+void Lifetime::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+    MemoryRange* _ranges = (MemoryRange*)ranges;
+    auto& alloc_entries = alloc_index.entries();
+    auto& tensor_entries = tensor_index.entries();
+    *count = 0;
+
+    // allocations cut at the tensors inside them, both lists are sorted by address
+    std::vector<MemoryRange> pieces;
+    auto tensor = tensor_entries.begin();
+    for (auto& alloc : alloc_entries) {
+        uint64_t cursor = alloc.start;
+        while (tensor != tensor_entries.end() && tensor->start < alloc.start) {
+            ++tensor;
+        }
+        for (; tensor != tensor_entries.end() && tensor->start < alloc.end; ++tensor) {
+            if (tensor->start > cursor) {
+                pieces.push_back(MemoryRange{cursor, tensor->start});
+            }
+            uint64_t end = std::min(tensor->end, alloc.end);
+            if (end > tensor->start) {
+                pieces.push_back(MemoryRange{tensor->start, end});
+            }
+            cursor = std::max(cursor, end);
+        }
+        if (cursor < alloc.end) {
+            pieces.push_back(MemoryRange{cursor, alloc.end});
+        }
+    }
+
+    if (pieces.size() > limit) {
+        // too many tensors, fall back to whole allocations: tensors in them are not tracked
+        truncated_queries++;
+        pieces.clear();
+        for (auto& alloc : alloc_entries) {
+            if (pieces.size() >= limit) {
+                break;
+            }
+            pieces.push_back(MemoryRange{alloc.start, alloc.end});
+        }
+    }
+    std::copy(pieces.begin(), pieces.end(), _ranges);
+    *count = pieces.size();
+}
+
+
+static std::vector<IdleObject_t> collect_idle(const ObjectTable_t& table, uint64_t& lifetime_bytes,
+                                              uint64_t& idle_bytes, uint64_t& untouched, uint64_t& untouched_size) {
+    std::vector<IdleObject_t> idle;
+    for (uint32_t id = 0; id < table.count(); id++) {
+        uint64_t alloc_time = table.alloc_time[id];
+        uint64_t free_time = table.free_time[id] == NO_KERNEL ? num_kernels : table.free_time[id];
+        uint64_t size = table.size[id];
+        IdleObject_t object{id, 0, 0, 0};
+        if (table.first_touch[id] == NO_KERNEL) {
+            object.before = free_time - alloc_time;
+            untouched++;
+            untouched_size += size;
+        } else {
+            object.before = table.first_touch[id] - alloc_time;
+            object.after = free_time - table.last_touch[id] - 1;
+        }
+        object.weight = size * (object.before + object.after);
+        lifetime_bytes += size * (free_time - alloc_time);
+        idle_bytes += object.weight;
+        if (object.weight > 0) {
+            idle.push_back(object);
+        }
+    }
+    std::sort(idle.begin(), idle.end(), [](const IdleObject_t& a, const IdleObject_t& b) {
+        return a.weight > b.weight;
+    });
+    return idle;
+}
+
+
+static const std::string& kernel_name(uint32_t kernel) {
+    static const std::string none = "-";
+    return kernel < kernel_names.size() ? kernel_names[kernel] : none;
+}
+
+
+static void dump_objects(std::ofstream& out, const char* kind, const ObjectTable_t& table) {
+    uint64_t lifetime_bytes = 0;
+    uint64_t idle_bytes = 0;
+    uint64_t untouched = 0;
+    uint64_t untouched_size = 0;
+    auto idle = collect_idle(table, lifetime_bytes, idle_bytes, untouched, untouched_size);
+
+    out << kind << "s: " << table.count() << ", never touched " << untouched
+        << " (" << format_size(untouched_size) << ")" << std::endl;
+    out << "Idle byte-kernels: " << idle_bytes << " of " << lifetime_bytes << " ("
+        << (lifetime_bytes > 0 ? 100.0 * idle_bytes / lifetime_bytes : 0.0) << "%)" << std::endl;
+    out << kind << " id addr size: alloc first last free, idle before/after, idle byte-kernels" << std::endl;
+    for (size_t i = 0; i < idle.size() && i < top_k; i++) {
+        uint32_t id = idle[i].id;
+        out << kind << " " << id << " " << table.addr[id] << " " << table.size[id]
+            << " (" << format_size(table.size[id]) << "): alloc=" << table.alloc_time[id];
+        if (table.first_touch[id] == NO_KERNEL) {
+            out << " untouched";
+        } else {
+            out << " first=" << table.first_touch[id] << ":" << kernel_name(table.first_touch[id])
+                << " last=" << table.last_touch[id] << ":" << kernel_name(table.last_touch[id])
+                << " kernels=" << table.touch_kernels[id];
+        }
+        out << " free=";
+        if (table.free_time[id] == NO_KERNEL) {
+            out << "live";
+        } else {
+            out << table.free_time[id];
+        }
+        out << " idle=" << idle[i].before << "/" << idle[i].after << " weight=" << idle[i].weight << std::endl;
+    }
+    out << std::endl;
+}
+
+
+void Lifetime::flush() {
+    std::string filename = get_output_name("lifetime") + ".log";
+    printf("Dumping object lifetimes to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out << "Kernels: " << num_kernels << std::endl;
+    if (truncated_queries > 0) {
+        out << "Launches with tensors left untracked (range limit): " << truncated_queries << std::endl;
+    }
+    out << std::endl;
+
+    out << "==================== Allocations ====================" << std::endl;
+    dump_objects(out, "Alloc", allocs);
+    if (tensors.count() > 0) {
+        out << "==================== Tensors ====================" << std::endl;
+        dump_objects(out, "Tensor", tensors);
+    }
+
+    out.close();
+}
@@ -1,15 +1,26 @@
 #include "tools/mem_trace.h"
 #include "utils/helper.h"
 #include "utils/event.h"
+#include "utils/output_sink.h"
+#include "utils/fast_hash.h"
+#include "utils/thread_pool.h"
+#include "utils/flat_hash.h"
+#include "utils/access_flags.h"
+#include "utils/trace_reader.h"
 #include "gpu_patch.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <map>
+#include <unordered_map>
 #include <vector>
-#include <fstream>
+#include <sstream>
 #include <memory>
 #include <cassert>
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
 
 
 using namespace yosemite;
@@ -17,6 +28,7 @@ using namespace yosemite;
 static Timer_t _timer;
 
 static std::string output_directory;
+static std::shared_ptr<OutputSink> _sink;
 static uint32_t kernel_id = 0;
 
 static std::map<uint64_t, std::shared_ptr<KernelLauch_t>> kernel_events;
@@ -27,6 +39,142 @@ static std::map<uint64_t, std::shared_ptr<TenAlloc>> tensor_events;
 static std::map<DevPtr, std::shared_ptr<TenAlloc>> active_tensors;
 
 static std::vector<MemoryAccess> _traces;
+static uint64_t _trace_accesses = 0;
+
+typedef struct TraceFingerprint {
+    uint32_t kernel_id;
+    uint64_t accesses;
+    uint64_t records;
+    uint64_t check;             // second digest of the same stream, seeded differently
+    std::string kernel_name;
+} TraceFingerprint_t;
+
+/**
+ * Heatmap mode (YOSEMITE_TRACE_MODE=heatmap) keeps per-page read/write counts
+ * for the running kernel instead of the accesses themselves and writes one
+ * sorted (page, reads, writes) line per touched page at kernel end. With
+ * sampling the written counts are estimates for the whole kernel, the kept
+ * counts scaled by seen / kept accesses.
+ */
+typedef struct PageCounts {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+} PageCounts_t;
+
+typedef struct PageHeat {
+    uint64_t page;
+    uint64_t reads;
+    uint64_t writes;
+} PageHeat_t;
+
+static bool heatmap_enabled = false;
+static uint32_t heatmap_page_shift = 12;
+static FlatHashMap<PageCounts_t> page_counts;
+
+static bool dedup_enabled = false;
+// YOSEMITE_TRACE_DEDUP_VERIFY=1: read the referenced trace back and compare it on every hit
+static bool dedup_verify = false;
+static uint64_t dedup_kernels = 0;
+static uint64_t dedup_collisions = 0;
+static std::unordered_map<uint64_t, TraceFingerprint_t> trace_fingerprints;
+
+/**
+ * One finished kernel handed to the post-processing pool. The allocation and
+ * tensor lists are snapshotted and the access timer range is reserved at
+ * kernel end, so the output does not depend on when the job runs.
+ */
+typedef struct KernelTraceJob {
+    uint64_t seq;
+    std::shared_ptr<KernelLauch_t> kernel;
+    std::vector<MemoryAccess> traces;
+    std::vector<PageHeat_t> pages;
+    std::vector<std::pair<DevPtr, uint64_t>> allocations;
+    std::vector<std::pair<DevPtr, uint64_t>> tensors;
+    uint64_t timer_base;
+    uint64_t accesses;
+    uint64_t seen_accesses;
+    uint64_t fingerprint = 0;
+    uint64_t check = 0;
+    bool is_reference = false;
+    uint32_t reference_kernel_id = 0;
+} KernelTraceJob_t;
+
+typedef std::shared_ptr<KernelTraceJob_t> KernelTraceJobPtr_t;
+
+static uint64_t job_seq = 0;
+static uint64_t next_retire_seq = 0;
+static std::map<uint64_t, KernelTraceJobPtr_t> fingerprinted_jobs;
+static std::mutex retire_mutex;
+
+static uint32_t inflight_jobs = 0;
+static uint32_t max_inflight_jobs = 0;
+static std::mutex inflight_mutex;
+static std::condition_variable inflight_cv;
+
+/**
+ * Sampling keeps tracing cost bounded on full-size jobs. Kernel invocations
+ * are selected by name (every Nth / first K), then warps are sampled at
+ * warp_rate and addresses SHARDS-style: a 128B line is kept when its hash
+ * falls under spatial_rate, so every access to a kept line survives and
+ * reuse behaviour is preserved.
+ */
+typedef struct SamplingConfig {
+    bool enabled = false;
+    uint32_t every_nth = 1;
+    uint32_t first_k = 0;
+    double warp_rate = 1.0;
+    double spatial_rate = 1.0;
+    uint64_t warp_threshold = 0;
+    uint64_t spatial_threshold = 0;
+} SamplingConfig_t;
+
+typedef struct KernelSamplingStats {
+    uint64_t invocations = 0;
+    uint64_t sampled_invocations = 0;
+    uint64_t seen_accesses = 0;
+    uint64_t kept_accesses = 0;
+} KernelSamplingStats_t;
+
+static constexpr uint32_t SHARDS_LINE_SHIFT = 7;
+static constexpr uint64_t SHARDS_MODULUS = 1ULL << 24;
+
+static SamplingConfig_t sampling;
+static std::map<std::string, KernelSamplingStats_t> sampling_stats;
+static bool kernel_sampled = true;
+static uint64_t kernel_seen_accesses = 0;
+
+// declared after the sink so that it is torn down (and drained) first
+static std::unique_ptr<ThreadPool> _pool;
+
+
+static void parse_sampling_config(const char* spec) {
+    std::istringstream fields(spec);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        auto sep = field.find(':');
+        if (sep == std::string::npos) {
+            fprintf(stderr, "Ignoring sampling option %s\n", field.c_str());
+            continue;
+        }
+        std::string key = field.substr(0, sep);
+        std::string value = field.substr(sep + 1);
+        if (key == "nth") {
+            sampling.every_nth = std::max(std::atoi(value.c_str()), 1);
+        } else if (key == "first") {
+            sampling.first_k = std::max(std::atoi(value.c_str()), 0);
+        } else if (key == "warp") {
+            sampling.warp_rate = std::min(1.0, std::max(0.0, std::atof(value.c_str())));
+        } else if (key == "shards") {
+            sampling.spatial_rate = std::min(1.0, std::max(0.0, std::atof(value.c_str())));
+        } else {
+            fprintf(stderr, "Ignoring sampling option %s\n", field.c_str());
+        }
+    }
+    // ldexp(rate, 64) overflows for rate == 1, the rates are only checked when below 1
+    sampling.warp_threshold = (uint64_t)std::ldexp(std::min(sampling.warp_rate, 0.999999), 64);
+    sampling.spatial_threshold = (uint64_t)(sampling.spatial_rate * SHARDS_MODULUS);
+    sampling.enabled = true;
+}
 
 
 MemTrace::MemTrace() : Tool(MEM_TRACE) {
@@ -44,6 +192,49 @@ MemTrace::MemTrace() : Tool(MEM_TRACE) {
         output_directory = "traces_" + get_current_date_n_time();
     }
     check_folder_existance(output_directory);
+    _sink = create_output_sink();
+
+    const char* env_mode = std::getenv("YOSEMITE_TRACE_MODE");
+    if (env_mode && std::string(env_mode) == "heatmap") {
+        heatmap_enabled = true;
+        const char* env_page_size = std::getenv("YOSEMITE_HEATMAP_PAGE_SIZE");
+        uint64_t page_size = env_page_size ? parse_size(env_page_size) : 4096;
+        if (page_size != 4096 && page_size != (64 << 10) && page_size != (2 << 20)) {
+            fprintf(stderr, "Unsupported heatmap page size %s, using 4KB.\n", env_page_size);
+            page_size = 4096;
+        }
+        heatmap_page_shift = __builtin_ctzll(page_size);
+        fprintf(stdout, "MemTrace heatmap mode with %s pages.\n", format_size(page_size).c_str());
+    }
+
+    const char* env_dedup = std::getenv("YOSEMITE_TRACE_DEDUP");
+    if (env_dedup && std::string(env_dedup) == "1" && heatmap_enabled) {
+        fprintf(stdout, "Trace deduplication does not apply to heatmaps, ignored.\n");
+    } else if (env_dedup && std::string(env_dedup) == "1") {
+        fprintf(stdout, "Enabling trace deduplication in MemTrace.\n");
+        dedup_enabled = true;
+        const char* env_verify = std::getenv("YOSEMITE_TRACE_DEDUP_VERIFY");
+        dedup_verify = env_verify && std::string(env_verify) == "1";
+    }
+
+    const char* env_sampling = std::getenv("YOSEMITE_TRACE_SAMPLING");
+    if (env_sampling != nullptr) {
+        parse_sampling_config(env_sampling);
+        fprintf(stdout, "MemTrace sampling: nth=%u first=%u warp=%.4f shards=%.4f\n",
+                sampling.every_nth, sampling.first_k, sampling.warp_rate, sampling.spatial_rate);
+    }
+
+    uint32_t num_threads = default_thread_count("YOSEMITE_TRACE_THREADS");
+    if (dedup_verify) {
+        // the referenced trace must be on disk before the next kernel is compared with it
+        fprintf(stdout, "Verifying deduplicated traces against the written ones, post-processing inline.\n");
+        num_threads = 0;
+    }
+    if (num_threads > 0) {
+        _pool.reset(new ThreadPool(num_threads));
+    }
+    max_inflight_jobs = 2 * std::max(num_threads, 1u);
+    fprintf(stdout, "MemTrace post-processing threads: %u\n", num_threads);
 }
 
 
@@ -53,50 +244,337 @@ MemTrace::~MemTrace() {}
 void MemTrace::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
 
     kernel->kernel_id = kernel_id++;
+    kernel->timestamp = _timer.get();
     kernel_events.emplace(_timer.get(), kernel);
     _traces.clear();
+    page_counts.clear();
+    _trace_accesses = 0;
+    kernel_seen_accesses = 0;
+
+    // nothing new to learn from a steady-state iteration
+    kernel_sampled = !_steady_state;
+    if (sampling.enabled) {
+        auto& stats = sampling_stats[kernel->kernel_name];
+        kernel_sampled = kernel_sampled && stats.invocations % sampling.every_nth == 0
+                         && (sampling.first_k == 0 || stats.sampled_invocations < sampling.first_k);
+        stats.invocations++;
+        stats.sampled_invocations += kernel_sampled;
+    }
 
     _timer.increment(true);
 }
 
 
-void MemTrace::kernel_trace_flush(std::shared_ptr<KernelLauch_t> kernel) {
-    std::string filename = output_directory + "/kernel_"
-                            + std::to_string(kernel->kernel_id) + ".txt";
-    printf("Dumping traces to %s\n", filename.c_str());
+static constexpr uint64_t CHECK_SEED = 0x9E3779B97F4A7C15ULL;
+
+/**
+ * Fingerprint a kernel's trace. Every address is rewritten as
+ * (rank of the owning allocation, offset) first, so the same accesses
+ * replayed on re-allocated buffers in a later iteration hash the same.
+ * check gets an independent digest of the same stream.
+ */
+static uint64_t trace_fingerprint(const KernelTraceJob_t& job, uint64_t& check) {
+    auto& allocations = job.allocations;
+    FastHash hash;
+    FastHash check_hash(CHECK_SEED);
+    hash.update(job.kernel->kernel_name.data(), job.kernel->kernel_name.size());
+    check_hash.update(job.kernel->kernel_name.data(), job.kernel->kernel_name.size());
+
+    uint64_t record[GPU_WARP_SIZE + 3];
+    size_t rank = 0;
+    for (auto& trace : job.traces) {
+        uint64_t mask = 0;
+        uint32_t num_lanes = 0;
+        for (int i = 0; i < GPU_WARP_SIZE; i++) {
+            uint64_t addr = trace.addresses[i];
+            if (addr == 0) {
+                continue;
+            }
+            mask |= 1ULL << i;
+            // lanes of a warp almost always fall into the same allocation
+            if (rank >= allocations.size() || addr < allocations[rank].first
+                || addr >= allocations[rank].first + allocations[rank].second) {
+                auto it = std::upper_bound(allocations.begin(), allocations.end(),
+                                           std::make_pair(addr, UINT64_MAX));
+                rank = it - allocations.begin() - 1;
+            }
+            if (rank < allocations.size() && addr < allocations[rank].first + allocations[rank].second) {
+                record[3 + num_lanes] = ((rank + 1) << 48) | (addr - allocations[rank].first);
+            } else {
+                record[3 + num_lanes] = addr;
+            }
+            num_lanes++;
+        }
+        record[0] = mask | ((uint64_t)trace.accessSize << 32);
+        record[1] = trace.flags;
+        record[2] = trace.warpId;
+        hash.update(record, (3 + num_lanes) * sizeof(uint64_t));
+        check_hash.update(record, (3 + num_lanes) * sizeof(uint64_t));
+    }
+    check = check_hash.digest();
+    return hash.digest();
+}
+
 
-    std::ofstream out(filename);
+// (rank of the owning allocation + 1, offset), or the raw address outside all of them
+static uint64_t normalize_address(const std::vector<std::pair<DevPtr, uint64_t>>& allocations,
+                                  uint64_t addr) {
+    auto it = std::upper_bound(allocations.begin(), allocations.end(),
+                               std::make_pair(addr, UINT64_MAX));
+    if (it == allocations.begin()) {
+        return addr;
+    }
+    size_t rank = it - allocations.begin() - 1;
+    if (addr >= allocations[rank].first + allocations[rank].second) {
+        return addr;
+    }
+    return ((rank + 1) << 48) | (addr - allocations[rank].first);
+}
 
-    for (auto& trace : _traces) {
+
+/**
+ * Compare a kernel's trace with the full trace written for reference_kernel_id,
+ * both normalized against their own allocations.
+ */
+static bool stored_trace_matches(uint32_t reference_kernel_id, const KernelTraceJob_t& job) {
+    _sink->drain();
+    KernelTrace_t stored;
+    if (!read_kernel_trace(output_directory, reference_kernel_id, stored, false) || stored.is_reference) {
+        return false;
+    }
+    size_t r = 0;
+    for (auto& trace : job.traces) {
         for (int i = 0; i < GPU_WARP_SIZE; i++) {
-            if (trace.addresses[i] != 0) {
-                _timer.increment(false);
-                out << (trace.addresses[i] >> 12) << " "
-                    << trace.addresses[i] << " "
-                    << trace.accessSize << " "
-                    << _timer.get() << " "
-                    << trace.flags << " "
-                    << trace.warpId << std::endl;
+            uint64_t addr = trace.addresses[i];
+            if (addr == 0) {
+                continue;
+            }
+            if (r >= stored.records.size()) {
+                return false;
+            }
+            const TraceRecord_t& record = stored.records[r++];
+            if (record.access_size != trace.accessSize || record.flags != trace.flags
+                || record.warp_id != trace.warpId
+                || normalize_address(stored.allocations, record.address)
+                   != normalize_address(job.allocations, addr)) {
+                return false;
+            }
+        }
+    }
+    return r == stored.records.size();
+}
+
+
+static std::string kernel_trace_filename(uint32_t id) {
+    return output_directory + (heatmap_enabled ? "/heatmap_" : "/kernel_")
+           + std::to_string(id) + ".txt";
+}
+
+
+static void write_kernel_trace(KernelTraceJobPtr_t job) {
+    auto kernel = job->kernel;
+    std::string filename = kernel_trace_filename(kernel->kernel_id);
+    std::ostringstream out;
+
+    if (heatmap_enabled) {
+        std::sort(job->pages.begin(), job->pages.end(), [](const PageHeat_t& a, const PageHeat_t& b) {
+            return a.page < b.page;
+        });
+        out << "HEATMAP: " << (1u << heatmap_page_shift) << " " << job->pages.size() << std::endl;
+        // sampled counts are scaled up to the whole kernel by the achieved rate, seen / kept
+        double scale = job->accesses > 0 ? (double)job->seen_accesses / job->accesses : 1.0;
+        for (auto& page : job->pages) {
+            if (sampling.enabled) {
+                out << page.page << " " << std::llround(page.reads * scale)
+                    << " " << std::llround(page.writes * scale) << std::endl;
+            } else {
+                out << page.page << " " << page.reads << " " << page.writes << std::endl;
+            }
+        }
+    } else if (job->is_reference) {
+        // same normalized trace as an earlier kernel, only record where to find it
+        out << "REFERENCE: " << job->reference_kernel_id << " " << std::hex << job->fingerprint
+            << std::dec << " " << job->timer_base << " " << job->accesses << std::endl;
+    } else {
+        uint64_t timer = job->timer_base;
+        for (auto& trace : job->traces) {
+            for (int i = 0; i < GPU_WARP_SIZE; i++) {
+                if (trace.addresses[i] != 0) {
+                    out << (trace.addresses[i] >> 12) << " "
+                        << trace.addresses[i] << " "
+                        << trace.accessSize << " "
+                        << ++timer << " "
+                        << trace.flags << " "
+                        << trace.warpId << std::endl;
+                }
             }
         }
     }
 
     out << std::endl;
-    for (auto evt : active_memories) {
-        out << "ALLOCATION: " << " " << evt.second->addr
-            << " " << evt.second->size << std::endl;
+    for (auto& mem : job->allocations) {
+        out << "ALLOCATION: " << " " << mem.first
+            << " " << mem.second << std::endl;
     }
 
     out << std::endl;
-    for (auto evt : active_tensors) {
-        out << "TENSOR: " << " " << evt.second->addr
-            << " " << evt.second->size << std::endl;
+    for (auto& ten : job->tensors) {
+        out << "TENSOR: " << " " << ten.first
+            << " " << ten.second << std::endl;
+    }
+
+    if (sampling.enabled) {
+        out << std::endl;
+        out << "SAMPLING: " << job->seen_accesses << " " << job->accesses << " "
+            << sampling.warp_rate << " " << sampling.spatial_rate << std::endl;
     }
 
     out << std::endl;
     out << "KERNEL: " << kernel->timestamp << " " << kernel->end_time << std::endl;
 
-    out.close();
+    _sink->submit(filename, out.str());
+    job.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(inflight_mutex);
+        inflight_jobs--;
+    }
+    inflight_cv.notify_all();
+}
+
+
+/**
+ * Deduplication decisions are made strictly in kernel order, whatever order
+ * the fingerprints finish in, so the first occurrence is always the one
+ * written in full exactly as in a serial run.
+ */
+static void retire_fingerprinted(KernelTraceJobPtr_t job) {
+    std::vector<KernelTraceJobPtr_t> ready;
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        fingerprinted_jobs.emplace(job->seq, job);
+        auto it = fingerprinted_jobs.begin();
+        while (it != fingerprinted_jobs.end() && it->first == next_retire_seq) {
+            auto& cur = it->second;
+            auto res = trace_fingerprints.emplace(cur->fingerprint,
+                            TraceFingerprint_t{cur->kernel->kernel_id, cur->accesses, cur->traces.size(),
+                                               cur->check, cur->kernel->kernel_name});
+            // a fingerprint hit alone is not proof of identical content
+            const TraceFingerprint_t& seen = res.first->second;
+            bool same = !res.second && seen.accesses == cur->accesses
+                        && seen.records == cur->traces.size() && seen.check == cur->check
+                        && seen.kernel_name == cur->kernel->kernel_name
+                        && (!dedup_verify || stored_trace_matches(seen.kernel_id, *cur));
+            if (!res.second && !same) {
+                dedup_collisions++;
+            }
+            if (same) {
+                cur->is_reference = true;
+                cur->reference_kernel_id = res.first->second.kernel_id;
+                cur->traces.clear();
+                cur->traces.shrink_to_fit();
+                dedup_kernels++;
+            }
+            ready.push_back(cur);
+            it = fingerprinted_jobs.erase(it);
+            next_retire_seq++;
+        }
+    }
+    for (auto& cur : ready) {
+        if (_pool && !cur->is_reference) {
+            _pool->submit([cur] { write_kernel_trace(cur); });
+        } else {
+            write_kernel_trace(cur);
+        }
+    }
+}
+
+
+static void process_kernel_trace(KernelTraceJobPtr_t job) {
+    if (dedup_enabled) {
+        job->fingerprint = trace_fingerprint(*job, job->check);
+        retire_fingerprinted(job);
+    } else {
+        write_kernel_trace(job);
+    }
+}
+
+
+static void dump_sampling_metadata() {
+    std::ostringstream out;
+    out << "every_nth " << sampling.every_nth << std::endl;
+    out << "first_k " << sampling.first_k << std::endl;
+    out << "warp_rate " << sampling.warp_rate << std::endl;
+    out << "spatial_rate " << sampling.spatial_rate << std::endl;
+    out << "spatial_line_size " << (1 << SHARDS_LINE_SHIFT) << std::endl;
+    out << std::endl;
+    // invocations sampled_invocations seen_accesses kept_accesses kernel_name
+    for (auto& it : sampling_stats) {
+        auto& stats = it.second;
+        out << stats.invocations << " " << stats.sampled_invocations << " "
+            << stats.seen_accesses << " " << stats.kept_accesses << " "
+            << it.first << std::endl;
+    }
+    _sink->submit(output_directory + "/sampling.txt", out.str());
+}
+
+
+void MemTrace::kernel_trace_flush(std::shared_ptr<KernelLauch_t> kernel) {
+    std::string filename = kernel_trace_filename(kernel->kernel_id);
+    if (sampling.enabled) {
+        auto& stats = sampling_stats[kernel->kernel_name];
+        stats.seen_accesses += kernel_seen_accesses;
+        stats.kept_accesses += _trace_accesses;
+    }
+    if (!kernel_sampled) {
+        _traces.clear();
+        page_counts.clear();
+        return;
+    }
+    if (sampling.enabled) {
+        printf("Dumping traces to %s (kept %lu of %lu accesses, %.2f%%)\n",
+               filename.c_str(), _trace_accesses, kernel_seen_accesses,
+               kernel_seen_accesses ? 100.0 * _trace_accesses / kernel_seen_accesses : 100.0);
+    } else {
+        printf("Dumping traces to %s\n", filename.c_str());
+    }
+
+    auto job = std::make_shared<KernelTraceJob_t>();
+    job->seq = job_seq++;
+    job->kernel = kernel;
+    job->traces.swap(_traces);
+    if (heatmap_enabled) {
+        job->pages.reserve(page_counts.size());
+        page_counts.for_each([&job](uint64_t page, PageCounts_t& counts) {
+            job->pages.push_back(PageHeat_t{page, counts.reads, counts.writes});
+        });
+        page_counts.clear();
+    }
+    job->accesses = _trace_accesses;
+    job->seen_accesses = kernel_seen_accesses;
+    job->allocations.reserve(active_memories.size());
+    for (auto& mem : active_memories) {
+        job->allocations.emplace_back(mem.second->addr, mem.second->size);
+    }
+    job->tensors.reserve(active_tensors.size());
+    for (auto& ten : active_tensors) {
+        job->tensors.emplace_back(ten.second->addr, ten.second->size);
+    }
+    // one timer tick per active lane, as if the accesses were written right now
+    job->timer_base = _timer.get();
+    _timer.access_timer += job->accesses;
+    _trace_accesses = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(inflight_mutex);
+        inflight_cv.wait(lock, [] { return inflight_jobs < max_inflight_jobs; });
+        inflight_jobs++;
+    }
+    if (_pool) {
+        _pool->submit([job] { process_kernel_trace(job); });
+    } else {
+        process_kernel_trace(job);
+    }
 }
 
 
@@ -144,11 +622,84 @@ void MemTrace::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
 }
 
 
+// Heatmap mode: fold the active lanes of one warp access into the page counts.
+static void count_pages(const MemoryAccess& trace) {
+    bool is_write = access_is_write(trace.flags);
+    uint64_t last_page = UINT64_MAX;
+    PageCounts_t* counts = nullptr;
+    for (int j = 0; j < GPU_WARP_SIZE; j++) {
+        if (trace.addresses[j] == 0) {
+            continue;
+        }
+        // lanes of a warp mostly share a page, look it up once per run
+        uint64_t page = trace.addresses[j] >> heatmap_page_shift;
+        if (page != last_page) {
+            counts = &page_counts[page];
+            last_page = page;
+        }
+        if (is_write) {
+            counts->writes++;
+        } else {
+            counts->reads++;
+        }
+    }
+}
+
+
 void MemTrace::gpu_data_analysis(void* data, uint64_t size) {
     MemoryAccess* accesses_buffer = (MemoryAccess*)data;
-    for (int i = 0; i < size; i++) {
+    if (sampling.enabled) {
+        for (uint64_t i = 0; i < size; i++) {
+            MemoryAccess& trace = accesses_buffer[i];
+            uint32_t seen = 0;
+            for (int j = 0; j < GPU_WARP_SIZE; j++) {
+                seen += trace.addresses[j] != 0;
+            }
+            kernel_seen_accesses += seen;
+            if (!kernel_sampled || seen == 0) {
+                continue;
+            }
+            if (sampling.warp_rate < 1.0 && mix64(trace.warpId) >= sampling.warp_threshold) {
+                continue;
+            }
+            MemoryAccess sampled = trace;
+            uint32_t kept = seen;
+            if (sampling.spatial_rate < 1.0) {
+                kept = 0;
+                for (int j = 0; j < GPU_WARP_SIZE; j++) {
+                    uint64_t line = sampled.addresses[j] >> SHARDS_LINE_SHIFT;
+                    if (sampled.addresses[j] != 0
+                        && (mix64(line) & (SHARDS_MODULUS - 1)) >= sampling.spatial_threshold) {
+                        sampled.addresses[j] = 0;
+                    }
+                    kept += sampled.addresses[j] != 0;
+                }
+            }
+            if (kept > 0) {
+                if (heatmap_enabled) {
+                    count_pages(sampled);
+                } else {
+                    _traces.push_back(sampled);
+                }
+                _trace_accesses += kept;
+            }
+        }
+        return;
+    }
+
+    if (!kernel_sampled) {
+        return;
+    }
+    for (uint64_t i = 0; i < size; i++) {
         MemoryAccess trace = accesses_buffer[i];
-        _traces.push_back(trace);
+        if (heatmap_enabled) {
+            count_pages(trace);
+        } else {
+            _traces.push_back(trace);
+        }
+        for (int j = 0; j < GPU_WARP_SIZE; j++) {
+            _trace_accesses += trace.addresses[j] != 0;
+        }
     }
 
 }
@@ -186,4 +737,22 @@ void MemTrace::evt_callback(EventPtr_t evt) {
 
 
 void MemTrace::flush() {
+    if (_pool) {
+        _pool->wait();
+    }
+    if (dedup_enabled) {
+        fprintf(stdout, "MemTrace: %lu of %u kernel traces deduplicated, %lu fingerprint collisions.\n",
+                dedup_kernels, kernel_id, dedup_collisions);
+    }
+    if (sampling.enabled) {
+        uint64_t seen = 0, kept = 0;
+        for (auto& it : sampling_stats) {
+            seen += it.second.seen_accesses;
+            kept += it.second.kept_accesses;
+        }
+        fprintf(stdout, "MemTrace: sampled %lu of %lu accesses (%.2f%%).\n",
+                kept, seen, seen ? 100.0 * kept / seen : 100.0);
+        dump_sampling_metadata();
+    }
+    _sink->drain();
 }
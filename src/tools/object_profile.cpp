@@ -0,0 +1,333 @@
+/**
+ * Per-object read/write profile.
+ * Every warp access is attributed to the allocation and the tensor holding
+ * its first active lane. Objects accumulate read/write instructions and
+ * bytes, the launches touching them and the first/last touching kernel, and
+ * are classified at flush as read-only, write-only, write-once-read-many or
+ * read-write.
+ */
+#include "tools/object_profile.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/access_flags.h"
+#include "utils/address_index.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t NO_LAUNCH = UINT32_MAX;
+
+typedef enum {
+    OBJECT_UNTOUCHED = 0,
+    OBJECT_READ_ONLY = 1,
+    OBJECT_WRITE_ONLY = 2,
+    OBJECT_WRITE_ONCE_READ_MANY = 3,
+    OBJECT_READ_WRITE = 4,
+    OBJECT_CLASS_NUMS = 5
+} ObjectClass_t;
+
+static const char* OBJECT_CLASS_NAMES[OBJECT_CLASS_NUMS] = {
+    "untouched", "read_only", "write_only", "write_once_read_many", "read_write"
+};
+
+typedef struct ObjectStats {
+    DevPtr addr;
+    uint64_t size;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+    uint32_t launches = 0;
+    uint32_t read_launches = 0;
+    uint32_t write_launches = 0;
+    uint32_t first_launch = NO_LAUNCH;
+    uint32_t last_launch = NO_LAUNCH;
+    uint32_t first_read_launch = NO_LAUNCH;
+    uint32_t last_read_launch = NO_LAUNCH;
+    uint32_t last_write_launch = NO_LAUNCH;
+    std::vector<uint32_t> kernels;      // distinct kernel name ids
+
+    ObjectStats(DevPtr addr, uint64_t size) : addr(addr), size(size) {}
+
+    void touch(uint32_t launch, uint32_t kernel, bool is_write, uint64_t bytes) {
+        if (last_launch != launch) {
+            launches++;
+            if (std::find(kernels.begin(), kernels.end(), kernel) == kernels.end()) {
+                kernels.push_back(kernel);
+            }
+            last_launch = launch;
+            if (first_launch == NO_LAUNCH) {
+                first_launch = launch;
+            }
+        }
+        if (is_write) {
+            writes++;
+            write_bytes += bytes;
+            if (last_write_launch != launch) {
+                write_launches++;
+                last_write_launch = launch;
+            }
+        } else {
+            reads++;
+            read_bytes += bytes;
+            if (last_read_launch != launch) {
+                read_launches++;
+                last_read_launch = launch;
+                if (first_read_launch == NO_LAUNCH) {
+                    first_read_launch = launch;
+                }
+            }
+        }
+    }
+
+    ObjectClass_t classify() const {
+        if (launches == 0) {
+            return OBJECT_UNTOUCHED;
+        }
+        if (writes == 0) {
+            return OBJECT_READ_ONLY;
+        }
+        if (reads == 0) {
+            return OBJECT_WRITE_ONLY;
+        }
+        // written by one launch, then only read by later ones
+        if (write_launches == 1 && read_launches >= 2 && last_write_launch <= first_read_launch) {
+            return OBJECT_WRITE_ONCE_READ_MANY;
+        }
+        return OBJECT_READ_WRITE;
+    }
+} ObjectStats_t;
+
+// live objects by slot, a freed slot is classified, folded into the freed
+// totals and reused
+typedef struct ProfileTable {
+    AddressIndex index;
+    std::vector<ObjectStats_t> stats;
+    std::vector<uint32_t> free_slots;
+    uint64_t num_freed = 0;
+    uint64_t freed_reads = 0;
+    uint64_t freed_writes = 0;
+    uint64_t freed_read_bytes = 0;
+    uint64_t freed_write_bytes = 0;
+    uint64_t freed_counts[OBJECT_CLASS_NUMS] = {0};
+    uint64_t freed_bytes[OBJECT_CLASS_NUMS] = {0};
+
+    void insert(DevPtr addr, uint64_t size) {
+        uint32_t slot = stats.size();
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+            stats[slot] = ObjectStats_t(addr, size);
+        } else {
+            stats.emplace_back(addr, size);
+        }
+        index.insert(addr, size, slot);
+    }
+
+    void erase(DevPtr addr) {
+        uint32_t slot = index.find(addr);
+        if (slot == AddressIndex::NONE || stats[slot].addr != addr) {
+            return;
+        }
+        const ObjectStats_t& object = stats[slot];
+        ObjectClass_t object_class = object.classify();
+        freed_counts[object_class]++;
+        freed_bytes[object_class] += object.size;
+        freed_reads += object.reads;
+        freed_writes += object.writes;
+        freed_read_bytes += object.read_bytes;
+        freed_write_bytes += object.write_bytes;
+        num_freed++;
+        stats[slot] = ObjectStats_t(0, 0);
+        index.erase(addr);
+        free_slots.push_back(slot);
+    }
+} ProfileTable_t;
+
+static ProfileTable_t allocs;
+static ProfileTable_t tensors;
+
+// launch id -> interned kernel name
+static std::map<std::string, uint32_t> kernel_name_ids;
+static std::vector<std::string> kernel_names;
+static std::vector<uint32_t> launch_names;
+static uint32_t cur_launch = NO_LAUNCH;
+static uint32_t cur_kernel = 0;
+
+
+ObjectProfile::ObjectProfile() : Tool(OBJECT_PROFILE) {}
+
+
+ObjectProfile::~ObjectProfile() {}
+
+
+void ObjectProfile::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    auto it = kernel_name_ids.find(kernel->kernel_name);
+    if (it == kernel_name_ids.end()) {
+        it = kernel_name_ids.emplace(kernel->kernel_name, kernel_names.size()).first;
+        kernel_names.push_back(kernel->kernel_name);
+    }
+    cur_launch = launch_names.size();
+    cur_kernel = it->second;
+    launch_names.push_back(cur_kernel);
+    allocs.index.refresh();
+    tensors.index.refresh();
+}
+
+
+void ObjectProfile::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+}
+
+
+void ObjectProfile::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    allocs.insert(mem->addr, mem->size);
+}
+
+
+void ObjectProfile::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    allocs.erase(mem->addr);
+}
+
+
+void ObjectProfile::ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten) {
+    tensors.insert(ten->addr, ten->size);
+}
+
+
+void ObjectProfile::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
+    tensors.erase(ten->addr);
+}
+
+
+void ObjectProfile::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        case EventType_TEN_ALLOC:
+            ten_alloc_callback(std::dynamic_pointer_cast<TenAlloc_t>(evt));
+            break;
+        case EventType_TEN_FREE:
+            ten_free_callback(std::dynamic_pointer_cast<TenFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void ObjectProfile::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_launch == NO_LAUNCH) {
+        kernel_start_callback(std::make_shared<KernelLauch_t>("<unknown>"));
+    }
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        if (active == 0) {
+            continue;
+        }
+        uint64_t addr = access.addresses[__builtin_ctz(active)];
+        uint64_t bytes = (uint64_t)__builtin_popcount(active) * access.accessSize;
+        bool is_write = access_is_write(access.flags);
+
+        uint32_t alloc_id = allocs.index.find(addr);
+        if (alloc_id != AddressIndex::NONE) {
+            allocs.stats[alloc_id].touch(cur_launch, cur_kernel, is_write, bytes);
+        }
+        uint32_t tensor_id = tensors.index.find(addr);
+        if (tensor_id != AddressIndex::NONE) {
+            tensors.stats[tensor_id].touch(cur_launch, cur_kernel, is_write, bytes);
+        }
+    }
+}
+
+
+void ObjectProfile::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static const std::string& launch_name(uint32_t launch) {
+    static const std::string none = "-";
+    return launch == NO_LAUNCH ? none : kernel_names[launch_names[launch]];
+}
+
+
+static void dump_objects(std::ofstream& out, const char* kind, const ProfileTable_t& table) {
+    uint64_t class_counts[OBJECT_CLASS_NUMS] = {0};
+    uint64_t class_bytes[OBJECT_CLASS_NUMS] = {0};
+    for (uint32_t c = 0; c < OBJECT_CLASS_NUMS; c++) {
+        class_counts[c] = table.freed_counts[c];
+        class_bytes[c] = table.freed_bytes[c];
+    }
+    for (uint32_t i = 0; i < table.stats.size(); i++) {
+        const ObjectStats_t& object = table.stats[i];
+        if (object.addr == 0 && object.size == 0) {
+            continue;       // free slot
+        }
+        ObjectClass_t object_class = object.classify();
+        class_counts[object_class]++;
+        class_bytes[object_class] += object.size;
+        if (object_class == OBJECT_UNTOUCHED) {
+            continue;
+        }
+        out << kind << " " << i << " " << object.addr << " " << object.size
+            << " (" << format_size(object.size) << ") " << OBJECT_CLASS_NAMES[object_class]
+            << ": reads=" << object.reads << " writes=" << object.writes
+            << " read_bytes=" << object.read_bytes << " write_bytes=" << object.write_bytes
+            << " kernels=" << object.kernels.size()
+            << " launches=" << object.launches
+            << " read_launches=" << object.read_launches
+            << " write_launches=" << object.write_launches
+            << " first=" << object.first_launch << ":" << launch_name(object.first_launch)
+            << " last=" << object.last_launch << ":" << launch_name(object.last_launch)
+            << std::endl;
+    }
+    if (table.num_freed > 0) {
+        out << "Freed (" << table.num_freed << "): reads=" << table.freed_reads
+            << " writes=" << table.freed_writes
+            << " read_bytes=" << table.freed_read_bytes
+            << " write_bytes=" << table.freed_write_bytes << std::endl;
+    }
+    out << kind << " summary:";
+    for (uint32_t c = 0; c < OBJECT_CLASS_NUMS; c++) {
+        out << " " << OBJECT_CLASS_NAMES[c] << "=" << class_counts[c]
+            << " (" << format_size(class_bytes[c]) << ")";
+    }
+    out << std::endl << std::endl;
+}
+
+
+void ObjectProfile::flush() {
+    std::string filename = get_output_name("object_profile") + ".log";
+    printf("Dumping object profile to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out << "Launches: " << launch_names.size() << ", kernels: " << kernel_names.size() << std::endl;
+    out << std::endl;
+
+    out << "==================== Allocations ====================" << std::endl;
+    dump_objects(out, "Alloc", allocs);
+    if (!tensors.stats.empty()) {
+        out << "==================== Tensors ====================" << std::endl;
+        dump_objects(out, "Tensor", tensors);
+    }
+
+    out.close();
+}
@@ -0,0 +1,197 @@
+/**
+ * Reuse (LRU stack) distance analysis.
+ * Every warp access is split into the distinct cache lines (or sectors) it
+ * touches and fed to two stacks: one reset at each kernel launch for the
+ * kernel's own footprint, one kept for the whole run. Histograms are
+ * aggregated per kernel name and turned into miss-ratio curves at flush.
+ */
+#include "tools/reuse_distance.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/stack_distance.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static uint32_t block_shift = 7;
+static double sampling_rate = 1.0;
+static uint64_t max_tracked = 0;
+
+static std::unique_ptr<StackDistance> kernel_stack;
+static std::unique_ptr<StackDistance> run_stack;
+
+static std::map<std::string, ReuseHistogram_t> kernel_histograms;
+static ReuseHistogram_t* cur_kernel_histogram = nullptr;
+static ReuseHistogram_t kernel_total_histogram;
+static ReuseHistogram_t run_histogram;
+static uint64_t num_kernels = 0;
+
+
+ReuseDistance::ReuseDistance() : Tool(REUSE_DISTANCE) {
+    const char* env_granularity = std::getenv("YOSEMITE_REUSE_GRANULARITY");
+    if (env_granularity != nullptr && std::string(env_granularity) == "sector") {
+        block_shift = 5;
+    }
+    const char* env_shards = std::getenv("YOSEMITE_REUSE_SHARDS");
+    if (env_shards != nullptr) {
+        // 0 from an unparsable value would sample almost nothing, keep the default then
+        double rate = std::atof(env_shards);
+        if (rate > 0) {
+            sampling_rate = rate;
+        }
+    }
+    const char* env_shards_max = std::getenv("YOSEMITE_REUSE_SHARDS_MAX");
+    if (env_shards_max != nullptr) {
+        max_tracked = std::max(std::atoll(env_shards_max), 0LL);
+    }
+
+    kernel_stack = std::make_unique<StackDistance>(sampling_rate, max_tracked);
+    run_stack = std::make_unique<StackDistance>(sampling_rate, max_tracked);
+
+    fprintf(stdout, "Reuse distance at %uB granularity", 1u << block_shift);
+    if (sampling_rate < 1.0 || max_tracked > 0) {
+        fprintf(stdout, ", SHARDS rate %g, max tracked %lu", sampling_rate, max_tracked);
+    }
+    fprintf(stdout, ".\n");
+}
+
+
+ReuseDistance::~ReuseDistance() {}
+
+
+void ReuseDistance::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    kernel_stack->reset();
+    cur_kernel_histogram = &kernel_histograms[kernel->kernel_name];
+    num_kernels++;
+}
+
+
+void ReuseDistance::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    cur_kernel_histogram = nullptr;
+}
+
+
+void ReuseDistance::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+}
+
+
+void ReuseDistance::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+}
+
+
+void ReuseDistance::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void ReuseDistance::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_kernel_histogram == nullptr) {
+        cur_kernel_histogram = &kernel_histograms["<unknown>"];
+    }
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        uint32_t unique = warp_unique_mask(access.addresses, active, block_shift);
+        // accesses wider than a block touch the following blocks as well
+        uint32_t span = (access.accessSize + (1u << block_shift) - 1) >> block_shift;
+        span = std::max(span, 1u);
+        while (unique) {
+            uint32_t lane = __builtin_ctz(unique);
+            unique &= unique - 1;
+            uint64_t block = access.addresses[lane] >> block_shift;
+            for (uint32_t j = 0; j < span; j++) {
+                uint64_t distance = kernel_stack->access(block + j);
+                cur_kernel_histogram->add(distance, 1.0 / kernel_stack->rate());
+                distance = run_stack->access(block + j);
+                run_histogram.add(distance, 1.0 / run_stack->rate());
+            }
+        }
+    }
+}
+
+
+void ReuseDistance::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static void dump_histogram(std::ofstream& out, const ReuseHistogram_t& histogram) {
+    uint32_t max_bucket = histogram.max_bucket();
+    out << "  accesses=" << (uint64_t)histogram.total
+        << " cold=" << (uint64_t)histogram.cold << std::endl;
+    out << "  distance histogram:";
+    for (uint32_t k = 0; k <= max_bucket; k++) {
+        if (histogram.buckets[k] > 0) {
+            out << " [" << (k == 0 ? 0 : 1ULL << (k - 1)) << "]:" << (uint64_t)histogram.buckets[k];
+        }
+    }
+    out << std::endl;
+    out << "  miss ratio:";
+    for (uint32_t k = 0; k <= max_bucket + 1 && k < 64; k++) {
+        uint64_t capacity = 1ULL << k;
+        out << " " << format_size(capacity << block_shift) << ":" << histogram.miss_ratio(capacity);
+    }
+    out << std::endl;
+}
+
+
+void ReuseDistance::flush() {
+    std::string filename = get_output_name("reuse_distance") + ".log";
+    printf("Dumping reuse distance analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(4);
+    out << "Granularity: " << (1u << block_shift) << "B" << std::endl;
+    out << "SHARDS rate: " << run_stack->rate() << std::endl;
+    out << "Kernels: " << num_kernels << std::endl;
+    out << std::endl;
+
+    std::vector<std::pair<std::string, ReuseHistogram_t*>> kernels;
+    for (auto& it : kernel_histograms) {
+        kernels.emplace_back(it.first, &it.second);
+        kernel_total_histogram.merge(it.second);
+    }
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        return a.second->total > b.second->total;
+    });
+
+    out << "==================== Whole run ====================" << std::endl;
+    dump_histogram(out, run_histogram);
+    out << std::endl;
+
+    out << "==================== All kernels (intra-kernel) ====================" << std::endl;
+    dump_histogram(out, kernel_total_histogram);
+    out << std::endl;
+
+    out << "==================== Kernels ====================" << std::endl;
+    for (auto& kernel : kernels) {
+        out << kernel.first << std::endl;
+        dump_histogram(out, *kernel.second);
+    }
+
+    out.close();
+}
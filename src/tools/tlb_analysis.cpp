@@ -0,0 +1,360 @@
+/**
+ * TLB reach and page-size what-if analysis.
+ * The access stream is translated at 4KB, 64KB and 2MB pages through a
+ * two-level TLB (each level a CacheModel over page numbers). Distinct pages
+ * are tracked in flat hash sets per run, per launch and per allocation, and
+ * each allocation gets the page size with the cheapest estimated
+ * translation cost.
+ */
+#include "tools/tlb_analysis.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/address_index.h"
+#include "utils/cache_model.h"
+#include "utils/flat_hash.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t NUM_PAGE_SIZES = 3;
+static constexpr uint32_t PAGE_SHIFTS[NUM_PAGE_SIZES] = {12, 16, 21};
+static constexpr const char* PAGE_NAMES[NUM_PAGE_SIZES] = {"4KB", "64KB", "2MB"};
+
+// relative cost of an L1 miss that hits L2 and of a page walk
+static constexpr double L2_HIT_COST = 1.0;
+static constexpr double PAGE_WALK_COST = 20.0;
+// a larger page is only recommended if it is at least this much cheaper
+static constexpr double RECOMMEND_MARGIN = 0.9;
+
+typedef struct TlbStats {
+    uint64_t translations = 0;
+    uint64_t l1_misses = 0;
+    uint64_t l2_misses = 0;
+    uint64_t pages = 0;
+
+    double cost() const {
+        return (l1_misses - l2_misses) * L2_HIT_COST + l2_misses * PAGE_WALK_COST;
+    }
+} TlbStats_t;
+
+typedef struct PageSizeState {
+    std::unique_ptr<CacheModel> l1;
+    std::unique_ptr<CacheModel> l2;
+    CacheStats_t l1_stats;
+    CacheStats_t l2_stats;
+    FlatHashSet run_pages;
+    FlatHashSet kernel_pages;
+    FlatHashSet alloc_pages;    // (alloc id << 40) | page within the allocation
+    TlbStats_t kernel_stats;
+} PageSizeState_t;
+
+typedef struct KernelTlbStats {
+    uint64_t launches = 0;
+    TlbStats_t stats[NUM_PAGE_SIZES];
+    uint64_t max_pages[NUM_PAGE_SIZES] = {0};
+} KernelTlbStats_t;
+
+typedef struct AllocationTlbStats {
+    DevPtr addr;
+    uint64_t size;
+    TlbStats_t stats[NUM_PAGE_SIZES];
+} AllocationTlbStats_t;
+
+static PageSizeState_t page_states[NUM_PAGE_SIZES];
+static uint32_t l1_entries = 32;
+static uint32_t l2_entries = 2048;
+
+// live allocations by slot, a freed slot is folded into freed_stats and reused
+static AddressIndex alloc_index;
+static std::vector<AllocationTlbStats_t> alloc_stats;
+static std::vector<uint32_t> free_slots;
+static AllocationTlbStats_t freed_stats;
+static uint64_t num_freed = 0;
+static AllocationTlbStats_t unknown_stats;
+
+static std::map<std::string, KernelTlbStats_t> kernel_stats;
+static KernelTlbStats_t* cur_kernel_stats = nullptr;
+
+
+static uint32_t env_uint(const char* name, uint32_t default_value) {
+    const char* env = std::getenv(name);
+    return env != nullptr ? std::max(std::atoi(env), 0) : default_value;
+}
+
+
+TlbAnalysis::TlbAnalysis() : Tool(TLB_ANALYSIS) {
+    l1_entries = std::max(env_uint("YOSEMITE_TLB_L1_ENTRIES", 32), 1u);
+    l2_entries = std::max(env_uint("YOSEMITE_TLB_L2_ENTRIES", 2048), 1u);
+    // associativity 0 means fully associative
+    uint32_t l1_assoc = env_uint("YOSEMITE_TLB_L1_ASSOC", 0);
+    uint32_t l2_assoc = env_uint("YOSEMITE_TLB_L2_ASSOC", 16);
+
+    CacheConfig_t l1_config;
+    l1_config.size = l1_entries;
+    l1_config.line_size = 1;
+    l1_config.sector_size = 1;
+    l1_config.assoc = l1_assoc ? l1_assoc : l1_entries;
+    CacheConfig_t l2_config = l1_config;
+    l2_config.size = l2_entries;
+    l2_config.assoc = l2_assoc ? l2_assoc : l2_entries;
+
+    for (auto& state : page_states) {
+        state.l1 = std::make_unique<CacheModel>(l1_config);
+        state.l2 = std::make_unique<CacheModel>(l2_config);
+    }
+    fprintf(stdout, "TLB model: L1 %u entries (%u-way), L2 %u entries (%u-way)\n",
+            l1_entries, l1_config.assoc, l2_entries, l2_config.assoc);
+}
+
+
+TlbAnalysis::~TlbAnalysis() {}
+
+
+void TlbAnalysis::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_stats = &kernel_stats[kernel->kernel_name];
+    cur_kernel_stats->launches++;
+    alloc_index.refresh();
+}
+
+
+void TlbAnalysis::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    if (cur_kernel_stats == nullptr) {
+        return;
+    }
+    for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+        PageSizeState_t& state = page_states[s];
+        TlbStats_t& stats = cur_kernel_stats->stats[s];
+        stats.translations += state.kernel_stats.translations;
+        stats.l1_misses += state.kernel_stats.l1_misses;
+        stats.l2_misses += state.kernel_stats.l2_misses;
+        stats.pages += state.kernel_pages.size();
+        cur_kernel_stats->max_pages[s] = std::max<uint64_t>(cur_kernel_stats->max_pages[s],
+                                                            state.kernel_pages.size());
+        state.kernel_stats = TlbStats_t();
+        state.kernel_pages.clear();
+    }
+    cur_kernel_stats = nullptr;
+}
+
+
+void TlbAnalysis::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    uint32_t slot = alloc_stats.size();
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        alloc_stats[slot] = AllocationTlbStats_t{mem->addr, mem->size, {}};
+    } else {
+        alloc_stats.push_back(AllocationTlbStats_t{mem->addr, mem->size, {}});
+    }
+    alloc_index.insert(mem->addr, mem->size, slot);
+}
+
+
+void TlbAnalysis::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    uint32_t slot = alloc_index.find(mem->addr);
+    if (slot == AddressIndex::NONE || alloc_stats[slot].addr != mem->addr) {
+        return;
+    }
+    AllocationTlbStats_t& alloc = alloc_stats[slot];
+    for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+        TlbStats_t& stats = alloc.stats[s];
+        TlbStats_t& freed = freed_stats.stats[s];
+        freed.translations += stats.translations;
+        freed.l1_misses += stats.l1_misses;
+        freed.l2_misses += stats.l2_misses;
+        freed.pages += stats.pages;
+        // drop the slot's distinct-page keys, the next allocation in it starts fresh
+        uint64_t pages = ((alloc.addr + alloc.size - 1) >> PAGE_SHIFTS[s]) - (alloc.addr >> PAGE_SHIFTS[s]) + 1;
+        uint64_t left = stats.pages;
+        for (uint64_t page = 0; page < pages && left > 0; page++) {
+            left -= page_states[s].alloc_pages.erase(((uint64_t)slot << 40) | page);
+        }
+        stats = TlbStats_t();
+    }
+    num_freed++;
+    alloc_index.erase(mem->addr);
+    free_slots.push_back(slot);
+}
+
+
+void TlbAnalysis::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void TlbAnalysis::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_kernel_stats == nullptr) {
+        cur_kernel_stats = &kernel_stats["<unknown>"];
+        cur_kernel_stats->launches++;
+    }
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+            PageSizeState_t& state = page_states[s];
+            uint32_t shift = PAGE_SHIFTS[s];
+            // one translation per distinct page of the warp
+            uint32_t unique = warp_unique_mask(access.addresses, active, shift);
+            while (unique) {
+                uint32_t lane = __builtin_ctz(unique);
+                unique &= unique - 1;
+                uint64_t page = access.addresses[lane] >> shift;
+
+                uint32_t alloc_id = alloc_index.find(access.addresses[lane]);
+                AllocationTlbStats_t& alloc = alloc_id == AddressIndex::NONE
+                                              ? unknown_stats : alloc_stats[alloc_id];
+                TlbStats_t& alloc_tlb = alloc.stats[s];
+
+                bool l1_miss = state.l1->access(page, false, state.l1_stats) != CACHE_HIT;
+                bool l2_miss = l1_miss && state.l2->access(page, false, state.l2_stats) != CACHE_HIT;
+                state.kernel_stats.translations++;
+                state.kernel_stats.l1_misses += l1_miss;
+                state.kernel_stats.l2_misses += l2_miss;
+                alloc_tlb.translations++;
+                alloc_tlb.l1_misses += l1_miss;
+                alloc_tlb.l2_misses += l2_miss;
+
+                state.run_pages.insert(page);
+                state.kernel_pages.insert(page);
+                if (alloc_id != AddressIndex::NONE) {
+                    uint64_t key = ((uint64_t)alloc_id << 40) | (page - (alloc.addr >> shift));
+                    alloc_tlb.pages += state.alloc_pages.insert(key);
+                }
+            }
+        }
+    }
+}
+
+
+void TlbAnalysis::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+static void dump_stats(std::ofstream& out, const TlbStats_t& stats) {
+    double translations = stats.translations ? stats.translations : 1;
+    out << "translations=" << stats.translations
+        << " l1_miss=" << 100.0 * stats.l1_misses / translations << "%"
+        << " l2_miss=" << 100.0 * stats.l2_misses / translations << "%";
+}
+
+
+// smallest page size within RECOMMEND_MARGIN of the cheapest one that does not exceed the allocation
+static uint32_t recommend_page_size(const AllocationTlbStats_t& alloc) {
+    uint32_t best = 0;
+    for (uint32_t s = 1; s < NUM_PAGE_SIZES; s++) {
+        if (alloc.size < (1ULL << PAGE_SHIFTS[s])) {
+            break;
+        }
+        if (alloc.stats[s].cost() < alloc.stats[best].cost() * RECOMMEND_MARGIN) {
+            best = s;
+        }
+    }
+    return best;
+}
+
+
+void TlbAnalysis::flush() {
+    kernel_end_callback(nullptr);
+
+    std::string filename = get_output_name("tlb_analysis") + ".log";
+    printf("Dumping TLB analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(4);
+    out << "TLB: L1 " << l1_entries << " entries, L2 " << l2_entries << " entries" << std::endl;
+    for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+        uint64_t pages = page_states[s].run_pages.size();
+        out << PAGE_NAMES[s] << " pages: distinct=" << pages
+            << " footprint=" << format_size(pages << PAGE_SHIFTS[s])
+            << " L2 reach=" << format_size((uint64_t)l2_entries << PAGE_SHIFTS[s])
+            << " l1_miss=" << 100.0 * page_states[s].l1_stats.line_misses
+                              / std::max<uint64_t>(page_states[s].l1_stats.accesses, 1) << "%"
+            << " l2_miss=" << 100.0 * page_states[s].l2_stats.line_misses
+                              / std::max<uint64_t>(page_states[s].l1_stats.accesses, 1) << "%"
+            << std::endl;
+    }
+    out << std::endl;
+
+    std::vector<std::pair<std::string, KernelTlbStats_t*>> kernels;
+    for (auto& it : kernel_stats) {
+        kernels.emplace_back(it.first, &it.second);
+    }
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        return a.second->stats[0].l2_misses > b.second->stats[0].l2_misses;
+    });
+
+    out << "==================== Kernels ====================" << std::endl;
+    for (auto& kernel : kernels) {
+        out << kernel.first << " (launches=" << kernel.second->launches << ")" << std::endl;
+        for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+            const TlbStats_t& stats = kernel.second->stats[s];
+            out << "  " << PAGE_NAMES[s] << ": ";
+            dump_stats(out, stats);
+            out << " avg_pages=" << stats.pages / std::max<uint64_t>(kernel.second->launches, 1)
+                << " max_pages=" << kernel.second->max_pages[s];
+            if (kernel.second->max_pages[s] > l2_entries) {
+                out << " (exceeds L2 reach)";
+            }
+            out << std::endl;
+        }
+    }
+    out << std::endl;
+
+    out << "==================== Allocations ====================" << std::endl;
+    for (uint32_t i = 0; i < alloc_stats.size(); i++) {
+        auto& alloc = alloc_stats[i];
+        if (alloc.stats[0].translations == 0) {
+            continue;
+        }
+        out << "Alloc " << i << " " << alloc.addr << " " << alloc.size
+            << " (" << format_size(alloc.size) << "): recommended page size "
+            << PAGE_NAMES[recommend_page_size(alloc)] << std::endl;
+        for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+            out << "  " << PAGE_NAMES[s] << ": ";
+            dump_stats(out, alloc.stats[s]);
+            out << " pages=" << alloc.stats[s].pages << " cost=" << alloc.stats[s].cost() << std::endl;
+        }
+    }
+    if (freed_stats.stats[0].translations > 0) {
+        out << "Freed allocations (" << num_freed << "):" << std::endl;
+        for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+            out << "  " << PAGE_NAMES[s] << ": ";
+            dump_stats(out, freed_stats.stats[s]);
+            out << " pages=" << freed_stats.stats[s].pages << std::endl;
+        }
+    }
+    if (unknown_stats.stats[0].translations > 0) {
+        out << "Outside allocations:" << std::endl;
+        for (uint32_t s = 0; s < NUM_PAGE_SIZES; s++) {
+            out << "  " << PAGE_NAMES[s] << ": ";
+            dump_stats(out, unknown_stats.stats[s]);
+            out << std::endl;
+        }
+    }
+
+    out.close();
+}
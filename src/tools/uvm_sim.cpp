@@ -0,0 +1,337 @@
+/**
+ * Unified-memory oversubscription simulator.
+ * Records, per launch, the pages of the live allocations it touched: touched
+ * ranges from the hot_analysis patch by default, or the exact pages of every
+ * warp access with YOSEMITE_UVM_SOURCE=mem_trace. At flush the trace is
+ * replayed by UvmSimulator for every policy (YOSEMITE_UVM_POLICIES, any of
+ * lru, lfu, belady) against a device of YOSEMITE_UVM_CAPACITY bytes, or of the
+ * peak footprint shrunk by each ratio of YOSEMITE_UVM_OVERSUB ("0.2" means the
+ * footprint is 20% larger than the device), and faults, migrated bytes, an
+ * estimated migration time and the thrashing kernels are reported.
+ */
+#include "tools/uvm_sim.h"
+#include "utils/helper.h"
+#include "utils/touch_reduce.h"
+#include "utils/warp_simd.h"
+#include "utils/uvm_simulator.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static UvmSimulator simulator;
+static std::map<DevPtr, uint64_t> active_memories;
+static std::map<std::string, uint32_t> kernel_name_ids;
+static std::vector<std::string> kernel_names;
+static std::vector<uint64_t> touched_bitmap;
+static bool trace_source = false;
+
+static std::vector<UvmPolicy_t> policies = {UVM_POLICY_LRU, UVM_POLICY_LFU, UVM_POLICY_BELADY};
+static std::vector<double> oversubscriptions = {0.2};
+static uint64_t capacity_bytes = 0;
+static double bandwidth = 16.0;         // GB/s
+static double fault_latency = 20.0;     // us
+static uint32_t top_k = 10;
+
+
+static std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        if (comma > start) {
+            items.push_back(list.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return items;
+}
+
+
+UvmSim::UvmSim() : Tool(UVM_SIM) {
+    const char* env_page_size = std::getenv("YOSEMITE_UVM_PAGE_SIZE");
+    uint64_t page_size = env_page_size ? parse_size(env_page_size) : (2 << 20);
+    if (page_size == 0 || (page_size & (page_size - 1)) != 0) {
+        fprintf(stderr, "Invalid YOSEMITE_UVM_PAGE_SIZE %s, using 2MB.\n", env_page_size);
+        page_size = 2 << 20;
+    }
+    simulator = UvmSimulator(page_size);
+
+    const char* env_source = std::getenv("YOSEMITE_UVM_SOURCE");
+    trace_source = env_source && std::string(env_source) == "mem_trace";
+
+    const char* env_policies = std::getenv("YOSEMITE_UVM_POLICIES");
+    if (env_policies) {
+        policies.clear();
+        for (auto& name : split_list(env_policies)) {
+            if (name == "lru") {
+                policies.push_back(UVM_POLICY_LRU);
+            } else if (name == "lfu") {
+                policies.push_back(UVM_POLICY_LFU);
+            } else if (name == "belady") {
+                policies.push_back(UVM_POLICY_BELADY);
+            } else {
+                fprintf(stderr, "Unknown UVM eviction policy %s, ignored.\n", name.c_str());
+            }
+        }
+    }
+
+    const char* env_capacity = std::getenv("YOSEMITE_UVM_CAPACITY");
+    if (env_capacity) {
+        capacity_bytes = parse_size(env_capacity);
+    }
+    const char* env_oversub = std::getenv("YOSEMITE_UVM_OVERSUB");
+    if (env_oversub) {
+        oversubscriptions.clear();
+        for (auto& ratio : split_list(env_oversub)) {
+            oversubscriptions.push_back(std::max(std::atof(ratio.c_str()), 0.0));
+        }
+    }
+    const char* env_bandwidth = std::getenv("YOSEMITE_UVM_BANDWIDTH");
+    if (env_bandwidth && std::atof(env_bandwidth) > 0) {
+        bandwidth = std::atof(env_bandwidth);
+    }
+    const char* env_fault = std::getenv("YOSEMITE_UVM_FAULT_US");
+    if (env_fault) {
+        fault_latency = std::max(std::atof(env_fault), 0.0);
+    }
+    const char* env_topk = std::getenv("YOSEMITE_UVM_TOPK");
+    if (env_topk) {
+        top_k = std::max(std::atoi(env_topk), 0);
+    }
+    fprintf(stdout, "UVM simulator with %s pages, touches from %s.\n",
+            format_size(page_size).c_str(), trace_source ? "mem_trace" : "hot_analysis");
+}
+
+
+UvmSim::~UvmSim() {}
+
+
+void UvmSim::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    auto it = kernel_name_ids.find(kernel->kernel_name);
+    if (it == kernel_name_ids.end()) {
+        it = kernel_name_ids.emplace(kernel->kernel_name, kernel_names.size()).first;
+        kernel_names.push_back(kernel->kernel_name);
+    }
+    simulator.kernel_start(it->second);
+}
+
+
+void UvmSim::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+}
+
+
+void UvmSim::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    active_memories.emplace(mem->addr, mem->size);
+    simulator.alloc(mem->addr, mem->size);
+}
+
+
+void UvmSim::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    active_memories.erase(mem->addr);
+    simulator.free(mem->addr);
+}
+
+
+void UvmSim::mem_cpy_callback(std::shared_ptr<MemCpy_t> mem) {
+}
+
+
+void UvmSim::mem_set_callback(std::shared_ptr<MemSet_t> mem) {
+}
+
+
+void UvmSim::ten_alloc_callback(std::shared_ptr<TenAlloc_t> ten) {
+}
+
+
+void UvmSim::ten_free_callback(std::shared_ptr<TenFree_t> ten) {
+}
+
+
+void UvmSim::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        case EventType_MEM_COPY:
+            mem_cpy_callback(std::dynamic_pointer_cast<MemCpy_t>(evt));
+            break;
+        case EventType_MEM_SET:
+            mem_set_callback(std::dynamic_pointer_cast<MemSet_t>(evt));
+            break;
+        case EventType_TEN_ALLOC:
+            ten_alloc_callback(std::dynamic_pointer_cast<TenAlloc_t>(evt));
+            break;
+        case EventType_TEN_FREE:
+            ten_free_callback(std::dynamic_pointer_cast<TenFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void UvmSim::gpu_data_analysis(void* data, uint64_t size) {
+    if (kernel_names.empty()) {
+        kernel_start_callback(std::make_shared<KernelLauch_t>("<unknown>"));
+    }
+
+    if (trace_source) {
+        uint32_t page_shift = __builtin_ctzll(simulator.page_size());
+        MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+        for (uint64_t i = 0; i < size; i++) {
+            const MemoryAccess& access = accesses_buffer[i];
+            uint32_t active = warp_active_mask(access.addresses);
+            if (active == 0) {
+                continue;
+            }
+            // one touch per distinct page of the warp
+            uint32_t unique = warp_unique_mask(access.addresses, active, page_shift);
+            for (; unique != 0; unique &= unique - 1) {
+                uint64_t addr = access.addresses[__builtin_ctz(unique)];
+                simulator.touch(addr, addr + access.accessSize);
+            }
+        }
+        return;
+    }
+
+    // the hot_analysis patch hands over the access state itself, size is the number of ranges
+    MemoryAccessState* state = (MemoryAccessState*)data;
+    static_assert(sizeof(MemoryRange) == 2 * sizeof(uint64_t), "start_end must be (start, end) pairs");
+    touched_bitmap.resize((size + 63) / 64);
+    touch_reduce((const uint64_t*)state->start_end, state->touch, size, touched_bitmap.data());
+    for (uint32_t w = 0; w < touched_bitmap.size(); ++w) {
+        for (uint64_t bits = touched_bitmap[w]; bits != 0; bits &= bits - 1) {
+            uint32_t i = w * 64 + __builtin_ctzll(bits);
+            simulator.touch(state->start_end[i].start, state->start_end[i].end);
+        }
+    }
+}
+
+
+void UvmSim::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+    MemoryRange* _ranges = (MemoryRange*)ranges;
+    *count = 0;
+    if (limit == 0) {
+        return;
+    }
+    // page-sized pieces, coarser when the live allocations need more than limit of them,
+    // at most one per allocation once a piece covers the largest one
+    uint64_t max_size = 0;
+    for (auto& mem : active_memories) {
+        max_size = std::max(max_size, mem.second);
+    }
+    uint64_t chunk = simulator.page_size();
+    while (chunk < max_size) {
+        uint64_t pieces = 0;
+        for (auto& mem : active_memories) {
+            pieces += (mem.second + chunk - 1) / chunk;
+        }
+        if (pieces <= limit) {
+            break;
+        }
+        chunk = chunk <= max_size / 2 ? chunk * 2 : max_size;
+    }
+    for (auto& mem : active_memories) {
+        for (uint64_t offset = 0; offset < mem.second && *count < limit; offset += chunk) {
+            _ranges[*count].start = mem.first + offset;
+            _ranges[*count].end = mem.first + std::min(offset + chunk, mem.second);
+            (*count)++;
+        }
+        if (*count == limit) {
+            break;
+        }
+    }
+}
+
+
+static void dump_result(std::ofstream& out, const UvmResult_t& result, uint64_t page_size) {
+    double in_bytes = (double)result.migrated_in * page_size;
+    double out_bytes = (double)result.migrated_out * page_size;
+    double seconds = (in_bytes + out_bytes) / (bandwidth * 1e9) + result.faults * fault_latency * 1e-6;
+    out << uvm_policy_name(result.policy) << ": faults=" << result.faults
+        << " (cold " << result.cold_faults << ", refault " << result.refaults
+        << ", forced " << result.forced_evictions << ")"
+        << " migrated_in=" << format_size(in_bytes)
+        << " migrated_out=" << format_size(out_bytes)
+        << " thrashing_launches=" << result.thrashing_launches
+        << " est_time=" << seconds << "s" << std::endl;
+
+    std::vector<uint32_t> names;
+    for (uint32_t name = 0; name < result.name_refaults.size(); name++) {
+        if (result.name_thrashing_launches[name] > 0) {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end(), [&result](uint32_t a, uint32_t b) {
+        return result.name_refaults[a] > result.name_refaults[b];
+    });
+    for (size_t i = 0; i < names.size() && i < top_k; i++) {
+        uint32_t name = names[i];
+        out << "    refaulted " << format_size((double)result.name_refaults[name] * page_size)
+            << " in " << result.name_thrashing_launches[name] << " launches:\t"
+            << kernel_names[name] << std::endl;
+    }
+    fprintf(stdout, "%-8s capacity %s: %lu faults, %s migrated, %lu thrashing launches, ~%.3fs\n",
+            uvm_policy_name(result.policy), format_size(result.capacity_pages * page_size).c_str(),
+            result.faults, format_size(in_bytes + out_bytes).c_str(), result.thrashing_launches, seconds);
+}
+
+
+void UvmSim::flush() {
+    simulator.kernel_end();
+    uint64_t page_size = simulator.page_size();
+
+    std::string filename = get_output_name("uvm_sim") + ".log";
+    printf("Dumping UVM simulation to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out << "Page size: " << format_size(page_size) << std::endl;
+    out << "Launches: " << simulator.num_kernels() << ", distinct page sets: " << simulator.num_sets()
+        << " (" << simulator.num_runs() << " runs)" << std::endl;
+    out << "Pages: " << simulator.num_pages() << ", peak footprint: " << simulator.peak_pages()
+        << " pages (" << format_size(simulator.peak_pages() * page_size) << ")" << std::endl;
+    out << "Bandwidth: " << bandwidth << " GB/s, fault latency: " << fault_latency << " us" << std::endl;
+    out << std::endl;
+
+    // (capacity in pages, label)
+    std::vector<std::pair<uint64_t, std::string>> capacities;
+    if (capacity_bytes > 0) {
+        capacities.emplace_back(std::max<uint64_t>(capacity_bytes / page_size, 1), "configured");
+    } else {
+        for (double ratio : oversubscriptions) {
+            uint64_t pages = (uint64_t)(simulator.peak_pages() / (1.0 + ratio));
+            capacities.emplace_back(std::max<uint64_t>(pages, 1),
+                                    std::to_string((int)(ratio * 100 + 0.5)) + "% oversubscription");
+        }
+    }
+
+    for (auto& capacity : capacities) {
+        out << "==================== " << format_size(capacity.first * page_size) << " ("
+            << capacity.second << ") ====================" << std::endl;
+        for (auto policy : policies) {
+            dump_result(out, simulator.simulate(policy, capacity.first), page_size);
+        }
+        out << std::endl;
+    }
+    out.close();
+}
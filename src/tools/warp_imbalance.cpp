@@ -0,0 +1,236 @@
+/**
+ * Per-warp load imbalance and lane utilization.
+ * Accesses are counted per warp in a flat array indexed by warpId (grown on
+ * demand up to a cap, cleared per launch); sparse warp ids beyond the cap go
+ * to a hash map. At kernel end the distribution over warps is
+ * reduced to min/mean/max, a Gini coefficient and the top stragglers, and
+ * folded into a compact per kernel name summary.
+ */
+#include "tools/warp_imbalance.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/flat_hash.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t LANE_BUCKETS = 8;     // 1-4, 5-8, ..., 29-32 active lanes
+
+typedef struct KernelImbalanceStats {
+    uint64_t launches = 0;
+    uint64_t instructions = 0;
+    uint64_t active_lanes = 0;
+    uint64_t lane_hist[LANE_BUCKETS] = {0};
+    uint64_t warps = 0;
+    uint64_t min_accesses = UINT64_MAX;
+    uint64_t max_accesses = 0;
+    uint64_t gini_launches = 0;     // launches with accesses, the gini_sum divisor
+    double gini_sum = 0;
+    double max_gini = 0;
+    double worst_ratio = 0;     // max / mean of the worst launch
+    std::vector<std::pair<uint64_t, uint64_t>> stragglers;    // (warpId, accesses) of that launch
+} KernelImbalanceStats_t;
+
+// 8MB of dense counters, enough for every warp of any real launch
+static constexpr uint64_t DENSE_WARPS = 1ULL << 20;
+
+static uint32_t top_k = 5;
+static std::vector<uint64_t> warp_accesses;
+static FlatHashMap<uint64_t> sparse_warp_accesses;
+static uint64_t max_warp_id = 0;
+static bool warps_touched = false;
+
+static std::map<std::string, KernelImbalanceStats_t> kernel_stats;
+static KernelImbalanceStats_t* cur_kernel_stats = nullptr;
+
+
+WarpImbalance::WarpImbalance() : Tool(WARP_IMBALANCE) {
+    const char* env_top_k = std::getenv("YOSEMITE_IMBALANCE_TOPK");
+    if (env_top_k != nullptr) {
+        top_k = std::max(std::atoi(env_top_k), 0);
+    }
+    warp_accesses.resize(1024, 0);
+}
+
+
+WarpImbalance::~WarpImbalance() {}
+
+
+static void retire_launch() {
+    if (!warps_touched || cur_kernel_stats == nullptr) {
+        return;
+    }
+    KernelImbalanceStats_t& stats = *cur_kernel_stats;
+
+    std::vector<std::pair<uint64_t, uint64_t>> warps;
+    for (uint64_t w = 0; w <= max_warp_id; w++) {
+        if (warp_accesses[w] > 0) {
+            warps.emplace_back(w, warp_accesses[w]);
+        }
+    }
+    sparse_warp_accesses.for_each([&](uint64_t w, uint64_t& accesses) {
+        warps.emplace_back(w, accesses);
+    });
+    std::fill(warp_accesses.begin(), warp_accesses.begin() + max_warp_id + 1, 0);
+    sparse_warp_accesses.clear();
+    max_warp_id = 0;
+    warps_touched = false;
+
+    // ascending by accesses for the Gini coefficient
+    std::sort(warps.begin(), warps.end(), [](const auto& a, const auto& b) {
+        return a.second < b.second;
+    });
+    uint64_t n = warps.size();
+    double total = 0;
+    double weighted = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        total += warps[i].second;
+        weighted += (double)(i + 1) * warps[i].second;
+    }
+    double gini = n > 1 ? (2.0 * weighted) / (n * total) - (double)(n + 1) / n : 0.0;
+    double mean = total / n;
+    double ratio = warps.back().second / mean;
+
+    stats.warps += n;
+    stats.min_accesses = std::min(stats.min_accesses, warps.front().second);
+    stats.max_accesses = std::max(stats.max_accesses, warps.back().second);
+    stats.gini_launches++;
+    stats.gini_sum += gini;
+    stats.max_gini = std::max(stats.max_gini, gini);
+    if (ratio > stats.worst_ratio) {
+        stats.worst_ratio = ratio;
+        stats.stragglers.assign(warps.rbegin(), warps.rbegin() + std::min<uint64_t>(top_k, n));
+    }
+}
+
+
+void WarpImbalance::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_stats = &kernel_stats[kernel->kernel_name];
+    cur_kernel_stats->launches++;
+}
+
+
+void WarpImbalance::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    retire_launch();
+    cur_kernel_stats = nullptr;
+}
+
+
+void WarpImbalance::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+}
+
+
+void WarpImbalance::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+}
+
+
+void WarpImbalance::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void WarpImbalance::gpu_data_analysis(void* data, uint64_t size) {
+    if (cur_kernel_stats == nullptr) {
+        cur_kernel_stats = &kernel_stats["<unknown>"];
+        cur_kernel_stats->launches++;
+    }
+    KernelImbalanceStats_t& stats = *cur_kernel_stats;
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t lanes = __builtin_popcount(warp_active_mask(access.addresses));
+        if (lanes == 0) {
+            continue;
+        }
+        stats.instructions++;
+        stats.active_lanes += lanes;
+        stats.lane_hist[(lanes - 1) * LANE_BUCKETS / GPU_WARP_SIZE]++;
+
+        uint64_t warp = access.warpId;
+        if (warp >= DENSE_WARPS) {
+            sparse_warp_accesses[warp]++;
+            warps_touched = true;
+            continue;
+        }
+        if (warp >= warp_accesses.size()) {
+            warp_accesses.resize(std::min(std::max<uint64_t>(warp + 1, warp_accesses.size() * 2), DENSE_WARPS), 0);
+        }
+        warp_accesses[warp]++;
+        max_warp_id = std::max(max_warp_id, warp);
+        warps_touched = true;
+    }
+}
+
+
+void WarpImbalance::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+void WarpImbalance::flush() {
+    retire_launch();
+
+    std::string filename = get_output_name("warp_imbalance") + ".log";
+    printf("Dumping warp imbalance analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out.precision(3);
+
+    std::vector<std::pair<std::string, KernelImbalanceStats_t*>> kernels;
+    for (auto& it : kernel_stats) {
+        if (it.second.instructions > 0) {
+            kernels.emplace_back(it.first, &it.second);
+        }
+    }
+    // most imbalanced first
+    std::sort(kernels.begin(), kernels.end(), [](const auto& a, const auto& b) {
+        return a.second->max_gini > b.second->max_gini;
+    });
+
+    out << "# lanes: active-lane histogram over 1-4,5-8,...,29-32 lanes (% of instructions)" << std::endl;
+    for (auto& kernel : kernels) {
+        const KernelImbalanceStats_t& stats = *kernel.second;
+        double insts = stats.instructions;
+        out << kernel.first << std::endl;
+        out << "  launches=" << stats.launches
+            << " warps/launch=" << stats.warps / std::max<uint64_t>(stats.launches, 1)
+            << " accesses/warp min=" << stats.min_accesses
+            << " mean=" << insts / std::max<uint64_t>(stats.warps, 1)
+            << " max=" << stats.max_accesses
+            << " gini mean=" << stats.gini_sum / std::max<uint64_t>(stats.gini_launches, 1)
+            << " max=" << stats.max_gini << std::endl;
+        out << "  lane_efficiency=" << 100.0 * stats.active_lanes / (insts * GPU_WARP_SIZE) << "% lanes:";
+        for (uint32_t b = 0; b < LANE_BUCKETS; b++) {
+            out << " " << 100.0 * stats.lane_hist[b] / insts;
+        }
+        out << std::endl;
+        out << "  stragglers (max/mean=" << stats.worst_ratio << "):";
+        for (auto& warp : stats.stragglers) {
+            out << " " << warp.first << ":" << warp.second;
+        }
+        out << std::endl;
+    }
+
+    out.close();
+}
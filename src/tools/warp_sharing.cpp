@@ -0,0 +1,453 @@
+/**
+ * Inter-warp cache line sharing and contention.
+ * Within each kernel launch every line records how many distinct warps read
+ * and wrote it: exactly up to a few warps, then through a 128-bit linear
+ * counting sketch. Writer warps get their own exact small set, so a sketch
+ * collision never changes the class of a line. Lines live in a map sharded
+ * by line hash, each shard updated by a single worker. At kernel end lines
+ * are classified as read-shared, read-write shared, write-write contended or
+ * atomic contended, and the most contended ones are kept for the report.
+ */
+#include "tools/warp_sharing.h"
+#include "utils/helper.h"
+#include "utils/warp_simd.h"
+#include "utils/access_flags.h"
+#include "utils/address_index.h"
+#include "utils/flat_hash.h"
+#include "utils/fast_hash.h"
+#include "utils/thread_pool.h"
+#include "gpu_patch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <vector>
+#include <string>
+
+
+using namespace yosemite;
+
+static constexpr uint32_t SMALL_SET_SIZE = 4;
+static constexpr uint32_t SKETCH_BITS = 128;
+// estimate of a full sketch; the true count is at least this large
+static constexpr uint32_t SKETCH_SATURATED = 621;
+
+typedef enum {
+    SHARING_PRIVATE = 0,
+    SHARING_READ = 1,           // several warps, reads only
+    SHARING_READ_WRITE = 2,     // one writer, other warps read
+    SHARING_WRITE_WRITE = 3,    // several writers
+    SHARING_ATOMIC = 4,         // several writers, atomics among them
+    SHARING_NUMS = 5
+} SharingClass_t;
+
+static const char* SHARING_NAMES[SHARING_NUMS] = {
+    "private", "read_shared", "read_write_shared", "write_write", "atomic_contention"
+};
+
+typedef struct LineSharing {
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+    uint32_t atomics = 0;
+    uint32_t small_warps[SMALL_SET_SIZE];
+    uint32_t small_count = 0;           // SMALL_SET_SIZE + 1 once overflowed
+    uint32_t small_writers[SMALL_SET_SIZE];
+    uint32_t small_writer_count = 0;    // SMALL_SET_SIZE + 1 once overflowed
+    uint32_t last_writer = 0;
+    uint32_t written_words = 0;         // 4B words written so far
+    uint32_t true_sharing = 0;          // writer change on an already written word
+    uint32_t false_sharing = 0;         // writer change on untouched words
+    uint64_t readers[SKETCH_BITS / 64] = {0};
+    uint64_t writers[SKETCH_BITS / 64] = {0};
+} LineSharing_t;
+
+typedef struct LineRequest {
+    uint64_t line;
+    uint32_t warp;
+    uint32_t words;
+    uint32_t flags;
+} LineRequest_t;
+
+typedef struct SharingShard {
+    FlatHashMap<LineSharing_t> lines;
+    std::vector<LineRequest_t> requests;
+} SharingShard_t;
+
+typedef struct ContendedLine {
+    uint64_t address;
+    std::string kernel_name;
+    SharingClass_t sharing;
+    double score;
+    uint32_t warps;
+    uint32_t writer_warps;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t atomics;
+    uint32_t true_sharing;
+    uint32_t false_sharing;
+    uint32_t alloc_id;
+    uint64_t alloc_offset;
+} ContendedLine_t;
+
+typedef struct KernelSharingStats {
+    uint64_t launches = 0;
+    uint64_t lines[SHARING_NUMS] = {0};
+} KernelSharingStats_t;
+
+typedef struct AllocationInfo {
+    DevPtr addr;
+    uint64_t size;
+} AllocationInfo_t;
+
+static uint32_t line_shift = 7;
+static uint32_t top_k = 32;
+static uint32_t num_shards = 1;
+static std::vector<SharingShard_t> shards;
+static std::unique_ptr<ThreadPool> _pool;
+
+static AddressIndex alloc_index;
+static std::vector<AllocationInfo_t> allocations;
+
+static std::map<std::string, KernelSharingStats_t> kernel_stats;
+static std::string cur_kernel_name = "<unknown>";
+static std::vector<ContendedLine_t> top_lines;
+
+
+WarpSharing::WarpSharing() : Tool(WARP_SHARING) {
+    const char* env_granularity = std::getenv("YOSEMITE_SHARING_GRANULARITY");
+    if (env_granularity != nullptr && std::string(env_granularity) == "sector") {
+        line_shift = 5;
+    }
+    const char* env_top_k = std::getenv("YOSEMITE_SHARING_TOPK");
+    if (env_top_k != nullptr) {
+        top_k = std::max(std::atoi(env_top_k), 0);
+    }
+    uint32_t num_threads = default_thread_count("YOSEMITE_SHARING_THREADS");
+    if (num_threads > 0) {
+        _pool.reset(new ThreadPool(num_threads));
+        num_shards = num_threads;
+    }
+    shards.resize(num_shards);
+    fprintf(stdout, "Warp sharing analysis at %uB granularity, %u shards.\n",
+            1u << line_shift, num_shards);
+}
+
+
+WarpSharing::~WarpSharing() {}
+
+
+static inline void sketch_add(uint64_t* sketch, uint32_t warp) {
+    uint32_t bit = mix64(warp) & (SKETCH_BITS - 1);
+    sketch[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+
+// linear counting estimate of the distinct warps in a sketch
+static uint32_t sketch_estimate(const uint64_t* sketch) {
+    uint32_t set = 0;
+    for (uint32_t i = 0; i < SKETCH_BITS / 64; i++) {
+        set += __builtin_popcountll(sketch[i]);
+    }
+    if (set >= SKETCH_BITS) {
+        return SKETCH_SATURATED;
+    }
+    return (uint32_t)std::lround(-(double)SKETCH_BITS * std::log(1.0 - (double)set / SKETCH_BITS));
+}
+
+
+static uint32_t distinct_warps(const LineSharing_t& line) {
+    if (line.small_count <= SMALL_SET_SIZE) {
+        return line.small_count;
+    }
+    uint64_t all[SKETCH_BITS / 64];
+    for (uint32_t i = 0; i < SKETCH_BITS / 64; i++) {
+        all[i] = line.readers[i] | line.writers[i];
+    }
+    return std::max(sketch_estimate(all), SMALL_SET_SIZE + 1);
+}
+
+
+// exact while the writers fit the small set, the sketch estimate beyond
+static uint32_t distinct_writers(const LineSharing_t& line) {
+    if (line.small_writer_count <= SMALL_SET_SIZE) {
+        return line.small_writer_count;
+    }
+    return std::max(sketch_estimate(line.writers), SMALL_SET_SIZE + 1);
+}
+
+
+static inline void small_set_add(uint32_t* warps, uint32_t& count, uint32_t warp) {
+    if (count > SMALL_SET_SIZE) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (warps[i] == warp) {
+            return;
+        }
+    }
+    if (count < SMALL_SET_SIZE) {
+        warps[count] = warp;
+    }
+    count++;
+}
+
+
+static void update_line(LineSharing_t& line, const LineRequest_t& request) {
+    small_set_add(line.small_warps, line.small_count, request.warp);
+
+    if (!access_is_write(request.flags)) {
+        line.reads++;
+        sketch_add(line.readers, request.warp);
+        return;
+    }
+    line.writes++;
+    line.atomics += access_is_atomic(request.flags);
+    sketch_add(line.writers, request.warp);
+    small_set_add(line.small_writers, line.small_writer_count, request.warp);
+    if (line.writes > 1 && line.last_writer != request.warp) {
+        if (line.written_words & request.words) {
+            line.true_sharing++;
+        } else {
+            line.false_sharing++;
+        }
+    }
+    line.last_writer = request.warp;
+    line.written_words |= request.words;
+}
+
+
+static void process_shard(uint32_t s) {
+    SharingShard_t& shard = shards[s];
+    for (auto& request : shard.requests) {
+        update_line(shard.lines[request.line], request);
+    }
+    shard.requests.clear();
+}
+
+
+static void process_requests() {
+    for (uint32_t s = 0; s < num_shards; s++) {
+        if (shards[s].requests.empty()) {
+            continue;
+        }
+        if (_pool) {
+            _pool->submit([s] { process_shard(s); });
+        } else {
+            process_shard(s);
+        }
+    }
+    if (_pool) {
+        _pool->wait();
+    }
+}
+
+
+static SharingClass_t classify(const LineSharing_t& line, uint32_t warps, uint32_t writer_warps) {
+    if (warps <= 1) {
+        return SHARING_PRIVATE;
+    }
+    if (writer_warps == 0) {
+        return SHARING_READ;
+    }
+    if (writer_warps == 1) {
+        return SHARING_READ_WRITE;
+    }
+    return line.atomics > 0 ? SHARING_ATOMIC : SHARING_WRITE_WRITE;
+}
+
+
+static void retire_kernel() {
+    process_requests();
+
+    uint64_t num_lines = 0;
+    for (auto& shard : shards) {
+        num_lines += shard.lines.size();
+    }
+    if (num_lines == 0) {
+        return;
+    }
+
+    KernelSharingStats_t& stats = kernel_stats[cur_kernel_name];
+    std::vector<ContendedLine_t> candidates;
+    for (auto& shard : shards) {
+        shard.lines.for_each([&](uint64_t line_id, LineSharing_t& line) {
+            uint32_t warps = distinct_warps(line);
+            uint32_t writer_warps = distinct_writers(line);
+            SharingClass_t sharing = classify(line, warps, writer_warps);
+            stats.lines[sharing]++;
+            if (sharing == SHARING_PRIVATE) {
+                return;
+            }
+            // writers serialize on the line, readers only share it
+            double score = sharing == SHARING_READ ? (double)warps * line.reads
+                                                   : (double)writer_warps * line.writes;
+            candidates.push_back(ContendedLine_t{line_id << line_shift, cur_kernel_name, sharing,
+                                                 score, warps, writer_warps, line.reads, line.writes,
+                                                 line.atomics, line.true_sharing, line.false_sharing,
+                                                 AddressIndex::NONE, 0});
+        });
+        shard.lines.clear();
+    }
+
+    // keep the global top-K, mapping lines to allocations while they are still live
+    // any write sharing ranks above pure read sharing
+    auto by_score = [](const ContendedLine_t& a, const ContendedLine_t& b) {
+        bool a_write = a.sharing != SHARING_READ;
+        bool b_write = b.sharing != SHARING_READ;
+        if (a_write != b_write) {
+            return a_write;
+        }
+        return a.score > b.score;
+    };
+    if (candidates.size() > top_k) {
+        std::partial_sort(candidates.begin(), candidates.begin() + top_k, candidates.end(), by_score);
+        candidates.resize(top_k);
+    }
+    for (auto& line : candidates) {
+        line.alloc_id = alloc_index.find(line.address);
+        if (line.alloc_id != AddressIndex::NONE) {
+            line.alloc_offset = line.address - allocations[line.alloc_id].addr;
+        }
+        top_lines.push_back(line);
+    }
+    std::sort(top_lines.begin(), top_lines.end(), by_score);
+    if (top_lines.size() > top_k) {
+        top_lines.resize(top_k);
+    }
+}
+
+
+void WarpSharing::kernel_start_callback(std::shared_ptr<KernelLauch_t> kernel) {
+    cur_kernel_name = kernel->kernel_name;
+    kernel_stats[cur_kernel_name].launches++;
+    alloc_index.refresh();
+}
+
+
+void WarpSharing::kernel_end_callback(std::shared_ptr<KernelEnd_t> kernel) {
+    retire_kernel();
+    cur_kernel_name = "<unknown>";
+}
+
+
+void WarpSharing::mem_alloc_callback(std::shared_ptr<MemAlloc_t> mem) {
+    alloc_index.insert(mem->addr, mem->size, allocations.size());
+    allocations.push_back(AllocationInfo_t{mem->addr, mem->size});
+}
+
+
+void WarpSharing::mem_free_callback(std::shared_ptr<MemFree_t> mem) {
+    alloc_index.erase(mem->addr);
+}
+
+
+void WarpSharing::evt_callback(EventPtr_t evt) {
+    switch (evt->evt_type) {
+        case EventType_KERNEL_LAUNCH:
+            kernel_start_callback(std::dynamic_pointer_cast<KernelLauch_t>(evt));
+            break;
+        case EventType_KERNEL_END:
+            kernel_end_callback(std::dynamic_pointer_cast<KernelEnd_t>(evt));
+            break;
+        case EventType_MEM_ALLOC:
+            mem_alloc_callback(std::dynamic_pointer_cast<MemAlloc_t>(evt));
+            break;
+        case EventType_MEM_FREE:
+            mem_free_callback(std::dynamic_pointer_cast<MemFree_t>(evt));
+            break;
+        default:
+            break;
+    }
+}
+
+
+void WarpSharing::gpu_data_analysis(void* data, uint64_t size) {
+    MemoryAccess* accesses_buffer = (MemoryAccess*)data;
+    uint32_t word_bits = line_shift - 2;
+    uint32_t groups[GPU_WARP_SIZE];
+    for (uint64_t i = 0; i < size; i++) {
+        const MemoryAccess& access = accesses_buffer[i];
+        uint32_t active = warp_active_mask(access.addresses);
+        if (active == 0) {
+            continue;
+        }
+        uint32_t warp = (uint32_t)mix64(access.warpId);
+        uint32_t words_per_lane = std::max((access.accessSize + 3) >> 2, 1u);
+        warp_match_any(access.addresses, active, line_shift, groups);
+        for (uint32_t pending = active; pending != 0;) {
+            uint32_t lane = __builtin_ctz(pending);
+            uint32_t group = groups[lane];
+            pending &= ~group;
+
+            uint32_t words = 0;
+            for (uint32_t members = group; members != 0; members &= members - 1) {
+                uint32_t word = (access.addresses[__builtin_ctz(members)] >> 2) & ((1u << word_bits) - 1);
+                // clamp the span to the words left in the line
+                uint32_t span = std::min(words_per_lane, (1u << word_bits) - word);
+                words |= (span >= 32 ? ~0u : (1u << span) - 1) << word;
+            }
+            uint64_t line = access.addresses[lane] >> line_shift;
+            shards[mix64(line) % num_shards].requests.push_back(
+                LineRequest_t{line, warp, words, access.flags});
+        }
+    }
+    process_requests();
+}
+
+
+void WarpSharing::query_ranges(void* ranges, uint32_t limit, uint32_t* count) {
+}
+
+
+void WarpSharing::flush() {
+    retire_kernel();
+
+    std::string filename = get_output_name("warp_sharing") + ".log";
+    printf("Dumping warp sharing analysis to %s\n", filename.c_str());
+
+    std::ofstream out(filename);
+    out << "Granularity: " << (1u << line_shift) << "B" << std::endl << std::endl;
+
+    out << "==================== Top contended lines ====================" << std::endl;
+    for (auto& line : top_lines) {
+        out << SHARING_NAMES[line.sharing] << " " << line.address
+            << " warps" << (line.warps >= SKETCH_SATURATED ? ">=" : "=") << line.warps
+            << " writer_warps" << (line.writer_warps >= SKETCH_SATURATED ? ">=" : "=") << line.writer_warps
+            << " reads=" << line.reads << " writes=" << line.writes << " atomics=" << line.atomics
+            << " true_sharing=" << line.true_sharing << " false_sharing=" << line.false_sharing;
+        if (line.alloc_id != AddressIndex::NONE) {
+            out << " alloc=" << line.alloc_id << "+" << line.alloc_offset;
+        }
+        out << "\t" << line.kernel_name << std::endl;
+    }
+    out << std::endl;
+
+    out << "==================== Kernels ====================" << std::endl;
+    for (auto& it : kernel_stats) {
+        out << "launches=" << it.second.launches;
+        for (uint32_t c = 0; c < SHARING_NUMS; c++) {
+            out << " " << SHARING_NAMES[c] << "=" << it.second.lines[c];
+        }
+        out << "\t" << it.first << std::endl;
+    }
+    out << std::endl;
+
+    std::vector<uint32_t> referenced;
+    for (auto& line : top_lines) {
+        if (line.alloc_id != AddressIndex::NONE) {
+            referenced.push_back(line.alloc_id);
+        }
+    }
+    std::sort(referenced.begin(), referenced.end());
+    referenced.erase(std::unique(referenced.begin(), referenced.end()), referenced.end());
+
+    out << "==================== Allocations ====================" << std::endl;
+    for (uint32_t i : referenced) {
+        out << "Alloc " << i << " " << allocations[i].addr << " " << allocations[i].size
+            << " (" << format_size(allocations[i].size) << ")" << std::endl;
+    }
+
+    out.close();
+}
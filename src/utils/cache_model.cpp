@@ -0,0 +1,148 @@
+#include "utils/cache_model.h"
+#include "utils/fast_hash.h"
+#include "utils/helper.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace yosemite {
+
+static constexpr uint8_t RRPV_MAX = 3;
+
+
+CacheModel::CacheModel(const CacheConfig_t& config) : _config(config) {
+    _config.sector_size = std::max(_config.sector_size, 1u);
+    _config.line_size = std::max(_config.line_size, _config.sector_size);
+    _config.assoc = std::max(_config.assoc, 1u);
+    _sector_shift = 63 - __builtin_clzll(_config.sector_size);
+    _line_shift = 63 - __builtin_clzll(_config.line_size);
+    // at most 32 sectors per line so the masks fit in 32 bits
+    _line_shift = std::min(_line_shift, _sector_shift + 5);
+
+    uint64_t sets = _config.size >> _line_shift;
+    sets /= _config.assoc;
+    _num_sets = (uint32_t)std::max<uint64_t>(sets, 1);
+
+    _ways.assign((uint64_t)_num_sets * _config.assoc, Way_t{0, 0, 0, 0, RRPV_MAX});
+    _clocks.assign(_num_sets, 0);
+}
+
+
+uint32_t CacheModel::set_of(uint64_t line) const {
+    if (_config.hashed_index) {
+        return mix64(line) % _num_sets;
+    }
+    return line % _num_sets;
+}
+
+
+uint32_t CacheModel::victim(Way_t* ways, uint32_t set, uint64_t line) {
+    uint32_t assoc = _config.assoc;
+    for (uint32_t w = 0; w < assoc; w++) {
+        if (ways[w].valid == 0) {
+            return w;
+        }
+    }
+    switch (_config.policy) {
+        case CACHE_POLICY_RANDOM:
+            return mix64(line ^ _clocks[set]) % assoc;
+        case CACHE_POLICY_SRRIP:
+            while (true) {
+                for (uint32_t w = 0; w < assoc; w++) {
+                    if (ways[w].rrpv >= RRPV_MAX) {
+                        return w;
+                    }
+                }
+                for (uint32_t w = 0; w < assoc; w++) {
+                    ways[w].rrpv++;
+                }
+            }
+        default: {
+            // LRU and FIFO differ only in when the stamp is updated
+            uint32_t oldest = 0;
+            for (uint32_t w = 1; w < assoc; w++) {
+                if (ways[w].stamp < ways[oldest].stamp) {
+                    oldest = w;
+                }
+            }
+            return oldest;
+        }
+    }
+}
+
+
+CacheResult_t CacheModel::access(uint64_t sector, bool is_write, CacheStats_t& stats) {
+    uint64_t line = sector >> (_line_shift - _sector_shift);
+    uint32_t sector_bit = 1u << (sector & ((1u << (_line_shift - _sector_shift)) - 1));
+    uint32_t set = set_of(line);
+    Way_t* ways = &_ways[(uint64_t)set * _config.assoc];
+    uint64_t now = ++_clocks[set];
+
+    stats.accesses++;
+    stats.writes += is_write;
+
+    for (uint32_t w = 0; w < _config.assoc; w++) {
+        Way_t& way = ways[w];
+        if (way.valid == 0 || way.line != line) {
+            continue;
+        }
+        if (_config.policy == CACHE_POLICY_LRU) {
+            way.stamp = now;
+        }
+        way.rrpv = 0;
+        if (is_write) {
+            way.dirty |= sector_bit;
+        }
+        if (way.valid & sector_bit) {
+            stats.hits++;
+            return CACHE_HIT;
+        }
+        way.valid |= sector_bit;
+        stats.sector_misses++;
+        return CACHE_SECTOR_MISS;
+    }
+
+    Way_t& way = ways[victim(ways, set, line)];
+    stats.writebacks += __builtin_popcount(way.dirty);
+    way.line = line;
+    way.stamp = now;
+    way.valid = sector_bit;
+    way.dirty = is_write ? sector_bit : 0;
+    way.rrpv = RRPV_MAX - 1;
+    stats.line_misses++;
+    return CACHE_LINE_MISS;
+}
+
+
+std::string CacheModel::describe() const {
+    std::ostringstream os;
+    os << format_size(_config.size) << " " << _config.assoc << "-way, "
+       << (1u << _line_shift) << "B lines / " << (1u << _sector_shift) << "B sectors, "
+       << _num_sets << " sets, " << cache_policy_name(_config.policy)
+       << (_config.hashed_index ? ", hashed index" : ", modulo index");
+    return os.str();
+}
+
+
+CachePolicy_t parse_cache_policy(const std::string& name) {
+    if (name == "fifo") {
+        return CACHE_POLICY_FIFO;
+    } else if (name == "random") {
+        return CACHE_POLICY_RANDOM;
+    } else if (name == "srrip") {
+        return CACHE_POLICY_SRRIP;
+    }
+    return CACHE_POLICY_LRU;
+}
+
+
+const char* cache_policy_name(CachePolicy_t policy) {
+    switch (policy) {
+        case CACHE_POLICY_FIFO: return "FIFO";
+        case CACHE_POLICY_RANDOM: return "random";
+        case CACHE_POLICY_SRRIP: return "SRRIP";
+        default: return "LRU";
+    }
+}
+
+}   // yosemite
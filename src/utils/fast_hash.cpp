@@ -0,0 +1,179 @@
+#include "utils/fast_hash.h"
+#include "utils/helper.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace yosemite {
+
+static constexpr uint64_t PRIME32_1 = 0x9E3779B1ULL;
+static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+
+typedef void (*AccumulateBlockFn)(uint64_t* acc, const uint8_t* block, const uint64_t* keys);
+
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+static inline void accumulate_stripe_scalar(uint64_t* acc, const uint8_t* stripe, const uint64_t* keys) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t data = read64(stripe + i * 8);
+        uint64_t data_key = data ^ keys[i];
+        acc[i ^ 1] += data;
+        acc[i] += (data_key & 0xFFFFFFFFULL) * (data_key >> 32);
+    }
+}
+
+
+static void accumulate_block_scalar(uint64_t* acc, const uint8_t* block, const uint64_t* keys) {
+    for (size_t s = 0; s < FastHash::STRIPES_PER_BLOCK; s++) {
+        accumulate_stripe_scalar(acc, block + s * FastHash::STRIPE_SIZE, keys + s * 4);
+    }
+    const uint64_t* scramble_keys = keys + FastHash::STRIPES_PER_BLOCK * 4;
+    for (int i = 0; i < 4; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= scramble_keys[i];
+        acc[i] = a * PRIME32_1;
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void accumulate_block_avx2(uint64_t* acc, const uint8_t* block, const uint64_t* keys) {
+    __m256i vacc = _mm256_loadu_si256((const __m256i*)acc);
+    for (size_t s = 0; s < FastHash::STRIPES_PER_BLOCK; s++) {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(block + s * FastHash::STRIPE_SIZE));
+        __m256i key = _mm256_loadu_si256((const __m256i*)(keys + s * 4));
+        __m256i data_key = _mm256_xor_si256(data, key);
+        __m256i product = _mm256_mul_epu32(data_key, _mm256_srli_epi64(data_key, 32));
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        vacc = _mm256_add_epi64(vacc, _mm256_add_epi64(product, swapped));
+    }
+    __m256i scramble_key = _mm256_loadu_si256((const __m256i*)(keys + FastHash::STRIPES_PER_BLOCK * 4));
+    __m256i prime = _mm256_set1_epi64x(PRIME32_1);
+    vacc = _mm256_xor_si256(vacc, _mm256_srli_epi64(vacc, 47));
+    vacc = _mm256_xor_si256(vacc, scramble_key);
+    __m256i lo = _mm256_mul_epu32(vacc, prime);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(vacc, 32), prime);
+    vacc = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    _mm256_storeu_si256((__m256i*)acc, vacc);
+}
+#endif
+
+
+static AccumulateBlockFn select_accumulate_block() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpu_supports_avx2()) {
+        return accumulate_block_avx2;
+    }
+#endif
+    return accumulate_block_scalar;
+}
+
+static const AccumulateBlockFn accumulate_block = select_accumulate_block();
+
+
+void FastHash::reset(uint64_t seed) {
+    _seed = seed;
+    _buffer_len = 0;
+    _total_len = 0;
+    _acc[0] = PRIME32_1;
+    _acc[1] = PRIME64_1;
+    _acc[2] = PRIME64_2;
+    _acc[3] = PRIME64_3;
+    uint64_t state = seed ^ PRIME64_4;
+    for (auto& key : _keys) {
+        key = splitmix64(state);
+    }
+}
+
+
+void FastHash::update(const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    _total_len += len;
+
+    if (_buffer_len > 0) {
+        size_t fill = std::min(len, BLOCK_SIZE - _buffer_len);
+        memcpy(_buffer + _buffer_len, p, fill);
+        _buffer_len += fill;
+        p += fill;
+        len -= fill;
+        if (_buffer_len < BLOCK_SIZE) {
+            return;
+        }
+        accumulate_block(_acc, _buffer, _keys);
+        _buffer_len = 0;
+    }
+    while (len >= BLOCK_SIZE) {
+        accumulate_block(_acc, p, _keys);
+        p += BLOCK_SIZE;
+        len -= BLOCK_SIZE;
+    }
+    if (len > 0) {
+        memcpy(_buffer, p, len);
+        _buffer_len = len;
+    }
+}
+
+
+uint64_t FastHash::digest() const {
+    uint64_t acc[4] = {_acc[0], _acc[1], _acc[2], _acc[3]};
+
+    // the tail is zero padded to whole stripes, the total length is mixed in below
+    uint8_t tail[BLOCK_SIZE] = {0};
+    memcpy(tail, _buffer, _buffer_len);
+    size_t stripes = (_buffer_len + STRIPE_SIZE - 1) / STRIPE_SIZE;
+    for (size_t s = 0; s < stripes; s++) {
+        accumulate_stripe_scalar(acc, tail + s * STRIPE_SIZE, _keys + s * 4);
+    }
+
+    uint64_t h = _total_len * PRIME64_1 ^ _seed;
+    for (int i = 0; i < 4; i++) {
+        uint64_t k = acc[i] ^ _keys[STRIPES_PER_BLOCK * 4 + i];
+        k *= PRIME64_2;
+        k = rotl64(k, 31) * PRIME64_1;
+        h ^= k;
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+uint64_t fast_hash64(const void* data, size_t len, uint64_t seed) {
+    FastHash hash(seed);
+    hash.update(data, len);
+    return hash.digest();
+}
+
+}   // yosemite
@@ -3,6 +3,7 @@
 #include <sstream>
 #include <iomanip>
 #include <ctime>
+#include <cstdlib>
 #include <sys/stat.h>   // for folder creation
 
 namespace yosemite {
@@ -51,6 +52,30 @@ std::string format_number(uint64_t number) {
     return os.str();
 }
 
+uint64_t parse_size(const std::string& str) {
+    size_t pos = 0;
+    uint64_t value;
+    try {
+        value = std::stoull(str, &pos);
+    } catch (...) {
+        return 0;
+    }
+    std::string unit = str.substr(pos);
+    if (!unit.empty() && (unit.back() == 'B' || unit.back() == 'b')) {
+        unit.pop_back();
+    }
+    if (unit.empty()) {
+        return value;
+    }
+    switch (unit[0]) {
+        case 'K': case 'k': return value << 10;
+        case 'M': case 'm': return value << 20;
+        case 'G': case 'g': return value << 30;
+        case 'T': case 't': return value << 40;
+        default: return 0;
+    }
+}
+
 std::string get_current_date_n_time() {
     // Get current time as time_t
     std::time_t now = std::time(nullptr);
@@ -71,6 +96,15 @@ std::string get_current_date_n_time() {
     return ss.str();
 }
 
+// <prefix>_<YOSEMITE_APP_NAME>_<date> or <prefix>_<date> if no app name is set
+std::string get_output_name(const std::string& prefix) {
+    const char* env_app_name = std::getenv("YOSEMITE_APP_NAME");
+    if (env_app_name != nullptr) {
+        return prefix + "_" + std::string(env_app_name) + "_" + get_current_date_n_time();
+    }
+    return prefix + "_" + get_current_date_n_time();
+}
+
 bool check_folder_existance(const std::string &folder) {
     // Check if the folder exists
     struct stat info;
@@ -93,4 +127,22 @@ bool check_folder_existance(const std::string &folder) {
     }
 }
 
+bool cpu_supports_avx2() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+bool cpu_supports_avx512() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#else
+    return false;
+#endif
+}
+
 }   // yosemite
\ No newline at end of file
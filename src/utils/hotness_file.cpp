@@ -0,0 +1,420 @@
+#include "utils/hotness_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace yosemite {
+
+static const char HEADER_MAGIC[8] = {'Y', 'S', 'H', 'O', 'T', '0', '0', '1'};
+static const char TRAILER_MAGIC[8] = {'Y', 'S', 'H', 'O', 'T', 'E', 'N', 'D'};
+static constexpr size_t TRAILER_SIZE = 3 * sizeof(uint64_t) + sizeof(TRAILER_MAGIC);
+static constexpr size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+
+static void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+
+static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void put_u64(std::string& out, uint64_t value) {
+    out.append((const char*)&value, sizeof(value));
+}
+
+
+// removed addresses first, then added (addr, size) pairs, both delta coded
+static void put_live_set_delta(std::string& out, const LiveSet_t& before, const LiveSet_t& after) {
+    std::vector<DevPtr> removed;
+    LiveSet_t added;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < before.size() || j < after.size()) {
+        if (j == after.size() || (i < before.size() && before[i].first < after[j].first)) {
+            removed.push_back(before[i++].first);
+        } else if (i == before.size() || after[j].first < before[i].first) {
+            added.push_back(after[j++]);
+        } else {
+            if (before[i].second != after[j].second) {
+                removed.push_back(before[i].first);
+                added.push_back(after[j]);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    put_varint(out, removed.size());
+    DevPtr prev = 0;
+    for (auto addr : removed) {
+        put_varint(out, addr - prev);
+        prev = addr;
+    }
+    put_varint(out, added.size());
+    prev = 0;
+    for (auto& entry : added) {
+        put_varint(out, entry.first - prev);
+        put_varint(out, entry.second);
+        prev = entry.first;
+    }
+}
+
+
+static bool get_live_set_delta(const uint8_t*& p, const uint8_t* end, std::map<DevPtr, uint64_t>& live) {
+    uint64_t count;
+    uint64_t delta;
+    uint64_t size;
+    if (!get_varint(p, end, count)) {
+        return false;
+    }
+    DevPtr addr = 0;
+    for (uint64_t k = 0; k < count; k++) {
+        if (!get_varint(p, end, delta)) {
+            return false;
+        }
+        addr += delta;
+        live.erase(addr);
+    }
+    if (!get_varint(p, end, count)) {
+        return false;
+    }
+    addr = 0;
+    for (uint64_t k = 0; k < count; k++) {
+        if (!get_varint(p, end, delta) || !get_varint(p, end, size)) {
+            return false;
+        }
+        addr += delta;
+        live[addr] = size;
+    }
+    return true;
+}
+
+
+HotnessWriter::~HotnessWriter() {
+    close();
+}
+
+
+bool HotnessWriter::open(const std::string& filename, uint32_t keyframe_interval) {
+    _file = fopen(filename.c_str(), "wb");
+    if (_file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", filename.c_str());
+        return false;
+    }
+    _keyframe_interval = std::max(keyframe_interval, 1u);
+    _buffer.reserve(WRITE_BUFFER_SIZE + 4096);
+    _buffer.append(HEADER_MAGIC, sizeof(HEADER_MAGIC));
+    _offset = _buffer.size();
+    return true;
+}
+
+
+bool HotnessWriter::append(uint64_t kernel_id, const std::string& kernel_name, uint64_t num_ranges,
+                           const std::vector<HotnessRange_t>& ranges,
+                           const LiveSet_t& allocations, const LiveSet_t& tensors) {
+    if (_file == nullptr || _failed) {
+        return false;
+    }
+    auto name_it = _name_ids.find(kernel_name);
+    if (name_it == _name_ids.end()) {
+        name_it = _name_ids.emplace(kernel_name, _names.size()).first;
+        _names.push_back(kernel_name);
+    }
+    bool keyframe = _index.size() % _keyframe_interval == 0;
+    _index.push_back(HotnessIndexEntry_t{kernel_id, _offset, name_it->second, keyframe});
+
+    size_t begin = _buffer.size();
+    put_varint(_buffer, kernel_id);
+    put_varint(_buffer, name_it->second);
+    put_varint(_buffer, num_ranges);
+    put_varint(_buffer, ranges.size());
+    uint64_t prev = 0;
+    for (auto& range : ranges) {
+        put_varint(_buffer, range.start - prev);
+        put_varint(_buffer, range.end - range.start);
+        put_varint(_buffer, range.touch);
+        prev = range.start;
+    }
+    if (keyframe) {
+        _allocations.clear();
+        _tensors.clear();
+    }
+    put_live_set_delta(_buffer, _allocations, allocations);
+    put_live_set_delta(_buffer, _tensors, tensors);
+    _allocations = allocations;
+    _tensors = tensors;
+    _offset += _buffer.size() - begin;
+
+    if (_buffer.size() >= WRITE_BUFFER_SIZE) {
+        return flush_buffer();
+    }
+    return true;
+}
+
+
+// a failed write poisons the writer, later records are dropped
+bool HotnessWriter::flush_buffer() {
+    if (!_failed && !_buffer.empty()
+        && fwrite(_buffer.data(), 1, _buffer.size(), _file) != _buffer.size()) {
+        fprintf(stderr, "Failed to write hotness file: %s\n", strerror(errno));
+        _failed = true;
+    }
+    _buffer.clear();
+    return !_failed;
+}
+
+
+bool HotnessWriter::close() {
+    if (_file == nullptr) {
+        return false;
+    }
+    uint64_t index_offset = _offset;
+    size_t index_begin = _buffer.size();
+    uint64_t prev_kernel = 0;
+    uint64_t prev_offset = 0;
+    for (auto& entry : _index) {
+        put_varint(_buffer, entry.kernel_id - prev_kernel);
+        put_varint(_buffer, entry.offset - prev_offset);
+        put_varint(_buffer, entry.name_id);
+        _buffer.push_back(entry.keyframe ? 1 : 0);
+        prev_kernel = entry.kernel_id;
+        prev_offset = entry.offset;
+    }
+    uint64_t names_offset = index_offset + (_buffer.size() - index_begin);
+    put_varint(_buffer, _names.size());
+    for (auto& name : _names) {
+        put_varint(_buffer, name.size());
+        _buffer.append(name);
+    }
+    put_u64(_buffer, index_offset);
+    put_u64(_buffer, names_offset);
+    put_u64(_buffer, _index.size());
+    _buffer.append(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+    _offset += _buffer.size() - index_begin;
+
+    flush_buffer();
+    if (fclose(_file) != 0 && !_failed) {
+        fprintf(stderr, "Failed to write hotness file: %s\n", strerror(errno));
+        _failed = true;
+    }
+    _file = nullptr;
+    return !_failed;
+}
+
+
+HotnessReader::~HotnessReader() {
+    if (_file != nullptr) {
+        fclose(_file);
+    }
+}
+
+
+bool HotnessReader::open(const std::string& filename) {
+    _file = fopen(filename.c_str(), "rb");
+    if (_file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", filename.c_str());
+        return false;
+    }
+    char magic[sizeof(HEADER_MAGIC)];
+    uint8_t trailer[TRAILER_SIZE];
+    if (fread(magic, 1, sizeof(magic), _file) != sizeof(magic)
+        || memcmp(magic, HEADER_MAGIC, sizeof(magic)) != 0
+        || fseeko(_file, -(off_t)TRAILER_SIZE, SEEK_END) != 0
+        || fread(trailer, 1, TRAILER_SIZE, _file) != TRAILER_SIZE
+        || memcmp(trailer + 3 * sizeof(uint64_t), TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a complete hotness file\n", filename.c_str());
+        return false;
+    }
+    uint64_t index_offset;
+    uint64_t names_offset;
+    uint64_t num_records;
+    memcpy(&index_offset, trailer, sizeof(uint64_t));
+    memcpy(&names_offset, trailer + sizeof(uint64_t), sizeof(uint64_t));
+    memcpy(&num_records, trailer + 2 * sizeof(uint64_t), sizeof(uint64_t));
+    uint64_t footer_end = ftello(_file) - TRAILER_SIZE;
+    // every index entry takes at least 4 bytes
+    if (index_offset < sizeof(HEADER_MAGIC) || index_offset > names_offset || names_offset >= footer_end
+        || num_records > (names_offset - index_offset) / 4) {
+        fprintf(stderr, "%s has a corrupt footer\n", filename.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> footer(footer_end - index_offset);
+    if (fseeko(_file, index_offset, SEEK_SET) != 0
+        || fread(footer.data(), 1, footer.size(), _file) != footer.size()) {
+        return false;
+    }
+    const uint8_t* p = footer.data();
+    const uint8_t* names = footer.data() + (names_offset - index_offset);
+    const uint8_t* end = footer.data() + footer.size();
+
+    _index.resize(num_records);
+    uint64_t kernel_id = 0;
+    uint64_t offset = 0;
+    for (auto& entry : _index) {
+        uint64_t kernel_delta;
+        uint64_t offset_delta;
+        uint64_t name_id;
+        if (!get_varint(p, names, kernel_delta) || !get_varint(p, names, offset_delta)
+            || !get_varint(p, names, name_id) || p >= names) {
+            return false;
+        }
+        kernel_id += kernel_delta;
+        offset += offset_delta;
+        if (offset < sizeof(HEADER_MAGIC) || offset > index_offset || name_id > UINT32_MAX) {
+            return false;
+        }
+        entry = HotnessIndexEntry_t{kernel_id, offset, (uint32_t)name_id, *p++ != 0};
+    }
+
+    p = names;
+    uint64_t num_names;
+    // every name takes at least its length byte
+    if (!get_varint(p, end, num_names) || num_names > (uint64_t)(end - p)) {
+        return false;
+    }
+    _names.resize(num_names);
+    for (auto& name : _names) {
+        uint64_t length;
+        if (!get_varint(p, end, length) || (uint64_t)(end - p) < length) {
+            return false;
+        }
+        name.assign((const char*)p, length);
+        p += length;
+    }
+    for (auto& entry : _index) {
+        if (entry.name_id >= _names.size()) {
+            return false;
+        }
+    }
+    _records_end = index_offset;
+    _cursor = SIZE_MAX;
+    return true;
+}
+
+
+bool HotnessReader::decode(size_t i, HotnessRecord_t* record) {
+    const HotnessIndexEntry_t& entry = _index[i];
+    uint64_t next = i + 1 < _index.size() ? _index[i + 1].offset : _records_end;
+    std::vector<uint8_t> bytes(next - entry.offset);
+    if (fseeko(_file, entry.offset, SEEK_SET) != 0
+        || fread(bytes.data(), 1, bytes.size(), _file) != bytes.size()) {
+        return false;
+    }
+    const uint8_t* p = bytes.data();
+    const uint8_t* end = p + bytes.size();
+
+    uint64_t kernel_id;
+    uint64_t name_id;
+    uint64_t num_ranges;
+    uint64_t num_touched;
+    if (!get_varint(p, end, kernel_id) || !get_varint(p, end, name_id)
+        || !get_varint(p, end, num_ranges) || !get_varint(p, end, num_touched)
+        || name_id >= _names.size()) {
+        return false;
+    }
+    if (record != nullptr) {
+        record->kernel_id = kernel_id;
+        record->kernel_name = _names[name_id];
+        record->num_ranges = num_ranges;
+        record->ranges.clear();
+        record->ranges.reserve(num_touched);
+    }
+    uint64_t start = 0;
+    for (uint64_t k = 0; k < num_touched; k++) {
+        uint64_t delta;
+        uint64_t length;
+        uint64_t touch;
+        if (!get_varint(p, end, delta) || !get_varint(p, end, length) || !get_varint(p, end, touch)) {
+            return false;
+        }
+        start += delta;
+        if (record != nullptr) {
+            record->ranges.push_back(HotnessRange_t{start, start + length, touch});
+        }
+    }
+
+    if (entry.keyframe) {
+        _allocations.clear();
+        _tensors.clear();
+    }
+    if (!get_live_set_delta(p, end, _allocations) || !get_live_set_delta(p, end, _tensors)) {
+        return false;
+    }
+    _cursor = i;
+    return true;
+}
+
+
+bool HotnessReader::read(size_t i, HotnessRecord_t& record) {
+    if (i >= _index.size()) {
+        return false;
+    }
+    // replay from the closest keyframe unless the cursor is already on the way
+    size_t from = i;
+    while (!_index[from].keyframe && from > 0) {
+        from--;
+    }
+    if (_cursor != SIZE_MAX && _cursor >= from && _cursor < i) {
+        from = _cursor + 1;
+    }
+    for (size_t k = from; k < i; k++) {
+        if (!decode(k, nullptr)) {
+            _cursor = SIZE_MAX;
+            return false;
+        }
+    }
+    if (!decode(i, &record)) {
+        _cursor = SIZE_MAX;
+        return false;
+    }
+    record.allocations.assign(_allocations.begin(), _allocations.end());
+    record.tensors.assign(_tensors.begin(), _tensors.end());
+    return true;
+}
+
+
+bool HotnessReader::read_kernel(uint64_t kernel_id, HotnessRecord_t& record) {
+    auto it = std::lower_bound(_index.begin(), _index.end(), kernel_id,
+                               [](const HotnessIndexEntry_t& entry, uint64_t id) {
+        return entry.kernel_id < id;
+    });
+    if (it == _index.end() || it->kernel_id != kernel_id) {
+        return false;
+    }
+    return read(it - _index.begin(), record);
+}
+
+
+std::vector<size_t> HotnessReader::find(const std::string& kernel_name) const {
+    std::vector<size_t> positions;
+    auto it = std::find(_names.begin(), _names.end(), kernel_name);
+    if (it == _names.end()) {
+        return positions;
+    }
+    uint32_t name_id = it - _names.begin();
+    for (size_t i = 0; i < _index.size(); i++) {
+        if (_index[i].name_id == name_id) {
+            positions.push_back(i);
+        }
+    }
+    return positions;
+}
+
+}   // yosemite
@@ -0,0 +1,144 @@
+#include "utils/iteration_detector.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace yosemite {
+
+static constexpr uint64_t HASH_BASE = 0x100000001B3ULL;
+
+// only the most recent occurrences of the current token are tried as periods,
+// a rare token of the iteration will propose the right one
+static constexpr uint32_t MAX_CANDIDATES = 64;
+
+
+IterationDetector::IterationDetector(uint32_t max_period, uint32_t confirm_periods,
+                                     uint32_t recheck_interval)
+    : _max_period(max_period), _confirm_periods(std::max(2u, confirm_periods)),
+      _recheck_interval(recheck_interval) {
+    _capacity = (uint64_t)_confirm_periods * _max_period + 1;
+    _tokens.resize(_capacity, 0);
+    _prefix.resize(_capacity, 0);
+    _powers.resize(_capacity);
+    _powers[0] = 1;
+    for (uint64_t i = 1; i < _capacity; i++) {
+        _powers[i] = _powers[i - 1] * HASH_BASE;
+    }
+}
+
+
+bool IterationDetector::on_kernel(const std::string& kernel_name) {
+    auto it = _kernel_ids.find(kernel_name);
+    if (it == _kernel_ids.end()) {
+        it = _kernel_ids.emplace(kernel_name, _next_id++).first;
+    }
+    return push(it->second);
+}
+
+
+bool IterationDetector::on_alloc(uint64_t size) {
+    auto it = _alloc_ids.find(size);
+    if (it == _alloc_ids.end()) {
+        it = _alloc_ids.emplace(size, _next_id++).first;
+    }
+    return push(it->second);
+}
+
+
+// Hash of tokens [begin, end); _prefix[i] holds the hash of tokens [0, i).
+uint64_t IterationDetector::window_hash(uint64_t begin, uint64_t end) const {
+    return _prefix[end % _capacity] - _prefix[begin % _capacity] * _powers[end - begin];
+}
+
+
+bool IterationDetector::periodic(uint32_t p) const {
+    uint64_t window = (uint64_t)_confirm_periods * p;
+    if (_num_tokens < window) {
+        return false;
+    }
+    uint64_t begin = _num_tokens - window;
+    return window_hash(begin + p, _num_tokens) == window_hash(begin, _num_tokens - p);
+}
+
+
+bool IterationDetector::verify(uint32_t p) const {
+    uint64_t begin = _num_tokens - (uint64_t)_confirm_periods * p;
+    for (uint64_t i = begin + p; i < _num_tokens; i++) {
+        if (token_at(i) != token_at(i - p)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void IterationDetector::lock(uint32_t p) {
+    _locked = true;
+    _rechecking = false;
+    _period = p;
+    _lock_position = _num_tokens;
+    _iterations = 0;
+    fprintf(stdout, "Iteration detector: locked on a period of %u events after %lu events.\n",
+            p, _num_tokens);
+    fflush(stdout);
+}
+
+
+void IterationDetector::unlock() {
+    // Either the lock was on a loop inside the iteration (e.g. one layer) or
+    // the application changed phase. Only longer periods are accepted for a
+    // while; if none shows up, the floor is dropped again in push().
+    fprintf(stdout, "Iteration detector: period %u broken after %lu iterations.\n",
+            _period, _iterations);
+    fflush(stdout);
+    _min_period = _period;
+    _locked = false;
+    _rechecking = false;
+    _period = 0;
+    _unlock_position = _num_tokens;
+}
+
+
+bool IterationDetector::push(uint32_t token) {
+    bool was_steady = steady();
+
+    uint64_t n = _num_tokens;
+    _tokens[n % _capacity] = token;
+    _prefix[(n + 1) % _capacity] = _prefix[n % _capacity] * HASH_BASE + token;
+    _num_tokens = n + 1;
+
+    auto& positions = _positions[token];
+    while (!positions.empty() && n - positions.front() > _max_period) {
+        positions.pop_front();
+    }
+
+    if (_locked) {
+        if (token != token_at(n - _period)) {
+            unlock();
+        } else if ((_num_tokens - _lock_position) % _period == 0) {
+            _iterations++;
+            _rechecking = _recheck_interval > 0 && _iterations % _recheck_interval == 0;
+        }
+    }
+
+    if (!_locked) {
+        if (_min_period > 0
+            && _num_tokens - _unlock_position >= 2ULL * _confirm_periods * _min_period) {
+            _min_period = 0;
+        }
+        uint32_t candidates = 0;
+        for (auto it = positions.rbegin(); it != positions.rend()
+                                           && candidates < MAX_CANDIDATES; ++it, ++candidates) {
+            uint32_t p = n - *it;
+            if (p > _min_period && periodic(p) && verify(p)) {
+                lock(p);
+                break;
+            }
+        }
+    }
+    positions.push_back(n);
+
+    return was_steady != steady();
+}
+
+}   // yosemite
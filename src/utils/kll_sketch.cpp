@@ -0,0 +1,128 @@
+#include "utils/kll_sketch.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace yosemite {
+
+KLLSketch::KLLSketch(uint32_t k) : _k(std::max(k, 8u)), _random(0x9e3779b97f4a7c15ULL) {
+    grow();
+}
+
+
+uint32_t KLLSketch::capacity(uint32_t level) const {
+    uint32_t depth = _compactors.size() - level - 1;
+    return (uint32_t)std::ceil(_k * std::pow(2.0 / 3.0, depth)) + 1;
+}
+
+
+void KLLSketch::grow() {
+    _compactors.emplace_back();
+    _max_size = 0;
+    for (uint32_t level = 0; level < _compactors.size(); level++) {
+        _max_size += capacity(level);
+    }
+}
+
+
+void KLLSketch::compress() {
+    for (uint32_t level = 0; level < _compactors.size(); level++) {
+        if (_compactors[level].size() < capacity(level)) {
+            continue;
+        }
+        if (level + 1 == _compactors.size()) {
+            grow();
+        }
+        auto& items = _compactors[level];
+        std::sort(items.begin(), items.end());
+        // xorshift, one coin flip per compaction
+        _random ^= _random << 13;
+        _random ^= _random >> 7;
+        _random ^= _random << 17;
+        auto& next = _compactors[level + 1];
+        // an odd item out stays at this level with its weight intact
+        size_t even = items.size() & ~(size_t)1;
+        for (size_t i = _random & 1; i < even; i += 2) {
+            next.push_back(items[i]);
+        }
+        items.erase(items.begin(), items.begin() + even);
+        _size -= even / 2;
+        if (_size < _max_size) {
+            return;
+        }
+    }
+}
+
+
+void KLLSketch::update(double value) {
+    if (_count == 0) {
+        _min = _max = value;
+    } else {
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+    }
+    _count++;
+    _compactors[0].push_back(value);
+    _size++;
+    if (_size >= _max_size) {
+        compress();
+    }
+}
+
+
+void KLLSketch::merge(const KLLSketch& other) {
+    if (other._count == 0) {
+        return;
+    }
+    if (_count == 0) {
+        _min = other._min;
+        _max = other._max;
+    } else {
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+    }
+    _count += other._count;
+    while (_compactors.size() < other._compactors.size()) {
+        grow();
+    }
+    for (uint32_t level = 0; level < other._compactors.size(); level++) {
+        auto& items = other._compactors[level];
+        _compactors[level].insert(_compactors[level].end(), items.begin(), items.end());
+        _size += items.size();
+    }
+    while (_size >= _max_size) {
+        size_t before = _size;
+        compress();
+        if (_size == before) {
+            break;
+        }
+    }
+}
+
+
+double KLLSketch::quantile(double q) const {
+    if (_count == 0) {
+        return 0;
+    }
+    std::vector<std::pair<double, uint64_t>> weighted;
+    weighted.reserve(_size);
+    uint64_t total = 0;
+    for (uint32_t level = 0; level < _compactors.size(); level++) {
+        for (double value : _compactors[level]) {
+            weighted.emplace_back(value, 1ULL << level);
+            total += 1ULL << level;
+        }
+    }
+    std::sort(weighted.begin(), weighted.end());
+    double target = std::min(std::max(q, 0.0), 1.0) * total;
+    uint64_t rank = 0;
+    for (auto& item : weighted) {
+        rank += item.second;
+        if (rank >= target) {
+            return std::min(std::max(item.first, _min), _max);
+        }
+    }
+    return _max;
+}
+
+}   // yosemite
@@ -0,0 +1,121 @@
+#include "utils/memory_timeline.h"
+
+#include <algorithm>
+
+namespace yosemite {
+
+MemoryTimeline::MemoryTimeline(uint32_t num_buckets, double peak_step)
+    : _peak_step(std::max(peak_step, 0.0)), _num_buckets(std::max(num_buckets, 2u)) {
+}
+
+
+void MemoryTimeline::record(uint64_t time, uint64_t before) {
+    while (time / _width >= _num_buckets) {
+        // halve the resolution: bucket i absorbs buckets 2i and 2i + 1
+        size_t merged = (_buckets.size() + 1) / 2;
+        for (size_t i = 0; i < merged; i++) {
+            UsageBucket_t bucket = _buckets[2 * i];
+            if (2 * i + 1 < _buckets.size()) {
+                bucket.min = std::min(bucket.min, _buckets[2 * i + 1].min);
+                bucket.max = std::max(bucket.max, _buckets[2 * i + 1].max);
+            }
+            bucket.start = i * _width * 2;
+            _buckets[i] = bucket;
+        }
+        _buckets.resize(merged);
+        _width *= 2;
+    }
+    // buckets without events held the usage from before
+    size_t index = time / _width;
+    while (_buckets.size() <= index) {
+        _buckets.push_back(UsageBucket_t{_buckets.size() * _width, before, before});
+    }
+    UsageBucket_t& bucket = _buckets[index];
+    bucket.min = std::min(bucket.min, _usage);
+    bucket.max = std::max(bucket.max, _usage);
+}
+
+
+void MemoryTimeline::merge_pending(PeakDelta_t& peak) {
+    for (uint64_t seq : _pending_removed) {
+        // allocated after the previous peak and gone again: not part of either snapshot
+        if (peak.added.erase(seq) == 0) {
+            peak.removed.push_back(seq);
+        }
+    }
+    for (auto& it : _pending_added) {
+        peak.added.insert(it);
+    }
+    _pending_added.clear();
+    _pending_removed.clear();
+}
+
+
+void MemoryTimeline::alloc(DevPtr addr, uint64_t size, uint64_t time) {
+    uint64_t before = _usage;
+    LiveObject_t object{addr, size, _seq++, time};
+    auto it = _live.find(addr);
+    if (it != _live.end()) {
+        // a free we never saw, drop the stale object first
+        free(addr, time);
+        before = _usage;
+    }
+    _live.emplace(addr, object);
+    _pending_added.emplace(object.seq, object);
+    _usage += size;
+    record(time, before);
+
+    uint64_t last_peak = peak();
+    if (_usage <= last_peak) {
+        return;
+    }
+    if (!_peaks.empty() && _usage <= last_peak + (uint64_t)(last_peak * _peak_step)) {
+        PeakDelta_t& amended = _peaks.back();
+        merge_pending(amended);
+        amended.time = time;
+        amended.usage = _usage;
+        return;
+    }
+    _peaks.emplace_back();
+    PeakDelta_t& peak = _peaks.back();
+    peak.time = time;
+    peak.usage = _usage;
+    merge_pending(peak);
+}
+
+
+void MemoryTimeline::free(DevPtr addr, uint64_t time) {
+    auto it = _live.find(addr);
+    if (it == _live.end()) {
+        return;
+    }
+    uint64_t before = _usage;
+    uint64_t seq = it->second.seq;
+    _usage -= it->second.size;
+    _live.erase(it);
+    if (_pending_added.erase(seq) == 0) {
+        _pending_removed.push_back(seq);
+    }
+    record(time, before);
+}
+
+
+std::vector<LiveObject_t> MemoryTimeline::live_at_peak(size_t i) const {
+    std::map<uint64_t, LiveObject_t> live;
+    for (size_t p = 0; p <= i && p < _peaks.size(); p++) {
+        for (uint64_t seq : _peaks[p].removed) {
+            live.erase(seq);
+        }
+        for (auto& it : _peaks[p].added) {
+            live.insert(it);
+        }
+    }
+    std::vector<LiveObject_t> objects;
+    objects.reserve(live.size());
+    for (auto& it : live) {
+        objects.push_back(it.second);
+    }
+    return objects;
+}
+
+}   // yosemite
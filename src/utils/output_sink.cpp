@@ -0,0 +1,592 @@
+#include "utils/output_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define YOSEMITE_HAS_IO_URING 1
+#endif
+
+namespace yosemite {
+
+static uint64_t env_to_u64(const char* name, uint64_t default_value) {
+    const char* env = std::getenv(name);
+    if (env == nullptr) {
+        return default_value;
+    }
+    uint64_t value = std::strtoull(env, nullptr, 10);
+    return value > 0 ? value : default_value;
+}
+
+
+static int open_output_file(const std::string& filename) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", filename.c_str(), strerror(errno));
+    }
+    return fd;
+}
+
+
+static void write_file(const std::string& filename, const std::string& data) {
+    int fd = open_output_file(filename);
+    if (fd < 0) {
+        return;
+    }
+    uint64_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t ret = pwrite(fd, data.data() + offset, data.size() - offset, offset);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to write %s: %s\n", filename.c_str(), strerror(errno));
+            break;
+        }
+        offset += ret;
+    }
+    close(fd);
+}
+
+
+typedef struct WriteJob {
+    std::string filename;
+    std::string data;
+
+    WriteJob() = default;
+
+    WriteJob(const std::string& filename, std::string&& data)
+        : filename(filename), data(std::move(data)) {}
+} WriteJob_t;
+
+
+/**
+ * Writes on the calling thread. Kept for debugging and for
+ * comparing against the asynchronous backends.
+ */
+class SyncSink final : public OutputSink {
+public:
+    SyncSink() : OutputSink(OUTPUT_SINK_SYNC) {}
+
+    void submit(const std::string& filename, std::string&& data) override {
+        write_file(filename, data);
+    }
+
+    void drain() override {}
+};
+
+
+/**
+ * Pool of writer threads doing open/pwrite/close. The application thread
+ * only blocks when more than max_pending_bytes are queued.
+ */
+class PwriteSink final : public OutputSink {
+public:
+    PwriteSink(uint32_t num_threads, uint64_t max_pending_bytes)
+        : OutputSink(OUTPUT_SINK_PWRITE), _max_pending_bytes(max_pending_bytes) {
+        for (uint32_t i = 0; i < num_threads; i++) {
+            _workers.emplace_back(&PwriteSink::worker, this);
+        }
+    }
+
+    ~PwriteSink() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _job_cv.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    void submit(const std::string& filename, std::string&& data) override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock, [this] {
+            return _pending_bytes < _max_pending_bytes || _jobs.empty();
+        });
+        _pending_bytes += data.size();
+        _jobs.emplace_back(filename, std::move(data));
+        lock.unlock();
+        _job_cv.notify_one();
+    }
+
+    void drain() override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock, [this] { return _jobs.empty() && _busy == 0; });
+    }
+
+private:
+    void worker() {
+        while (true) {
+            WriteJob_t job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _job_cv.wait(lock, [this] { return _stop || !_jobs.empty(); });
+                if (_jobs.empty()) {
+                    return;
+                }
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+                _busy++;
+            }
+
+            write_file(job.filename, job.data);
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _pending_bytes -= job.data.size();
+                _busy--;
+            }
+            _done_cv.notify_all();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::deque<WriteJob_t> _jobs;
+    std::mutex _mutex;
+    std::condition_variable _job_cv;
+    std::condition_variable _done_cv;
+    uint64_t _max_pending_bytes;
+    uint64_t _pending_bytes = 0;
+    uint32_t _busy = 0;
+    bool _stop = false;
+};
+
+
+#ifdef YOSEMITE_HAS_IO_URING
+
+/**
+ * io_uring backend driven through the raw syscalls so that no liburing is
+ * needed at build time. A single ring thread opens files, copies their
+ * contents into a fixed pool of registered buffers and keeps at most
+ * queue_depth WRITE_FIXED requests in flight, submitting them in batches.
+ */
+class IoUringSink final : public OutputSink {
+public:
+    IoUringSink() : OutputSink(OUTPUT_SINK_IO_URING) {}
+
+    ~IoUringSink() {
+        if (_ring_fd < 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _job_cv.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        if (_sqes != nullptr) {
+            munmap(_sqes, _sqes_size);
+        }
+        if (_cq_ptr != nullptr && _cq_ptr != _sq_ptr) {
+            munmap(_cq_ptr, _cq_size);
+        }
+        if (_sq_ptr != nullptr) {
+            munmap(_sq_ptr, _sq_size);
+        }
+        close(_ring_fd);
+        for (auto buffer : _buffers) {
+            free(buffer);
+        }
+    }
+
+    // 0 on success, -errno otherwise
+    int init(uint32_t queue_depth, uint64_t buffer_size, uint64_t max_pending_bytes) {
+        _max_pending_bytes = max_pending_bytes;
+        _buffer_size = buffer_size;
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+        if (_ring_fd < 0) {
+            return -errno;
+        }
+
+        _sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+        }
+        _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+        if (_sq_ptr == MAP_FAILED) {
+            _sq_ptr = nullptr;
+            return -errno;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _cq_ptr = _sq_ptr;
+        } else {
+            _cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+            if (_cq_ptr == MAP_FAILED) {
+                _cq_ptr = nullptr;
+                return -errno;
+            }
+        }
+        _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = (io_uring_sqe*)mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+        if (_sqes == MAP_FAILED) {
+            _sqes = nullptr;
+            return -errno;
+        }
+
+        char* sq = (char*)_sq_ptr;
+        _sq_head = (uint32_t*)(sq + params.sq_off.head);
+        _sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+        _sq_mask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+        _sq_entries = params.sq_entries;
+        _sq_array = (uint32_t*)(sq + params.sq_off.array);
+        char* cq = (char*)_cq_ptr;
+        _cq_head = (uint32_t*)(cq + params.cq_off.head);
+        _cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+        _cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+        _cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // one registered buffer per in-flight write
+        std::vector<iovec> iovecs(params.sq_entries);
+        for (uint32_t i = 0; i < params.sq_entries; i++) {
+            void* buffer = nullptr;
+            int ret = posix_memalign(&buffer, 4096, _buffer_size);
+            if (ret != 0) {
+                return -ret;
+            }
+            _buffers.push_back((char*)buffer);
+            _free_buffers.push_back(i);
+            iovecs[i].iov_base = buffer;
+            iovecs[i].iov_len = _buffer_size;
+        }
+        _slots.resize(params.sq_entries);
+        // registration pins the buffers and may exceed RLIMIT_MEMLOCK,
+        // plain IORING_OP_WRITE works without it
+        _registered = syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_BUFFERS,
+                              iovecs.data(), iovecs.size()) == 0;
+
+        _thread = std::thread(&IoUringSink::ring_loop, this);
+        return 0;
+    }
+
+    void submit(const std::string& filename, std::string&& data) override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock, [this] {
+            return _pending_bytes < _max_pending_bytes || _pending_files == 0;
+        });
+        _pending_bytes += data.size();
+        _pending_files++;
+        _jobs.emplace_back(filename, std::move(data));
+        lock.unlock();
+        _job_cv.notify_one();
+    }
+
+    void drain() override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock, [this] { return _pending_files == 0; });
+    }
+
+private:
+    typedef struct OpenFile {
+        WriteJob_t job;
+        int fd = -1;
+        uint64_t submitted = 0;
+        uint32_t inflight = 0;
+    } OpenFile_t;
+
+    typedef struct Slot {
+        OpenFile_t* file;
+        uint64_t offset;
+        uint32_t len;
+        uint32_t done;
+    } Slot_t;
+
+    void release(uint64_t size) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending_bytes -= size;
+            _pending_files--;
+        }
+        _done_cv.notify_all();
+    }
+
+    void finish_file(std::list<OpenFile_t>::iterator it) {
+        if (it->fd >= 0) {
+            close(it->fd);
+        }
+        uint64_t size = it->job.data.size();
+        _files.erase(it);
+        release(size);
+    }
+
+    /**
+     * The ring is unusable: rewrite every file it still holds with pwrite and
+     * send all later jobs the same way. Whole files are rewritten, a write
+     * still completing in the kernel only puts the same bytes at the same offset.
+     */
+    void fail_over(std::deque<WriteJob_t>& local) {
+        _failed = true;
+        while (!_files.empty()) {
+            write_file(_files.front().job.filename, _files.front().job.data);
+            finish_file(_files.begin());
+        }
+        _cur = nullptr;
+        _inflight = 0;
+        _to_submit = 0;
+        write_local(local);
+    }
+
+    void write_local(std::deque<WriteJob_t>& local) {
+        while (!local.empty()) {
+            WriteJob_t job = std::move(local.front());
+            local.pop_front();
+            write_file(job.filename, job.data);
+            release(job.data.size());
+        }
+    }
+
+    void try_finish(OpenFile_t* file) {
+        if (file->inflight > 0 || file->submitted < file->job.data.size()) {
+            return;
+        }
+        if (_cur == file) {
+            _cur = nullptr;
+        }
+        for (auto it = _files.begin(); it != _files.end(); ++it) {
+            if (&*it == file) {
+                finish_file(it);
+                return;
+            }
+        }
+    }
+
+    void queue_write(uint32_t buffer_index) {
+        Slot_t& slot = _slots[buffer_index];
+        uint32_t tail = *_sq_tail;
+        uint32_t index = tail & _sq_mask;
+        io_uring_sqe* sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = _registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = slot.file->fd;
+        sqe->off = slot.offset + slot.done;
+        sqe->addr = (uint64_t)(_buffers[buffer_index] + slot.done);
+        sqe->len = slot.len - slot.done;
+        sqe->buf_index = _registered ? buffer_index : 0;
+        sqe->user_data = buffer_index;
+        _sq_array[index] = index;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        _to_submit++;
+    }
+
+    // Cut queued files into buffer-sized chunks while buffers are available.
+    void prepare_writes(std::deque<WriteJob_t>& local) {
+        while (!_free_buffers.empty()) {
+            if (_cur == nullptr) {
+                if (local.empty()) {
+                    return;
+                }
+                _files.emplace_back();
+                _cur = &_files.back();
+                _cur->job = std::move(local.front());
+                local.pop_front();
+                _cur->fd = open_output_file(_cur->job.filename);
+                if (_cur->fd < 0) {
+                    _cur->submitted = _cur->job.data.size();
+                }
+                if (_cur->job.data.empty() || _cur->fd < 0) {
+                    try_finish(_cur);
+                    continue;
+                }
+            }
+
+            uint32_t buffer_index = _free_buffers.back();
+            _free_buffers.pop_back();
+            uint64_t len = std::min(_buffer_size, _cur->job.data.size() - _cur->submitted);
+            memcpy(_buffers[buffer_index], _cur->job.data.data() + _cur->submitted, len);
+            _slots[buffer_index] = {_cur, _cur->submitted, (uint32_t)len, 0};
+            _cur->submitted += len;
+            _cur->inflight++;
+            _inflight++;
+            queue_write(buffer_index);
+            if (_cur->submitted == _cur->job.data.size()) {
+                _cur = nullptr;
+            }
+        }
+    }
+
+    void reap() {
+        uint32_t head = *_cq_head;
+        uint32_t tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe* cqe = &_cqes[head & _cq_mask];
+            uint32_t buffer_index = cqe->user_data;
+            int32_t res = cqe->res;
+            head++;
+
+            Slot_t& slot = _slots[buffer_index];
+            if (res > 0 && slot.done + res < slot.len) {
+                // short write, send the remainder from the same buffer
+                slot.done += res;
+                queue_write(buffer_index);
+                continue;
+            }
+            if (res < 0) {
+                fprintf(stderr, "Failed to write %s: %s\n",
+                        slot.file->job.filename.c_str(), strerror(-res));
+            }
+            OpenFile_t* file = slot.file;
+            file->inflight--;
+            _inflight--;
+            _free_buffers.push_back(buffer_index);
+            try_finish(file);
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    void ring_loop() {
+        std::deque<WriteJob_t> local;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (local.empty() && _cur == nullptr && _inflight == 0) {
+                    _job_cv.wait(lock, [this] { return _stop || !_jobs.empty(); });
+                    if (_jobs.empty()) {
+                        return;
+                    }
+                }
+                while (!_jobs.empty()) {
+                    local.push_back(std::move(_jobs.front()));
+                    _jobs.pop_front();
+                }
+            }
+
+            if (_failed) {
+                write_local(local);
+                continue;
+            }
+            prepare_writes(local);
+
+            uint32_t wait_nr = (_inflight > 0 && (_free_buffers.empty()
+                                || (local.empty() && _cur == nullptr))) ? 1 : 0;
+            if (_to_submit > 0 || wait_nr > 0) {
+                int ret = syscall(__NR_io_uring_enter, _ring_fd, _to_submit, wait_nr,
+                                  wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (ret >= 0) {
+                    _to_submit -= std::min((uint32_t)ret, _to_submit);
+                } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    fprintf(stderr, "io_uring_enter failed: %s, falling back to pwrite.\n", strerror(errno));
+                    fail_over(local);
+                    continue;
+                }
+            }
+            reap();
+        }
+    }
+
+    int _ring_fd = -1;
+    void* _sq_ptr = nullptr;
+    void* _cq_ptr = nullptr;
+    size_t _sq_size = 0;
+    size_t _cq_size = 0;
+    size_t _sqes_size = 0;
+    uint32_t* _sq_head = nullptr;
+    uint32_t* _sq_tail = nullptr;
+    uint32_t* _sq_array = nullptr;
+    uint32_t _sq_mask = 0;
+    uint32_t _sq_entries = 0;
+    uint32_t* _cq_head = nullptr;
+    uint32_t* _cq_tail = nullptr;
+    uint32_t _cq_mask = 0;
+    io_uring_sqe* _sqes = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+    bool _registered = false;
+
+    // owned by the ring thread
+    std::vector<char*> _buffers;
+    std::vector<uint32_t> _free_buffers;
+    std::vector<Slot_t> _slots;
+    std::list<OpenFile_t> _files;
+    OpenFile_t* _cur = nullptr;
+    uint64_t _buffer_size = 0;
+    uint32_t _inflight = 0;
+    uint32_t _to_submit = 0;
+    bool _failed = false;
+
+    // shared with the application thread
+    std::thread _thread;
+    std::deque<WriteJob_t> _jobs;
+    std::mutex _mutex;
+    std::condition_variable _job_cv;
+    std::condition_variable _done_cv;
+    uint64_t _max_pending_bytes = 0;
+    uint64_t _pending_bytes = 0;
+    uint64_t _pending_files = 0;
+    bool _stop = false;
+};
+
+#endif  // YOSEMITE_HAS_IO_URING
+
+
+const char* output_sink_name(OutputSinkType_t type) {
+    switch (type) {
+        case OUTPUT_SINK_SYNC:
+            return "sync";
+        case OUTPUT_SINK_PWRITE:
+            return "pwrite";
+        case OUTPUT_SINK_IO_URING:
+            return "io_uring";
+        default:
+            return "unknown";
+    }
+}
+
+
+std::shared_ptr<OutputSink> create_output_sink() {
+    const char* env_sink = std::getenv("YOSEMITE_OUTPUT_SINK");
+    std::string sink_name = env_sink ? std::string(env_sink) : "io_uring";
+
+    uint64_t max_pending_bytes = env_to_u64("YOSEMITE_SINK_MAX_PENDING_MB", 512) << 20;
+    std::shared_ptr<OutputSink> sink;
+    if (sink_name == "sync") {
+        sink = std::make_shared<SyncSink>();
+    }
+#ifdef YOSEMITE_HAS_IO_URING
+    if (!sink && sink_name == "io_uring") {
+        auto ring = std::make_shared<IoUringSink>();
+        int ret = ring->init(env_to_u64("YOSEMITE_SINK_QUEUE_DEPTH", 32),
+                             env_to_u64("YOSEMITE_SINK_BUFFER_KB", 256) << 10,
+                             max_pending_bytes);
+        if (ret == 0) {
+            sink = ring;
+        } else {
+            fprintf(stdout, "io_uring unavailable (%s), falling back to pwrite.\n",
+                    strerror(-ret));
+        }
+    }
+#endif
+    if (!sink) {
+        sink = std::make_shared<PwriteSink>(env_to_u64("YOSEMITE_SINK_THREADS", 2),
+                                            max_pending_bytes);
+    }
+    fprintf(stdout, "Using %s output sink.\n", output_sink_name(sink->type()));
+    fflush(stdout);
+    return sink;
+}
+
+}   // yosemite
@@ -0,0 +1,94 @@
+#include "utils/space_saving.h"
+
+#include <algorithm>
+
+namespace yosemite {
+
+SpaceSaving::SpaceSaving(uint32_t capacity) : _capacity(std::max(capacity, 1u)) {
+    _heap.reserve(_capacity);
+    _position.reserve(_capacity);
+}
+
+
+void SpaceSaving::clear() {
+    _heap.clear();
+    _position.clear();
+    _total = 0;
+}
+
+
+void SpaceSaving::add(uint64_t key, uint64_t weight) {
+    _total += weight;
+    uint32_t* pos = _position.find(key);
+    if (pos != nullptr) {
+        uint32_t i = *pos;
+        _heap[i].count += weight;
+        sift_down(i);
+        return;
+    }
+    if (_heap.size() < _capacity) {
+        _heap.push_back(Counter_t{key, weight, 0});
+        _position[key] = _heap.size() - 1;
+        sift_up(_heap.size() - 1);
+        return;
+    }
+    // evict the lightest counter, the newcomer may have been counted under it
+    Counter_t& min = _heap[0];
+    _position.erase(min.key);
+    min.error = min.count;
+    min.count += weight;
+    min.key = key;
+    _position[key] = 0;
+    sift_down(0);
+}
+
+
+std::vector<SpaceSaving::Counter_t> SpaceSaving::top() const {
+    std::vector<Counter_t> counters(_heap);
+    std::sort(counters.begin(), counters.end(), [](const Counter_t& a, const Counter_t& b) {
+        return a.count > b.count || (a.count == b.count && a.key < b.key);
+    });
+    return counters;
+}
+
+
+void SpaceSaving::swap_counters(uint32_t i, uint32_t j) {
+    std::swap(_heap[i], _heap[j]);
+    _position[_heap[i].key] = i;
+    _position[_heap[j].key] = j;
+}
+
+
+void SpaceSaving::sift_up(uint32_t i) {
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (_heap[parent].count <= _heap[i].count) {
+            break;
+        }
+        swap_counters(i, parent);
+        i = parent;
+    }
+}
+
+
+void SpaceSaving::sift_down(uint32_t i) {
+    uint32_t n = _heap.size();
+    while (true) {
+        uint32_t smallest = i;
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        if (left < n && _heap[left].count < _heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < n && _heap[right].count < _heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        swap_counters(i, smallest);
+        i = smallest;
+    }
+}
+
+}   // yosemite
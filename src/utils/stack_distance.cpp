@@ -0,0 +1,201 @@
+#include "utils/stack_distance.h"
+#include "utils/fast_hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace yosemite {
+
+static constexpr uint64_t SHARDS_MODULUS = 1ULL << 24;
+static constexpr uint64_t MIN_CAPACITY = 1ULL << 16;
+static constexpr uint64_t NO_OWNER = UINT64_MAX;
+
+
+StackDistance::StackDistance(double sampling_rate, uint64_t max_tracked)
+    : _capacity(MIN_CAPACITY), _max_tracked(max_tracked) {
+    sampling_rate = std::min(std::max(sampling_rate, 1.0 / SHARDS_MODULUS), 1.0);
+    _threshold = (uint64_t)std::llround(sampling_rate * SHARDS_MODULUS);
+    _initial_threshold = _threshold;
+    _tree.assign(_capacity + 1, 0);
+    _owner.assign(_capacity, NO_OWNER);
+}
+
+
+void StackDistance::reset() {
+    _last.clear();
+    _threshold = _initial_threshold;
+    // clear in place what the last run used and keep the capacity: owners are set
+    // below _now only, and the tree nodes covering them are [1, _now] plus the
+    // update path of _now
+    uint64_t used = std::min(_now, _capacity);
+    std::fill(_owner.begin(), _owner.begin() + used, NO_OWNER);
+    std::fill(_tree.begin(), _tree.begin() + used + 1, 0);
+    for (uint64_t pos = used; pos > 0 && pos <= _capacity; pos += pos & (~pos + 1)) {
+        _tree[pos] = 0;
+    }
+    _now = 0;
+}
+
+
+double StackDistance::rate() const {
+    return (double)_threshold / SHARDS_MODULUS;
+}
+
+
+uint64_t StackDistance::prefix(uint64_t pos) const {
+    // number of marks in [0, pos)
+    int64_t sum = 0;
+    for (; pos > 0; pos &= pos - 1) {
+        sum += _tree[pos];
+    }
+    return sum;
+}
+
+
+void StackDistance::update(uint64_t pos, int32_t delta) {
+    for (pos++; pos <= _capacity; pos += pos & (~pos + 1)) {
+        _tree[pos] += delta;
+    }
+}
+
+
+void StackDistance::compact() {
+    // renumber live marks to 0..n-1 keeping their order
+    uint64_t n = 0;
+    for (uint64_t pos = 0; pos < _now; pos++) {
+        if (_owner[pos] != NO_OWNER) {
+            _owner[n] = _owner[pos];
+            _last[_owner[n]] = n;
+            n++;
+        }
+    }
+
+    uint64_t capacity = MIN_CAPACITY;
+    while (capacity < 2 * n) {
+        capacity <<= 1;
+    }
+    _capacity = capacity;
+    _owner.resize(_capacity);
+    std::fill(_owner.begin() + n, _owner.end(), NO_OWNER);
+
+    // linear Fenwick build
+    _tree.assign(_capacity + 1, 0);
+    for (uint64_t i = 1; i <= n; i++) {
+        _tree[i] += 1;
+    }
+    for (uint64_t i = 1; i <= _capacity; i++) {
+        uint64_t parent = i + (i & (~i + 1));
+        if (parent <= _capacity) {
+            _tree[parent] += _tree[i];
+        }
+    }
+    _now = n;
+}
+
+
+void StackDistance::shrink_sample() {
+    // drop the blocks with the largest hashes until 7/8 of the budget is left
+    std::vector<uint64_t> hashes;
+    hashes.reserve(_last.size());
+    for (auto& it : _last) {
+        hashes.push_back(mix64(it.first) & (SHARDS_MODULUS - 1));
+    }
+    uint64_t keep = _max_tracked - _max_tracked / 8;
+    std::nth_element(hashes.begin(), hashes.begin() + keep, hashes.end());
+    _threshold = std::max<uint64_t>(hashes[keep], 1);
+
+    for (auto it = _last.begin(); it != _last.end();) {
+        if ((mix64(it->first) & (SHARDS_MODULUS - 1)) >= _threshold) {
+            update(it->second, -1);
+            _owner[it->second] = NO_OWNER;
+            it = _last.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+uint64_t StackDistance::access(uint64_t block) {
+    if (_threshold < SHARDS_MODULUS
+        && (mix64(block) & (SHARDS_MODULUS - 1)) >= _threshold) {
+        return SKIPPED;
+    }
+
+    uint64_t distance = COLD;
+    auto it = _last.find(block);
+    if (it == _last.end()) {
+        _last.emplace(block, _now);
+    } else {
+        uint64_t pos = it->second;
+        distance = _last.size() - prefix(pos + 1);
+        update(pos, -1);
+        _owner[pos] = NO_OWNER;
+        it->second = _now;
+        if (_threshold < SHARDS_MODULUS) {
+            distance = (uint64_t)(distance * ((double)SHARDS_MODULUS / _threshold));
+        }
+    }
+    update(_now, 1);
+    _owner[_now] = block;
+    _now++;
+
+    if (_max_tracked > 0 && _last.size() > _max_tracked) {
+        shrink_sample();
+    }
+    if (_now == _capacity) {
+        compact();
+    }
+    return distance;
+}
+
+
+void ReuseHistogram::add(uint64_t distance, double weight) {
+    if (distance == StackDistance::SKIPPED) {
+        return;
+    }
+    total += weight;
+    if (distance == StackDistance::COLD) {
+        cold += weight;
+    } else {
+        buckets[distance == 0 ? 0 : 64 - __builtin_clzll(distance)] += weight;
+    }
+}
+
+
+void ReuseHistogram::merge(const ReuseHistogram& other) {
+    for (uint32_t k = 0; k < NUM_BUCKETS; k++) {
+        buckets[k] += other.buckets[k];
+    }
+    cold += other.cold;
+    total += other.total;
+}
+
+
+double ReuseHistogram::miss_ratio(uint64_t capacity) const {
+    if (total == 0) {
+        return 0.0;
+    }
+    // hits are distances < capacity
+    double hits = 0;
+    for (uint32_t k = 0; k < NUM_BUCKETS; k++) {
+        uint64_t upper = k == 0 ? 1 : (k >= 64 ? UINT64_MAX : 1ULL << k);
+        if (upper > capacity) {
+            break;
+        }
+        hits += buckets[k];
+    }
+    return 1.0 - hits / total;
+}
+
+
+uint32_t ReuseHistogram::max_bucket() const {
+    for (uint32_t k = NUM_BUCKETS; k > 0; k--) {
+        if (buckets[k - 1] > 0) {
+            return k - 1;
+        }
+    }
+    return 0;
+}
+
+}   // yosemite
@@ -0,0 +1,124 @@
+#include "utils/thread_pool.h"
+
+#include <cstdlib>
+
+namespace yosemite {
+
+static thread_local ThreadPool* tls_pool = nullptr;
+static thread_local uint32_t tls_index = 0;
+
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        _queues.emplace_back(new WorkerQueue_t());
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        _workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _work_cv.notify_all();
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+}
+
+
+void ThreadPool::submit(Task task) {
+    uint32_t index;
+    if (tls_pool == this) {
+        index = tls_index;
+    } else {
+        index = _next_queue.fetch_add(1, std::memory_order_relaxed) % _queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _unfinished++;
+        _queued.fetch_add(1, std::memory_order_release);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(task));
+    }
+    _work_cv.notify_one();
+}
+
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cv.wait(lock, [this] { return _unfinished == 0; });
+}
+
+
+bool ThreadPool::pop_task(uint32_t index, Task& task) {
+    {
+        WorkerQueue_t& own = *_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (uint32_t i = 1; i < _queues.size(); i++) {
+        WorkerQueue_t& victim = *_queues[(index + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void ThreadPool::worker_loop(uint32_t index) {
+    tls_pool = this;
+    tls_index = index;
+    while (true) {
+        Task task;
+        if (pop_task(index, task)) {
+            _queued.fetch_sub(1, std::memory_order_acq_rel);
+            task();
+            bool done;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                done = --_unfinished == 0;
+            }
+            if (done) {
+                _done_cv.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _work_cv.wait(lock, [this] {
+            return _stop || _queued.load(std::memory_order_acquire) > 0;
+        });
+        if (_stop && _queued.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+    }
+}
+
+
+uint32_t default_thread_count(const char* env_name) {
+    const char* env = std::getenv(env_name);
+    if (env != nullptr) {
+        return std::strtoul(env, nullptr, 10);
+    }
+    uint32_t hw = std::thread::hardware_concurrency();
+    return hw > 1 ? hw / 2 : 1;
+}
+
+}   // yosemite
@@ -0,0 +1,192 @@
+#include "utils/touch_reduce.h"
+#include "utils/helper.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YOSEMITE_X86 1
+#endif
+
+namespace yosemite {
+
+typedef TouchSummary_t (*TouchReduceFn)(const uint64_t*, const uint32_t*, uint32_t, uint64_t*);
+
+
+// ranges [from, n), bitmap words from / 64 on must start out cleared
+static void touch_reduce_tail(const uint64_t* start_end, const uint32_t* touch, uint32_t from, uint32_t n,
+                              uint64_t* bitmap, TouchSummary_t& summary) {
+    for (uint32_t i = from; i < n; i++) {
+        if (touch[i] == 0) {
+            continue;
+        }
+        summary.objects++;
+        summary.bytes += start_end[2 * i + 1] - start_end[2 * i];
+        summary.touches += touch[i];
+        if (bitmap != nullptr) {
+            bitmap[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
+
+static TouchSummary_t touch_reduce_scalar(const uint64_t* start_end, const uint32_t* touch, uint32_t n,
+                                          uint64_t* bitmap) {
+    TouchSummary_t summary;
+    if (bitmap != nullptr) {
+        for (uint32_t w = 0; w < (n + 63) / 64; w++) {
+            bitmap[w] = 0;
+        }
+    }
+    touch_reduce_tail(start_end, touch, 0, n, bitmap, summary);
+    return summary;
+}
+
+
+#ifdef YOSEMITE_X86
+
+__attribute__((target("avx2")))
+static uint64_t hsum_avx2(__m256i v) {
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return (uint64_t)_mm_cvtsi128_si64(sum) + (uint64_t)_mm_extract_epi64(sum, 1);
+}
+
+
+__attribute__((target("avx2")))
+static TouchSummary_t touch_reduce_avx2(const uint64_t* start_end, const uint32_t* touch, uint32_t n,
+                                        uint64_t* bitmap) {
+    TouchSummary_t summary;
+    __m256i bytes = _mm256_setzero_si256();
+    __m256i touches = _mm256_setzero_si256();
+    __m256i zero = _mm256_setzero_si256();
+    uint64_t word = 0;
+    uint32_t i = 0;
+    // four ranges per step
+    for (; i + 4 <= n; i += 4) {
+        __m256i t = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(touch + i)));
+        __m256i untouched = _mm256_cmpeq_epi64(t, zero);
+        uint32_t mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(untouched)) & 0xf;
+        if (mask == 0) {
+            if (i % 64 == 60 && bitmap != nullptr) {
+                bitmap[i / 64] = word;
+                word = 0;
+            }
+            continue;
+        }
+        __m256i a = _mm256_loadu_si256((const __m256i*)(start_end + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(start_end + 2 * i + 4));
+        // unpack gives ranges in 0, 2, 1, 3 order, put them back in order
+        __m256i size = _mm256_sub_epi64(_mm256_unpackhi_epi64(a, b), _mm256_unpacklo_epi64(a, b));
+        size = _mm256_permute4x64_epi64(size, _MM_SHUFFLE(3, 1, 2, 0));
+        bytes = _mm256_add_epi64(bytes, _mm256_andnot_si256(untouched, size));
+        touches = _mm256_add_epi64(touches, t);
+        summary.objects += __builtin_popcount(mask);
+        word |= (uint64_t)mask << (i % 64);
+        if (i % 64 == 60 && bitmap != nullptr) {
+            bitmap[i / 64] = word;
+            word = 0;
+        }
+    }
+    if (bitmap != nullptr) {
+        for (uint32_t w = i / 64; w < (n + 63) / 64; w++) {
+            bitmap[w] = 0;
+        }
+        if (i % 64 != 0) {
+            bitmap[i / 64] = word;
+        }
+    }
+    summary.bytes = hsum_avx2(bytes);
+    summary.touches = hsum_avx2(touches);
+    touch_reduce_tail(start_end, touch, i, n, bitmap, summary);
+    return summary;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t hsum_avx512(__m512i v) {
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512((void*)lanes, v);
+    uint64_t sum = 0;
+    for (int k = 0; k < 8; k++) {
+        sum += lanes[k];
+    }
+    return sum;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static TouchSummary_t touch_reduce_avx512(const uint64_t* start_end, const uint32_t* touch, uint32_t n,
+                                          uint64_t* bitmap) {
+    TouchSummary_t summary;
+    __m512i bytes = _mm512_setzero_si512();
+    __m512i touches = _mm512_setzero_si512();
+    const __m512i start_index = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i end_index = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+    uint64_t word = 0;
+    uint32_t i = 0;
+    // eight ranges per step
+    for (; i + 8 <= n; i += 8) {
+        __m512i t = _mm512_maskz_cvtepu32_epi64(0xff, _mm256_loadu_si256((const __m256i*)(touch + i)));
+        __mmask8 mask = _mm512_test_epi64_mask(t, t);
+        if (mask != 0) {
+            __m512i a = _mm512_loadu_si512((const void*)(start_end + 2 * i));
+            __m512i b = _mm512_loadu_si512((const void*)(start_end + 2 * i + 8));
+            __m512i size = _mm512_sub_epi64(_mm512_permutex2var_epi64(a, end_index, b),
+                                            _mm512_permutex2var_epi64(a, start_index, b));
+            bytes = _mm512_mask_add_epi64(bytes, mask, bytes, size);
+            touches = _mm512_add_epi64(touches, t);
+            summary.objects += __builtin_popcount(mask);
+            word |= (uint64_t)mask << (i % 64);
+        }
+        if (i % 64 == 56 && bitmap != nullptr) {
+            bitmap[i / 64] = word;
+            word = 0;
+        }
+    }
+    if (bitmap != nullptr) {
+        for (uint32_t w = i / 64; w < (n + 63) / 64; w++) {
+            bitmap[w] = 0;
+        }
+        if (i % 64 != 0) {
+            bitmap[i / 64] = word;
+        }
+    }
+    summary.bytes = hsum_avx512(bytes);
+    summary.touches = hsum_avx512(touches);
+    touch_reduce_tail(start_end, touch, i, n, bitmap, summary);
+    return summary;
+}
+
+#endif  // YOSEMITE_X86
+
+
+typedef struct TouchReduceImpl {
+    const char* isa;
+    TouchReduceFn reduce;
+} TouchReduceImpl_t;
+
+
+static TouchReduceImpl_t select_touch_reduce() {
+#ifdef YOSEMITE_X86
+    if (cpu_supports_avx512()) {
+        return {"avx512", touch_reduce_avx512};
+    }
+    if (cpu_supports_avx2()) {
+        return {"avx2", touch_reduce_avx2};
+    }
+#endif
+    return {"scalar", touch_reduce_scalar};
+}
+
+static const TouchReduceImpl_t impl = select_touch_reduce();
+
+
+TouchSummary_t touch_reduce(const uint64_t* start_end, const uint32_t* touch, uint32_t n,
+                            uint64_t* bitmap) {
+    return impl.reduce(start_end, touch, n, bitmap);
+}
+
+
+const char* touch_reduce_isa() {
+    return impl.isa;
+}
+
+}   // yosemite
@@ -0,0 +1,110 @@
+#include "utils/trace_reader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace yosemite {
+
+static size_t find_allocation(const std::vector<std::pair<DevPtr, uint64_t>>& allocations,
+                              uint64_t addr) {
+    auto it = std::upper_bound(allocations.begin(), allocations.end(),
+                               std::make_pair(addr, UINT64_MAX));
+    if (it == allocations.begin()) {
+        return allocations.size();
+    }
+    size_t rank = it - allocations.begin() - 1;
+    if (addr >= allocations[rank].first + allocations[rank].second) {
+        return allocations.size();
+    }
+    return rank;
+}
+
+
+static bool parse_kernel_trace(const std::string& filename, KernelTrace_t& trace) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        fprintf(stderr, "Failed to open %s\n", filename.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream fields(line);
+        if (line.compare(0, 11, "ALLOCATION:") == 0) {
+            std::string tag;
+            std::pair<DevPtr, uint64_t> mem;
+            fields >> tag >> mem.first >> mem.second;
+            trace.allocations.push_back(mem);
+        } else if (line.compare(0, 7, "TENSOR:") == 0) {
+            std::string tag;
+            std::pair<DevPtr, uint64_t> ten;
+            fields >> tag >> ten.first >> ten.second;
+            trace.tensors.push_back(ten);
+        } else if (line.compare(0, 7, "KERNEL:") == 0) {
+            std::string tag;
+            fields >> tag >> trace.start_time >> trace.end_time;
+        } else if (line.compare(0, 9, "SAMPLING:") == 0) {
+            std::string tag;
+            fields >> tag >> trace.sampling_seen_accesses >> trace.sampling_kept_accesses
+                   >> trace.sampling_warp_rate >> trace.sampling_spatial_rate;
+            trace.is_sampled = true;
+        } else if (line.compare(0, 10, "REFERENCE:") == 0) {
+            std::string tag;
+            std::string fingerprint;
+            fields >> tag >> trace.reference_kernel_id >> fingerprint
+                   >> trace.reference_timer_base >> trace.reference_accesses;
+            trace.is_reference = true;
+        } else {
+            TraceRecord_t record;
+            fields >> record.page >> record.address >> record.access_size
+                   >> record.timer >> record.flags >> record.warp_id;
+            if (!fields.fail()) {
+                trace.records.push_back(record);
+            }
+        }
+    }
+    std::sort(trace.allocations.begin(), trace.allocations.end());
+    return true;
+}
+
+
+bool read_kernel_trace(const std::string& directory, uint32_t kernel_id,
+                       KernelTrace_t& trace, bool expand) {
+    std::string filename = directory + "/kernel_" + std::to_string(kernel_id) + ".txt";
+    trace = KernelTrace_t();
+    if (!parse_kernel_trace(filename, trace)) {
+        return false;
+    }
+    if (!trace.is_reference || !expand) {
+        return true;
+    }
+
+    KernelTrace_t original;
+    std::string original_filename = directory + "/kernel_"
+                                    + std::to_string(trace.reference_kernel_id) + ".txt";
+    if (!parse_kernel_trace(original_filename, original) || original.is_reference) {
+        fprintf(stderr, "Cannot expand reference in %s\n", filename.c_str());
+        return false;
+    }
+
+    // access timers of one kernel are consecutive, starting right after the base
+    uint64_t original_base = original.records.empty() ? 0 : original.records[0].timer - 1;
+    trace.records.reserve(original.records.size());
+    for (auto record : original.records) {
+        size_t rank = find_allocation(original.allocations, record.address);
+        if (rank < original.allocations.size() && rank < trace.allocations.size()) {
+            record.address = trace.allocations[rank].first
+                             + (record.address - original.allocations[rank].first);
+            record.page = record.address >> 12;
+        }
+        record.timer = trace.reference_timer_base + (record.timer - original_base);
+        trace.records.push_back(record);
+    }
+    return true;
+}
+
+}   // yosemite
@@ -0,0 +1,373 @@
+#include "utils/uvm_simulator.h"
+#include "utils/fast_hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace yosemite {
+
+static constexpr uint32_t NO_KERNEL = UINT32_MAX;
+
+typedef enum {
+    PAGE_ABSENT = 0,
+    PAGE_RESIDENT = 1,
+    PAGE_EVICTED = 2,
+    PAGE_RELEASED = 3
+} PageState_t;
+
+typedef struct HeapEntry {
+    uint64_t key;
+    uint32_t page;
+    uint32_t version;
+
+    // ties go to the lower page id, so that replays are deterministic
+    bool operator>(const HeapEntry& other) const {
+        return key != other.key ? key > other.key : page > other.page;
+    }
+} HeapEntry_t;
+
+
+UvmSimulator::UvmSimulator(uint64_t page_size) {
+    _page_shift = 63 - __builtin_clzll(std::max<uint64_t>(page_size, 1));
+    _page_size = 1ULL << _page_shift;
+    _set_offsets.push_back(0);
+}
+
+
+void UvmSimulator::alloc(DevPtr addr, uint64_t size) {
+    if (size == 0) {
+        return;
+    }
+    uint32_t id = _index.find(addr);
+    if (id != AddressIndex::NONE && _allocations[id].addr == addr) {
+        return;
+    }
+    Allocation_t allocation;
+    allocation.addr = addr;
+    allocation.first_page = addr >> _page_shift;
+    allocation.first_id = _num_pages;
+    allocation.pages = ((addr + size - 1) >> _page_shift) - allocation.first_page + 1;
+    _num_pages += allocation.pages;
+    _live_pages += allocation.pages;
+    _peak_pages = std::max(_peak_pages, _live_pages);
+    _index.insert(addr, size, _allocations.size());
+    _allocations.push_back(allocation);
+    _page_stamps.resize(_num_pages, 0);
+}
+
+
+void UvmSimulator::free(DevPtr addr) {
+    uint32_t id = _index.find(addr);
+    if (id == AddressIndex::NONE || _allocations[id].addr != addr) {
+        return;
+    }
+    const Allocation_t& allocation = _allocations[id];
+    // a launch still open has already run
+    uint32_t kernel = _kernel_sets.size() + (_in_kernel ? 1 : 0);
+    _releases.push_back(Release_t{kernel, PageRun_t{allocation.first_id, allocation.pages}});
+    _live_pages -= allocation.pages;
+    _index.erase(addr);
+}
+
+
+void UvmSimulator::kernel_start(uint32_t name) {
+    kernel_end();
+    _kernel_names.push_back(name);
+    _in_kernel = true;
+}
+
+
+void UvmSimulator::touch(DevPtr start, DevPtr end) {
+    if (!_in_kernel || end <= start) {
+        return;
+    }
+    uint32_t id = _index.find(start);
+    if (id == AddressIndex::NONE) {
+        return;
+    }
+    const Allocation_t& allocation = _allocations[id];
+    uint64_t last_page = allocation.first_page + allocation.pages - 1;
+    uint32_t first = allocation.first_id + ((start >> _page_shift) - allocation.first_page);
+    uint32_t last = allocation.first_id + (std::min((end - 1) >> _page_shift, last_page) - allocation.first_page);
+    // every page enters _current once per launch, however many accesses hit it;
+    // ranges mostly arrive in address order, extend the previous run when possible
+    uint32_t stamp = _kernel_sets.size() + 1;
+    for (uint32_t page = first; page <= last; page++) {
+        if (_page_stamps[page] == stamp) {
+            continue;
+        }
+        _page_stamps[page] = stamp;
+        if (!_current.empty() && _current.back().first + _current.back().count == page) {
+            _current.back().count++;
+        } else {
+            _current.push_back(PageRun_t{page, 1});
+        }
+    }
+}
+
+
+void UvmSimulator::kernel_end() {
+    if (!_in_kernel) {
+        return;
+    }
+    _kernel_sets.push_back(intern_set());
+    _current.clear();
+    _in_kernel = false;
+}
+
+
+uint32_t UvmSimulator::intern_set() {
+    std::sort(_current.begin(), _current.end(), [](const PageRun_t& a, const PageRun_t& b) {
+        return a.first < b.first;
+    });
+    size_t merged = 0;
+    for (size_t i = 0; i < _current.size(); i++) {
+        if (merged > 0 && _current[i].first <= _current[merged - 1].first + _current[merged - 1].count) {
+            PageRun_t& back = _current[merged - 1];
+            back.count = std::max(back.count, _current[i].first + _current[i].count - back.first);
+        } else {
+            _current[merged++] = _current[i];
+        }
+    }
+    _current.resize(merged);
+
+    uint64_t hash = fast_hash64(_current.data(), _current.size() * sizeof(PageRun_t));
+    uint32_t* known = _set_ids.find(hash);
+    if (known != nullptr) {
+        uint64_t begin = _set_offsets[*known];
+        uint64_t end = _set_offsets[*known + 1];
+        if (end - begin == _current.size()
+            && std::equal(_current.begin(), _current.end(), _set_runs.begin() + begin,
+                          [](const PageRun_t& a, const PageRun_t& b) {
+                              return a.first == b.first && a.count == b.count;
+                          })) {
+            return *known;
+        }
+    }
+    uint32_t set = _set_offsets.size() - 1;
+    _set_runs.insert(_set_runs.end(), _current.begin(), _current.end());
+    _set_offsets.push_back(_set_runs.size());
+    if (known == nullptr) {
+        _set_ids[hash] = set;
+    }
+    return set;
+}
+
+
+UvmResult_t UvmSimulator::simulate(UvmPolicy_t policy, uint64_t capacity_pages) const {
+    UvmResult_t result;
+    result.policy = policy;
+    result.capacity_pages = std::max<uint64_t>(capacity_pages, 1);
+    uint32_t num_names = 0;
+    for (uint32_t name : _kernel_names) {
+        num_names = std::max(num_names, name + 1);
+    }
+    result.name_refaults.assign(num_names, 0);
+    result.name_thrashing_launches.assign(num_names, 0);
+
+    std::vector<uint8_t> state(_num_pages, PAGE_ABSENT);
+    std::vector<uint32_t> version(_num_pages, 0);
+    std::vector<uint32_t> last_kernel(_num_pages, NO_KERNEL);
+    std::vector<uint32_t> frequency;
+    std::vector<uint32_t> next_kernel;
+    if (policy == UVM_POLICY_LFU) {
+        frequency.assign(_num_pages, 0);
+    }
+
+    // Belady: next launch touching the page, per touch of the current block of
+    // launches in replay order. The backward pass only keeps next_kernel as of
+    // the end of every block; the block is expanded from it when replay gets
+    // there, so next_use holds one block instead of the whole trace.
+    std::vector<uint32_t> next_use;
+    std::vector<uint64_t> set_touches;
+    std::vector<uint32_t> block_ends;
+    std::vector<std::vector<uint32_t>> block_next;
+    size_t block = 0;
+    if (policy == UVM_POLICY_BELADY) {
+        set_touches.assign(num_sets(), 0);
+        for (uint32_t set = 0; set < num_sets(); set++) {
+            for (uint64_t r = _set_offsets[set]; r < _set_offsets[set + 1]; r++) {
+                set_touches[set] += _set_runs[r].count;
+            }
+        }
+        uint64_t touches = 0;
+        for (uint32_t set : _kernel_sets) {
+            touches += set_touches[set];
+        }
+        // blocks of about sqrt(touches * pages) touches balance the snapshots against next_use
+        uint64_t block_touches = std::max<uint64_t>(std::sqrt((double)touches * _num_pages), _num_pages);
+        uint64_t filled = 0;
+        for (uint32_t k = 0; k < _kernel_sets.size(); k++) {
+            filled += set_touches[_kernel_sets[k]];
+            if (filled >= block_touches || k + 1 == _kernel_sets.size()) {
+                block_ends.push_back(k + 1);
+                filled = 0;
+            }
+        }
+        block_next.resize(block_ends.size());
+        next_kernel.assign(_num_pages, NO_KERNEL);
+        size_t b = block_ends.size();
+        for (uint32_t k = _kernel_sets.size(); k-- > 0;) {
+            if (b > 0 && k + 1 == block_ends[b - 1]) {
+                block_next[--b] = next_kernel;
+            }
+            uint32_t set = _kernel_sets[k];
+            for (uint64_t r = _set_offsets[set]; r < _set_offsets[set + 1]; r++) {
+                const PageRun_t& run = _set_runs[r];
+                for (uint32_t page = run.first; page < run.first + run.count; page++) {
+                    next_kernel[page] = k;
+                }
+            }
+        }
+    }
+
+    auto expand_block = [&](size_t b) {
+        uint32_t begin = b > 0 ? block_ends[b - 1] : 0;
+        uint64_t t = 0;
+        for (uint32_t k = begin; k < block_ends[b]; k++) {
+            t += set_touches[_kernel_sets[k]];
+        }
+        next_use.resize(t);
+        std::vector<uint32_t> next = std::move(block_next[b]);
+        for (uint32_t k = block_ends[b]; k-- > begin;) {
+            uint32_t set = _kernel_sets[k];
+            for (uint64_t r = _set_offsets[set + 1]; r-- > _set_offsets[set];) {
+                const PageRun_t& run = _set_runs[r];
+                for (uint32_t page = run.first + run.count; page-- > run.first;) {
+                    next_use[--t] = next[page];
+                    next[page] = k;
+                }
+            }
+        }
+    };
+
+    std::vector<HeapEntry_t> heap;
+    std::vector<uint32_t> pending;
+    uint64_t resident = 0;
+    uint64_t touch_index = 0;
+    size_t release = 0;
+
+    auto key_of = [&](uint32_t page) -> uint64_t {
+        switch (policy) {
+            case UVM_POLICY_LFU:
+                return ((uint64_t)frequency[page] << 32) | last_kernel[page];
+            case UVM_POLICY_BELADY:
+                // farthest next use first, pages never used again before anything else
+                return NO_KERNEL - next_kernel[page];
+            default:
+                return last_kernel[page];
+        }
+    };
+
+    for (uint32_t k = 0; k < _kernel_sets.size(); k++) {
+        if (policy == UVM_POLICY_BELADY && k == (block > 0 ? block_ends[block - 1] : 0)) {
+            expand_block(block++);
+            touch_index = 0;
+        }
+        for (; release < _releases.size() && _releases[release].kernel <= k; release++) {
+            const PageRun_t& run = _releases[release].run;
+            for (uint32_t page = run.first; page < run.first + run.count; page++) {
+                if (state[page] == PAGE_RESIDENT) {
+                    resident--;
+                    version[page]++;
+                }
+                state[page] = PAGE_RELEASED;
+            }
+        }
+
+        uint32_t name = _kernel_names[k];
+        bool thrashing = false;
+        uint32_t set = _kernel_sets[k];
+        for (uint64_t r = _set_offsets[set]; r < _set_offsets[set + 1]; r++) {
+            const PageRun_t& run = _set_runs[r];
+            for (uint32_t page = run.first; page < run.first + run.count; page++) {
+                result.touches++;
+                if (policy == UVM_POLICY_LFU) {
+                    frequency[page]++;
+                } else if (policy == UVM_POLICY_BELADY) {
+                    next_kernel[page] = next_use[touch_index++];
+                }
+                if (state[page] != PAGE_RESIDENT) {
+                    result.faults++;
+                    if (state[page] == PAGE_EVICTED) {
+                        result.refaults++;
+                        result.name_refaults[name]++;
+                        thrashing = true;
+                    } else {
+                        result.cold_faults++;
+                    }
+                    while (resident >= result.capacity_pages) {
+                        uint32_t victim = UINT32_MAX;
+                        while (!heap.empty()) {
+                            std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry_t>());
+                            HeapEntry_t entry = heap.back();
+                            heap.pop_back();
+                            if (state[entry.page] == PAGE_RESIDENT && version[entry.page] == entry.version) {
+                                victim = entry.page;
+                                break;
+                            }
+                        }
+                        if (victim == UINT32_MAX) {
+                            // everything resident belongs to this launch: it comes back in once more
+                            victim = pending.back();
+                            pending.pop_back();
+                            result.forced_evictions++;
+                            result.faults++;
+                            result.migrated_in++;
+                            thrashing = true;
+                        }
+                        state[victim] = PAGE_EVICTED;
+                        version[victim]++;
+                        resident--;
+                        result.evictions++;
+                        result.migrated_out++;
+                    }
+                    state[page] = PAGE_RESIDENT;
+                    resident++;
+                    result.migrated_in++;
+                }
+                // pages of the running launch are not eviction candidates until it ends
+                version[page]++;
+                last_kernel[page] = k;
+                pending.push_back(page);
+            }
+        }
+
+        for (uint32_t page : pending) {
+            if (state[page] == PAGE_RESIDENT && last_kernel[page] == k) {
+                heap.push_back(HeapEntry_t{key_of(page), page, version[page]});
+                std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry_t>());
+            }
+        }
+        pending.clear();
+        if (heap.size() > 2 * resident + 4096) {
+            heap.erase(std::remove_if(heap.begin(), heap.end(), [&](const HeapEntry_t& entry) {
+                return state[entry.page] != PAGE_RESIDENT || version[entry.page] != entry.version;
+            }), heap.end());
+            std::make_heap(heap.begin(), heap.end(), std::greater<HeapEntry_t>());
+        }
+
+        if (thrashing) {
+            result.thrashing_launches++;
+            result.name_thrashing_launches[name]++;
+        }
+    }
+    return result;
+}
+
+
+const char* uvm_policy_name(UvmPolicy_t policy) {
+    switch (policy) {
+        case UVM_POLICY_LRU:
+            return "LRU";
+        case UVM_POLICY_LFU:
+            return "LFU";
+        case UVM_POLICY_BELADY:
+            return "Belady";
+        default:
+            return "unknown";
+    }
+}
+
+}   // yosemite
@@ -0,0 +1,381 @@
+#include "utils/warp_simd.h"
+#include "utils/helper.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YOSEMITE_X86 1
+#endif
+
+namespace yosemite {
+
+static constexpr int WARP_SIZE = 32;
+
+typedef uint32_t (*ActiveMaskFn)(const uint64_t*);
+typedef uint32_t (*UniqueMaskFn)(const uint64_t*, uint32_t, uint32_t);
+typedef void (*MatchAnyFn)(const uint64_t*, uint32_t, uint32_t, uint32_t*);
+typedef uint32_t (*StrideMaskFn)(const uint64_t*, uint32_t, int64_t);
+typedef uint32_t (*BankLoadFn)(const uint64_t*, uint32_t, uint32_t);
+
+static constexpr uint64_t NUM_BANKS = 32;
+
+
+static uint32_t active_mask_scalar(const uint64_t* addresses) {
+    uint32_t mask = 0;
+    for (int i = 0; i < WARP_SIZE; i++) {
+        mask |= (uint32_t)(addresses[i] != 0) << i;
+    }
+    return mask;
+}
+
+
+static void match_any_scalar(const uint64_t* addresses, uint32_t active, uint32_t shift, uint32_t* masks) {
+    for (int i = 0; i < WARP_SIZE; i++) {
+        masks[i] = 0;
+        if (!(active >> i & 1)) {
+            continue;
+        }
+        uint64_t key = addresses[i] >> shift;
+        for (int j = 0; j < WARP_SIZE; j++) {
+            masks[i] |= (uint32_t)((addresses[j] >> shift) == key) << j;
+        }
+        masks[i] &= active;
+    }
+}
+
+
+static uint32_t unique_mask_scalar(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    uint32_t unique = 0;
+    for (int i = 0; i < WARP_SIZE; i++) {
+        if (!(active >> i & 1)) {
+            continue;
+        }
+        uint64_t key = addresses[i] >> shift;
+        bool first = true;
+        for (int j = 0; j < i && first; j++) {
+            first = !((active >> j & 1) && (addresses[j] >> shift) == key);
+        }
+        unique |= (uint32_t)first << i;
+    }
+    return unique;
+}
+
+
+// address lane 0 would have if every lane followed the lowest active one by stride
+static inline uint64_t stride_origin(const uint64_t* addresses, uint32_t active, int64_t stride) {
+    int first = __builtin_ctz(active);
+    return addresses[first] - (uint64_t)first * (uint64_t)stride;
+}
+
+
+static uint32_t stride_mask_scalar(const uint64_t* addresses, uint32_t active, int64_t stride) {
+    if (active == 0) {
+        return 0;
+    }
+    uint64_t expected = stride_origin(addresses, active, stride);
+    uint32_t mask = 0;
+    for (int i = 0; i < WARP_SIZE; i++) {
+        mask |= (uint32_t)(addresses[i] == expected) << i;
+        expected += stride;
+    }
+    return mask & active;
+}
+
+
+static uint32_t bank_load_scalar(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    uint32_t unique = unique_mask_scalar(addresses, active, shift);
+    uint32_t counts[NUM_BANKS] = {0};
+    uint32_t max_count = 0;
+    for (uint32_t pending = unique; pending != 0; pending &= pending - 1) {
+        uint32_t bank = (addresses[__builtin_ctz(pending)] >> shift) & (NUM_BANKS - 1);
+        max_count = std::max(max_count, ++counts[bank]);
+    }
+    return max_count;
+}
+
+
+#ifdef YOSEMITE_X86
+
+__attribute__((target("avx2")))
+static inline uint32_t eq_mask_avx2(const __m256i* keys, __m256i key) {
+    uint32_t mask = 0;
+    for (int v = 0; v < WARP_SIZE / 4; v++) {
+        __m256i eq = _mm256_cmpeq_epi64(keys[v], key);
+        mask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << (v * 4);
+    }
+    return mask;
+}
+
+
+__attribute__((target("avx2")))
+static inline void load_keys_avx2(const uint64_t* addresses, uint32_t shift, __m256i* keys) {
+    __m128i count = _mm_cvtsi32_si128(shift);
+    for (int v = 0; v < WARP_SIZE / 4; v++) {
+        keys[v] = _mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)(addresses + v * 4)), count);
+    }
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t active_mask_avx2(const uint64_t* addresses) {
+    __m256i zero = _mm256_setzero_si256();
+    uint32_t inactive = 0;
+    for (int v = 0; v < WARP_SIZE / 4; v++) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(addresses + v * 4)), zero);
+        inactive |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << (v * 4);
+    }
+    return ~inactive;
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t unique_mask_avx2(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    __m256i keys[WARP_SIZE / 4];
+    load_keys_avx2(addresses, shift, keys);
+    uint32_t unique = 0;
+    for (uint32_t pending = active; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        uint32_t eq = eq_mask_avx2(keys, _mm256_set1_epi64x(addresses[i] >> shift)) & active;
+        // i is the lowest pending lane of its group, so it is the first occurrence
+        unique |= 1u << i;
+        pending &= ~eq;
+    }
+    return unique;
+}
+
+
+__attribute__((target("avx2")))
+static void match_any_avx2(const uint64_t* addresses, uint32_t active, uint32_t shift, uint32_t* masks) {
+    __m256i keys[WARP_SIZE / 4];
+    load_keys_avx2(addresses, shift, keys);
+    for (int i = 0; i < WARP_SIZE; i++) {
+        masks[i] = 0;
+    }
+    // lanes sharing a key get the same mask, compute it once per group
+    for (uint32_t pending = active; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        uint32_t eq = eq_mask_avx2(keys, _mm256_set1_epi64x(addresses[i] >> shift)) & active;
+        for (uint32_t group = eq; group != 0; group &= group - 1) {
+            masks[__builtin_ctz(group)] = eq;
+        }
+        pending &= ~eq;
+    }
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t stride_mask_avx2(const uint64_t* addresses, uint32_t active, int64_t stride) {
+    if (active == 0) {
+        return 0;
+    }
+    uint64_t origin = stride_origin(addresses, active, stride);
+    __m256i expected = _mm256_set_epi64x(origin + 3 * stride, origin + 2 * stride,
+                                         origin + stride, origin);
+    __m256i step = _mm256_set1_epi64x(4 * stride);
+    uint32_t mask = 0;
+    for (int v = 0; v < WARP_SIZE / 4; v++) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(addresses + v * 4)), expected);
+        mask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << (v * 4);
+        expected = _mm256_add_epi64(expected, step);
+    }
+    return mask & active;
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t bank_load_avx2(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    __m256i keys[WARP_SIZE / 4];
+    load_keys_avx2(addresses, shift, keys);
+    uint32_t unique = 0;
+    for (uint32_t pending = active; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        unique |= 1u << i;
+        pending &= ~eq_mask_avx2(keys, _mm256_set1_epi64x(addresses[i] >> shift));
+    }
+    // distinct words per bank, one vector compare per distinct bank
+    __m256i bank_mask = _mm256_set1_epi64x(NUM_BANKS - 1);
+    for (int v = 0; v < WARP_SIZE / 4; v++) {
+        keys[v] = _mm256_and_si256(keys[v], bank_mask);
+    }
+    uint32_t max_count = 0;
+    for (uint32_t pending = unique; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        uint32_t eq = eq_mask_avx2(keys, _mm256_set1_epi64x((addresses[i] >> shift) & (NUM_BANKS - 1))) & unique;
+        max_count = std::max(max_count, (uint32_t)__builtin_popcount(eq));
+        pending &= ~eq;
+    }
+    return max_count;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static inline uint32_t eq_mask_avx512(const __m512i* keys, __m512i key) {
+    uint32_t mask = 0;
+    for (int v = 0; v < WARP_SIZE / 8; v++) {
+        mask |= (uint32_t)_mm512_cmpeq_epi64_mask(keys[v], key) << (v * 8);
+    }
+    return mask;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void load_keys_avx512(const uint64_t* addresses, uint32_t shift, __m512i* keys) {
+    __m512i count = _mm512_set1_epi64(shift);
+    for (int v = 0; v < WARP_SIZE / 8; v++) {
+        keys[v] = _mm512_maskz_srlv_epi64(0xFF, _mm512_loadu_si512((const void*)(addresses + v * 8)), count);
+    }
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t active_mask_avx512(const uint64_t* addresses) {
+    uint32_t active = 0;
+    for (int v = 0; v < WARP_SIZE / 8; v++) {
+        __m512i lanes = _mm512_loadu_si512((const void*)(addresses + v * 8));
+        active |= (uint32_t)_mm512_test_epi64_mask(lanes, lanes) << (v * 8);
+    }
+    return active;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t unique_mask_avx512(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    __m512i keys[WARP_SIZE / 8];
+    load_keys_avx512(addresses, shift, keys);
+    uint32_t unique = 0;
+    for (uint32_t pending = active; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        uint32_t eq = eq_mask_avx512(keys, _mm512_set1_epi64(addresses[i] >> shift)) & active;
+        // i is the lowest pending lane of its group, so it is the first occurrence
+        unique |= 1u << i;
+        pending &= ~eq;
+    }
+    return unique;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static void match_any_avx512(const uint64_t* addresses, uint32_t active, uint32_t shift, uint32_t* masks) {
+    __m512i keys[WARP_SIZE / 8];
+    load_keys_avx512(addresses, shift, keys);
+    for (int i = 0; i < WARP_SIZE; i++) {
+        masks[i] = 0;
+    }
+    for (uint32_t pending = active; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        uint32_t eq = eq_mask_avx512(keys, _mm512_set1_epi64(addresses[i] >> shift)) & active;
+        for (uint32_t group = eq; group != 0; group &= group - 1) {
+            masks[__builtin_ctz(group)] = eq;
+        }
+        pending &= ~eq;
+    }
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t stride_mask_avx512(const uint64_t* addresses, uint32_t active, int64_t stride) {
+    if (active == 0) {
+        return 0;
+    }
+    uint64_t origin = stride_origin(addresses, active, stride);
+    __m512i expected = _mm512_set_epi64(origin + 7 * stride, origin + 6 * stride,
+                                        origin + 5 * stride, origin + 4 * stride,
+                                        origin + 3 * stride, origin + 2 * stride,
+                                        origin + stride, origin);
+    __m512i step = _mm512_set1_epi64(8 * stride);
+    uint32_t mask = 0;
+    for (int v = 0; v < WARP_SIZE / 8; v++) {
+        mask |= (uint32_t)_mm512_cmpeq_epi64_mask(
+                    _mm512_loadu_si512((const void*)(addresses + v * 8)), expected) << (v * 8);
+        expected = _mm512_add_epi64(expected, step);
+    }
+    return mask & active;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t bank_load_avx512(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    __m512i keys[WARP_SIZE / 8];
+    load_keys_avx512(addresses, shift, keys);
+    uint32_t unique = 0;
+    for (uint32_t pending = active; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        unique |= 1u << i;
+        pending &= ~eq_mask_avx512(keys, _mm512_set1_epi64(addresses[i] >> shift));
+    }
+    __m512i bank_mask = _mm512_set1_epi64(NUM_BANKS - 1);
+    for (int v = 0; v < WARP_SIZE / 8; v++) {
+        keys[v] = _mm512_and_si512(keys[v], bank_mask);
+    }
+    uint32_t max_count = 0;
+    for (uint32_t pending = unique; pending != 0;) {
+        int i = __builtin_ctz(pending);
+        uint32_t eq = eq_mask_avx512(keys, _mm512_set1_epi64((addresses[i] >> shift) & (NUM_BANKS - 1))) & unique;
+        max_count = std::max(max_count, (uint32_t)__builtin_popcount(eq));
+        pending &= ~eq;
+    }
+    return max_count;
+}
+
+#endif  // YOSEMITE_X86
+
+
+typedef struct WarpSimdImpl {
+    const char* isa;
+    ActiveMaskFn active_mask;
+    UniqueMaskFn unique_mask;
+    MatchAnyFn match_any;
+    StrideMaskFn stride_mask;
+    BankLoadFn bank_load;
+} WarpSimdImpl_t;
+
+
+static WarpSimdImpl_t select_warp_simd() {
+#ifdef YOSEMITE_X86
+    if (cpu_supports_avx512()) {
+        return {"avx512", active_mask_avx512, unique_mask_avx512, match_any_avx512,
+                stride_mask_avx512, bank_load_avx512};
+    }
+    if (cpu_supports_avx2()) {
+        return {"avx2", active_mask_avx2, unique_mask_avx2, match_any_avx2,
+                stride_mask_avx2, bank_load_avx2};
+    }
+#endif
+    return {"scalar", active_mask_scalar, unique_mask_scalar, match_any_scalar,
+            stride_mask_scalar, bank_load_scalar};
+}
+
+static const WarpSimdImpl_t impl = select_warp_simd();
+
+
+uint32_t warp_active_mask(const uint64_t* addresses) {
+    return impl.active_mask(addresses);
+}
+
+
+uint32_t warp_unique_mask(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    return impl.unique_mask(addresses, active, shift);
+}
+
+
+void warp_match_any(const uint64_t* addresses, uint32_t active, uint32_t shift, uint32_t* masks) {
+    impl.match_any(addresses, active, shift, masks);
+}
+
+
+uint32_t warp_stride_mask(const uint64_t* addresses, uint32_t active, int64_t stride) {
+    return impl.stride_mask(addresses, active, stride);
+}
+
+
+uint32_t warp_bank_load(const uint64_t* addresses, uint32_t active, uint32_t shift) {
+    return impl.bank_load(addresses, active, shift);
+}
+
+
+const char* warp_simd_isa() {
+    return impl.isa;
+}
+
+}   // yosemite